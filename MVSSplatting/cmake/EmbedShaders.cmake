@@ -0,0 +1,36 @@
+# Writes OUTPUT: a header with the GLSL source of every file in SHADER_DIR, as embeddedShaders[<file name>] (see ShaderController).
+# Run as a script at build time: cmake -DSHADER_DIR=<folder> -DOUTPUT=<header> -P EmbedShaders.cmake
+# The sources are stored as byte arrays, which have no length limit per literal like string literals have on MSVC.
+
+file(GLOB SHADERS RELATIVE ${SHADER_DIR} ${SHADER_DIR}/*.*)
+list(SORT SHADERS)
+
+set(ARRAYS "")
+set(TABLE "")
+set(INDEX 0)
+foreach(NAME ${SHADERS})
+	file(READ ${SHADER_DIR}/${NAME} HEX_CONTENT HEX)
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BYTES "${HEX_CONTENT}")
+	string(APPEND ARRAYS "static const unsigned char embeddedShader${INDEX}[] = { ${BYTES}0x00 };\n")
+	string(APPEND TABLE "\t{ \"${NAME}\", reinterpret_cast<const char*>(embeddedShader${INDEX}) },\n")
+	math(EXPR INDEX "${INDEX} + 1")
+endforeach()
+
+file(WRITE ${OUTPUT}.tmp
+"// Generated from src/shaders by cmake/EmbedShaders.cmake, do not edit
+#ifndef EMBEDDED_SHADERS_H
+#define EMBEDDED_SHADERS_H
+
+#include <map>
+#include <string>
+
+${ARRAYS}
+// GLSL source per shader file name
+static const std::map<std::string, const char*> embeddedShaders = {
+${TABLE}};
+
+#endif // !EMBEDDED_SHADERS_H
+")
+# only touch the header if it changed, so an unchanged shader folder does not trigger a rebuild
+configure_file(${OUTPUT}.tmp ${OUTPUT} COPYONLY)
+file(REMOVE ${OUTPUT}.tmp)
@@ -0,0 +1,104 @@
+#ifndef ADAPTIVE_SAMPLER_H
+#define ADAPTIVE_SAMPLER_H
+
+#include <random>
+#include <numeric>
+#include <algorithm>
+
+// Places the transform feedback probes of a key view according to an importance map, instead of on a uniform grid.
+// The image is split in tiles, and each tile receives a part of the probe budget proportional to a mix of
+// how many of its pixels survived masking and how much detail it contains. The fractional share of each tile is
+// rounded by error diffusion, so that the tiles add up to the budget. Within a tile, the probes are placed on a
+// jittered (stratified) grid, and probes that land on masked pixels are handed to the next tiles.
+class AdaptiveSampler {
+
+public:
+	// 0: probes only follow the mask (like the uniform grid), 1: probes only follow the detail
+	float detailWeight = 0.5f;
+
+	// importance: per pixel (mask, detail), as calculated by importance.fs
+	// budget: nr of probes of the uniform grid, at most the capacity of the transform feedback buffer. Only as many probes
+	// are placed as the uniform grid would have kept after masking.
+	// probes: per probe (u, v, spacing relative to tfSubdivisions)
+	void Sample(const std::vector<glm::vec2>& importance, int width, int height, float tfSubdivisions, int budget, unsigned int seed, /*out*/ std::vector<glm::vec3>& probes) {
+
+		// tiles of 4 x 4 uniform grid cells
+		int tileSize = std::max(2, static_cast<int>(std::round(4 * tfSubdivisions)));
+		int nrTilesX = (width + tileSize - 1) / tileSize;
+		int nrTilesY = (height + tileSize - 1) / tileSize;
+
+		// sum the importance per tile
+		std::vector<glm::vec2> tileSums(nrTilesX * nrTilesY, glm::vec2(0));
+		ParallelFor(nrTilesY, [&](int begin, int end, int /*t*/) {
+			for (int tileY = begin; tileY < end; tileY++) {
+				for (int row = tileY * tileSize; row < std::min(height, (tileY + 1) * tileSize); row++) {
+					for (int col = 0; col < width; col++) {
+						tileSums[tileY * nrTilesX + col / tileSize] += importance[row * width + col];
+					}
+				}
+			}
+		});
+
+		glm::vec2 total(0);
+		for (glm::vec2& sum : tileSums) total += sum;
+		probes.clear();
+		if (total.x <= 0) return;
+		float detailWeight_ = total.y > 0 ? detailWeight : 0;
+		// the weights of the tiles add up to 1, so the rounded shares add up to at most this
+		double keptBudget = std::floor(static_cast<double>(budget) * total.x / (static_cast<double>(width) * height));
+		probes.reserve(static_cast<size_t>(keptBudget));
+
+		// stratified sampling per tile, in serpentine order so that the rounding error does not pile up on one side
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> jitter(0.0f, 1.0f);
+		std::vector<int> cells;
+		double carry = 0; // probes owed to the next tiles: the rounding error and the probes that landed on masked pixels
+		for (int tileY = 0; tileY < nrTilesY; tileY++) {
+			for (int step = 0; step < nrTilesX; step++) {
+				int tileX = tileY % 2 == 0 ? step : nrTilesX - 1 - step;
+				glm::vec2 sum = tileSums[tileY * nrTilesX + tileX];
+				if (sum.x <= 0) continue; // nothing kept in this tile, its detail is 0 as well
+
+				float weight = (1 - detailWeight_) * sum.x / total.x + (detailWeight_ > 0 ? detailWeight_ * sum.y / total.y : 0);
+				double wanted = weight * keptBudget + carry;
+				int n = std::max(0, static_cast<int>(std::floor(wanted + 0.5)));
+				if (n == 0) {
+					carry = wanted;
+					continue;
+				}
+
+				// a grid of at least n cells with about square cells, of which n random ones get a probe
+				int x0 = tileX * tileSize;
+				int y0 = tileY * tileSize;
+				int w = std::min(tileSize, width - x0);
+				int h = std::min(tileSize, height - y0);
+				int gx = std::max(1, static_cast<int>(std::round(std::sqrt(n * static_cast<float>(w) / h))));
+				int gy = (n + gx - 1) / gx;
+				cells.resize(gx * gy);
+				std::iota(cells.begin(), cells.end(), 0);
+				std::shuffle(cells.begin(), cells.end(), rng);
+				float spacing = std::sqrt(static_cast<float>(w) * h / n) / tfSubdivisions;
+
+				int nrPlaced = 0;
+				for (int c = 0; c < n; c++) {
+					int i = cells[c] % gx;
+					int j = cells[c] / gx;
+					// a few tries to find a kept pixel in the cell
+					for (int attempt = 0; attempt < 4; attempt++) {
+						float x = x0 + (i + jitter(rng)) * w / gx;
+						float y = y0 + (j + jitter(rng)) * h / gy;
+						int col = std::min(static_cast<int>(x), width - 1);
+						int row = std::min(static_cast<int>(y), height - 1);
+						if (importance[row * width + col].x <= 0) continue;
+						probes.push_back(glm::vec3(x / width, y / height, spacing));
+						nrPlaced++;
+						break;
+					}
+				}
+				carry = wanted - nrPlaced;
+			}
+		}
+	}
+};
+
+#endif // !ADAPTIVE_SAMPLER_H
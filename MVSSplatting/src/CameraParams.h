@@ -13,11 +13,21 @@ public:
 	float cx = 0;
 	float cy = 0;
 
+	// Lens distortion of the COLMAP camera model. The images are undistorted while they are loaded (see Undistorter.h),
+	// to the pinhole camera with the resolution, focal length and principal point of the first camera, which is what the rest uses.
+	bool distorted = false;
+	bool fisheye = false;
+	float k[6] = { 0, 0, 0, 0, 0, 0 }; // radial: numerator k1 k2 k3, denominator k4 k5 k6 (FULL_OPENCV), or the k1 - k4 of fisheye models
+	float p[2] = { 0, 0 };             // tangential
+
 	Intrinsics() {}
 
 	Intrinsics(int width, int height, float fx, float fy, float cx, float cy) : 
 		width(width), height(height), fx(fx), fy(fy), cx(cx), cy(cy) {}
 
+	// the cameras of cameras.bin, by camera_id (see Extrinsics::cameraIds), with their own distortion and pinhole parameters
+	std::map<uint32_t, Intrinsics> cameras;
+
 	Intrinsics(std::string camerasBinPath) {
 		this->camerasBinPath = camerasBinPath;
 	}
@@ -32,6 +42,8 @@ public:
 		size_t nrCameras;
 		file.read(reinterpret_cast<char*>(&nrCameras), sizeof(nrCameras));
 
+		bool first = true;
+		uint32_t firstId = 0;
 		while (file.peek() != EOF) {
 			uint32_t camera_id;
 			uint32_t model_id;
@@ -43,35 +55,103 @@ public:
 			file.read(reinterpret_cast<char*>(&width_), sizeof(width_));
 			file.read(reinterpret_cast<char*>(&height_), sizeof(height_));
 
-			width = width_;
-			height = height_;
-			
-			// Only allow models with no distortion
-			if (model_id == 0) { // SIMPLE_PINHOLE
-				params.resize(3);
-				file.read(reinterpret_cast<char*>(params.data()), sizeof(double) * 3);
-				fx = params[0];
-				cx = params[1];
-				cy = params[2];
+			// nr of parameters per COLMAP model id, 0 = unsupported (FOV, THIN_PRISM_FISHEYE)
+			const int nrParams[] = { 3, 4, 4, 5, 8, 8, 12, 0, 4, 5, 0 };
+			if (model_id >= sizeof(nrParams) / sizeof(nrParams[0]) || nrParams[model_id] == 0) {
+				std::cerr << "Unsupported camera model ID: " << model_id << "\nExpected SIMPLE_PINHOLE, PINHOLE, SIMPLE_RADIAL, RADIAL, OPENCV, OPENCV_FISHEYE, FULL_OPENCV, SIMPLE_RADIAL_FISHEYE or RADIAL_FISHEYE\n";
+				return false;
+			}
+			params.resize(nrParams[model_id]);
+			file.read(reinterpret_cast<char*>(params.data()), sizeof(double) * params.size());
+
+			Intrinsics camera(width_, height_, params[0], params[0], params[1], params[2]);
+			bool separateFocals = model_id == 1 || model_id == 4 || model_id == 5 || model_id == 6;
+			int d = separateFocals ? 4 : 3; // first distortion parameter
+			if (separateFocals) {
+				camera.fy = params[1];
+				camera.cx = params[2];
+				camera.cy = params[3];
 			}
-			else if (model_id == 1) { // PINHOLE 
-				params.resize(4);
-				file.read(reinterpret_cast<char*>(params.data()), sizeof(double) * 4);
-				fx = params[0];
-				fy = params[1];
-				cx = params[2];
-				cy = params[3];
+			camera.fisheye = model_id == 5 || model_id == 8 || model_id == 9;
+			switch (model_id) {
+			case 2: case 8: // SIMPLE_RADIAL, SIMPLE_RADIAL_FISHEYE: k
+				camera.k[0] = params[d];
+				break;
+			case 3: case 9: // RADIAL, RADIAL_FISHEYE: k1 k2
+				camera.k[0] = params[d];
+				camera.k[1] = params[d + 1];
+				break;
+			case 4: // OPENCV: k1 k2 p1 p2
+				camera.k[0] = params[d];
+				camera.k[1] = params[d + 1];
+				camera.p[0] = params[d + 2];
+				camera.p[1] = params[d + 3];
+				break;
+			case 5: // OPENCV_FISHEYE: k1 k2 k3 k4
+				for (int i = 0; i < 4; i++) camera.k[i] = params[d + i];
+				break;
+			case 6: // FULL_OPENCV: k1 k2 p1 p2 k3 k4 k5 k6
+				camera.k[0] = params[d];
+				camera.k[1] = params[d + 1];
+				camera.p[0] = params[d + 2];
+				camera.p[1] = params[d + 3];
+				for (int i = 2; i < 6; i++) camera.k[i] = params[d + 2 + i];
+				break;
 			}
-			else {
-				std::cerr << "Unsupported camera model ID: " << model_id << "\nExpected 0 (SIMPLE_PINHOLE) or 1 (PINHOLE)\n";
+			camera.distorted = camera.fisheye || std::any_of(std::begin(camera.k), std::end(camera.k), [](float v) { return v != 0; }) || camera.p[0] != 0 || camera.p[1] != 0;
+
+			// the images of the other cameras are remapped to the first one, which needs the same resolution for the textures
+			if (first) {
+				firstId = camera_id;
+				width = camera.width;
+				height = camera.height;
+				fx = camera.fx;
+				fy = camera.fy;
+				cx = camera.cx;
+				cy = camera.cy;
+			}
+			else if (camera.width != width || camera.height != height) {
+				printf("Error: camera %u is %d x %d pixels and camera %u is %d x %d, all cameras need the same resolution\n",
+					camera_id, camera.width, camera.height, firstId, width, height);
 				return false;
 			}
-			if (fy == 0) fy = fx;
-			printf("res = [%d, %d], f = [%.2f, %.2f], c = [%.2f, %.2f]\n", width, height, fx, fx, cx, cy);
+			first = false;
+			cameras[camera_id] = camera;
+			printf("res = [%d, %d], f = [%.2f, %.2f], c = [%.2f, %.2f]%s\n", camera.width, camera.height, camera.fx, camera.fy, camera.cx, camera.cy,
+				camera.distorted ? (camera.fisheye ? ", fisheye distortion" : ", radial distortion") : "");
+		}
+		if (cameras.size() > 1) {
+			printf("%d cameras, the images are remapped to the pinhole camera of camera %u\n", (int)cameras.size(), firstId);
 		}
 
 		return true;
 	}
+
+	// normalized image coordinates (x / z, y / z) -> their distorted position, like COLMAP's camera models
+	glm::vec2 Distort(glm::vec2 xy) const {
+		if (fisheye) {
+			float r = glm::length(xy);
+			if (r < 1e-8f) return xy;
+			float theta = std::atan(r);
+			float theta2 = theta * theta;
+			float thetaDistorted = theta * (1 + theta2 * (k[0] + theta2 * (k[1] + theta2 * (k[2] + theta2 * k[3]))));
+			return xy * (thetaDistorted / r);
+		}
+		float r2 = glm::dot(xy, xy);
+		float radial = (1 + r2 * (k[0] + r2 * (k[1] + r2 * k[2]))) / (1 + r2 * (k[3] + r2 * (k[4] + r2 * k[5])));
+		float xy2 = 2 * xy.x * xy.y;
+		return xy * radial + glm::vec2(p[0] * xy2 + p[1] * (r2 + 2 * xy.x * xy.x), p[1] * xy2 + p[0] * (r2 + 2 * xy.y * xy.y));
+	}
+
+	// whether the images of camera need to be remapped to this pinhole camera (see Undistorter.h)
+	bool NeedsRemap(const Intrinsics& camera) const {
+		return camera.distorted || camera.fx != fx || camera.fy != fy || camera.cx != cx || camera.cy != cy;
+	}
+
+	// whether the images of any camera need to be remapped
+	bool NeedsRemap() const {
+		return std::any_of(cameras.begin(), cameras.end(), [&](const std::pair<const uint32_t, Intrinsics>& pair) { return NeedsRemap(pair.second); });
+	}
 };
 
 struct CameraPose {
@@ -89,6 +169,7 @@ public:
 	std::string imagesBinPath;
 	std::vector<int> imageIds;
 	std::unordered_map<int, std::string> imageNames;
+	std::unordered_map<int, uint32_t> cameraIds; // of Intrinsics::cameras
 	std::unordered_map<int, CameraPose> poses; // needed for 'view' matrix
 
 	Extrinsics(std::string imagesBinPath, bool eval) : imagesBinPath(imagesBinPath), eval(eval){}
@@ -141,6 +222,7 @@ public:
 			imageIds.push_back(image_id);
 			poses[image_id] = { R, T, model, view, pos, forward };
 			imageNames[image_id] = image_name;
+			cameraIds[image_id] = camera_id;
 		}
 
 		// sort images alphabetically
@@ -182,12 +264,70 @@ private:
 	}
 };
 
+// Streaming histogram of the depths of the SfM points seen by 1 image, in bins of 1/32 octave (~2% of the depth)
+// from 2^-16 to 2^16 scene units, so it needs no range up front and 1 distant point costs 1 count instead of a range.
+struct DepthHistogram {
+	static constexpr int binsPerOctave = 32;
+	static constexpr int minOctave = -16;
+	static constexpr int nrBins = 32 * binsPerOctave;
+
+	std::vector<uint32_t> bins; // allocated by the first Add()
+	uint32_t count = 0;
+
+	void Add(float depth) {
+		if (!(depth > 0)) return; // behind the camera
+		if (bins.empty()) bins.resize(nrBins, 0);
+		bins[Bin(depth)]++;
+		count++;
+	}
+
+	// depth below which <percentile>% of the points lie, interpolated within its bin
+	float Percentile(float percentile) const {
+		float target = glm::clamp(percentile / 100.0f, 0.0f, 1.0f) * count;
+		float below = 0;
+		for (int bin = 0; bin < static_cast<int>(bins.size()); bin++) {
+			if (bins[bin] > 0 && below + bins[bin] >= target) {
+				return BinToDepth(bin + (target - below) / bins[bin]);
+			}
+			below += bins[bin];
+		}
+		return BinToDepth(nrBins);
+	}
+
+	// fraction of the points nearer than depth, interpolated within its bin
+	float Cdf(float depth) const {
+		if (count == 0 || !(depth > 0)) return 0;
+		float position = glm::clamp((std::log2(depth) - minOctave) * binsPerOctave, 0.0f, static_cast<float>(nrBins));
+		int bin = std::min(static_cast<int>(position), nrBins - 1);
+		float below = 0;
+		for (int b = 0; b < bin; b++) {
+			below += bins[b];
+		}
+		return (below + (position - bin) * bins[bin]) / count;
+	}
+
+private:
+	static int Bin(float depth) {
+		return glm::clamp(static_cast<int>((std::log2(depth) - minOctave) * binsPerOctave), 0, nrBins - 1);
+	}
+
+	static float BinToDepth(float bin) {
+		return std::exp2(bin / binsPerOctave + minOctave);
+	}
+};
+
 class SfmPoints {
 public:
 	std::string points3DBinPath;
 	std::unordered_map<int, std::vector<glm::vec3>> points;
 	std::unordered_map<int, std::vector<glm::vec3>> colors;
 	std::unordered_map<int, glm::vec2> depthRanges; // [near, far] per image id
+	std::unordered_map<int, DepthHistogram> depthHistograms; // per image id, of the same points as depthRanges
+
+	// depthRanges between these percentiles of the depths, instead of the min and max, so that a few distant or
+	// mis-triangulated points do not stretch the sweep. Set before Init().
+	float nearPercentile = 0;
+	float farPercentile = 100;
 
 	SfmPoints() {};
 	SfmPoints(std::string points3DBinPath) : points3DBinPath(points3DBinPath) { }
@@ -247,10 +387,18 @@ public:
 					float z = glm::dot(glm::vec3(views[image_id]), pos) + views[image_id].w;
 					depthRanges[image_id].x = std::min(depthRanges[image_id].x, z); // near
 					depthRanges[image_id].y = std::max(depthRanges[image_id].y, z); // far
+					depthHistograms[image_id].Add(z);
 				}
 			}
 		}
 
+		if (nearPercentile > 0 || farPercentile < 100) {
+			for (auto& pair : depthHistograms) {
+				if (pair.second.count == 0) continue;
+				depthRanges[pair.first] = glm::vec2(pair.second.Percentile(nearPercentile), pair.second.Percentile(farPercentile));
+			}
+		}
+
 		return true;
 	}
 };
@@ -0,0 +1,359 @@
+#ifndef CPU_SPLATTER_H
+#define CPU_SPLATTER_H
+
+// Multithreaded CPU versions of the consistency check (mask_bad_pixels3.fs) and the splat extraction (write_splats.vs/.gs),
+// for depth maps that are on the host: it needs no GL context. The views are either copies of the textures (see
+// SplatGenerator::ReadHostViews) or loaded from files by LoadView (see --host-depth), which runs without a GPU at all.
+// Every view holds its maps with rows from the top like the textures, and they are sampled like the shaders sample them:
+// nearest for the depth, mask and confidence, bilinear (clamped to the edge) for the colors and user masks. Both passes
+// gather per output pixel or probe, so the threads never write to the same memory.
+class CpuSplatter {
+
+public:
+	struct View {
+		std::vector<unsigned char> color;      // RGB
+		std::vector<float> depth;              // only needed for key views
+		std::vector<unsigned char> mask;       // > 127 = good pixel
+		std::vector<unsigned char> confidence;
+		std::vector<unsigned char> userMask;   // 0 = ignore the pixel, empty = keep all (see TexController::LoadUserMasks)
+	};
+	std::unordered_map<int, View> views;
+
+	CpuSplatter(Intrinsics intrinsics, Extrinsics extrinsics) : intrinsics(intrinsics), extrinsics(extrinsics) {}
+
+	// Load view id without GL: the colors of the image at imagePath, remapped to the pinhole camera if remap is not null
+	// (like TexController::Init), and the depth map at depthPath for key views (see ReadDepthMap, "" for the other views).
+	// Every pixel with a depth is a good pixel with full confidence.
+	bool LoadView(int id, const std::string& imagePath, const std::string& depthPath, const Undistorter* remap) {
+		View& view = views[id];
+		int width, height, channels;
+		unsigned char* image = stbi_load(imagePath.c_str(), &width, &height, &channels, 3);
+		if (!image) {
+			printf("Error: failed to load image %s\n", imagePath.c_str());
+			return false;
+		}
+		if (width != intrinsics.width || height != intrinsics.height) {
+			printf("Error: image %s is %d x %d pixels instead of %d x %d\n", imagePath.c_str(), width, height, intrinsics.width, intrinsics.height);
+			stbi_image_free(image);
+			return false;
+		}
+		view.color.assign(image, image + 3 * width * height);
+		stbi_image_free(image);
+		if (remap) {
+			std::vector<unsigned char> undistorted;
+			remap->Remap(view.color.data(), 3, undistorted);
+			view.color.swap(undistorted);
+			view.userMask = remap->ValidMask();
+		}
+		if (depthPath.empty()) return true;
+
+		if (!ReadDepthMap(depthPath, view.depth)) return false;
+		view.mask.resize(view.depth.size());
+		for (size_t i = 0; i < view.depth.size(); i++) {
+			view.mask[i] = view.depth[i] > 0 ? 255 : 0;
+		}
+		view.confidence.assign(view.depth.size(), 255);
+		return true;
+	}
+
+	// Depth maps on disk: width x height 32-bit floats (in the byte order of the machine) with rows from the top, the
+	// distance along the optical axis of the pinhole camera, and 0 where there is no depth.
+	bool ReadDepthMap(const std::string& path, /*out*/ std::vector<float>& depth) const {
+		std::ifstream file(path, std::ios::binary);
+		depth.resize(static_cast<size_t>(intrinsics.width) * intrinsics.height);
+		if (!file.read(reinterpret_cast<char*>(depth.data()), depth.size() * sizeof(float)) || file.peek() != EOF) {
+			printf("Error: %s is not a depth map of %d x %d floats\n", path.c_str(), intrinsics.width, intrinsics.height);
+			return false;
+		}
+		return true;
+	}
+
+	static bool WriteDepthMap(const std::string& path, const std::vector<float>& depth) {
+		std::ofstream file(path, std::ios::binary);
+		if (!file.write(reinterpret_cast<const char*>(depth.data()), depth.size() * sizeof(float))) {
+			printf("Error: could not write %s\n", path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// Like mask_bad_pixels3.fs: mask off the pixels of key camera idA whose point lies clearly in front of the surface
+	// that idB sees there, with a different color, and the other way around
+	void MaskBadPixels(int idA, int idB) {
+		View& a = views[idA];
+		View& b = views[idB];
+		int width = intrinsics.width;
+		ParallelFor(intrinsics.height, [&](int begin, int end, int /*t*/) {
+			for (int row = begin; row < end; row++) {
+				for (int col = 0; col < width; col++) {
+					glm::vec2 texCoords((col + 0.5f) / width, (row + 0.5f) / intrinsics.height);
+					int i = row * width + col;
+					if (!CheckProjectedPixel(texCoords, a, b, extrinsics.poses[idA].model, extrinsics.poses[idB].view)) a.mask[i] = 0;
+					if (!CheckProjectedPixel(texCoords, b, a, extrinsics.poses[idB].model, extrinsics.poses[idA].view)) b.mask[i] = 0;
+				}
+			}
+		});
+	}
+
+	// Like write_splats.vs and write_splats.gs: appends the splats of key camera keyCamId to splats, in the order of the probes.
+	// probes: (u, v, spacing relative to tfSubdivisions) per probe, empty for the uniform grid of FrameBufferController.
+	// colorNeighbors: the (at most 4) views for a multi-view color, empty for the color of the key view alone.
+	void ExtractSplats(int keyCamId, float tfSubdivisions, const std::vector<glm::vec3>& probes, const std::vector<int>& colorNeighbors, bool fitSh1,
+		const RegionOfInterest& roi, /*in and out*/ std::vector<Splat>& splats) {
+
+		Probe probe(*this, keyCamId, tfSubdivisions, colorNeighbors, fitSh1, roi);
+		int width_tf = intrinsics.width / tfSubdivisions;
+		int height_tf = intrinsics.height / tfSubdivisions;
+		int nrProbes = probes.empty() ? width_tf * height_tf : probes.size();
+
+		std::vector<std::vector<Splat>> splatsPerThread(NrThreads());
+		ParallelFor(nrProbes, [&](int begin, int end, int t) {
+			Splat splat;
+			for (int p = begin; p < end; p++) {
+				glm::vec3 uvSpacing = probes.empty() ? glm::vec3((p % width_tf + 0.5f) / width_tf, (p / width_tf + 0.5f) / height_tf, 1.0f) : probes[p];
+				if (probe.Extract(glm::vec2(uvSpacing), uvSpacing.z, splat)) splatsPerThread[t].push_back(splat);
+			}
+		});
+		for (std::vector<Splat>& threadSplats : splatsPerThread) {
+			splats.insert(splats.end(), threadSplats.begin(), threadSplats.end());
+		}
+	}
+
+private:
+	Intrinsics intrinsics;
+	Extrinsics extrinsics;
+
+	const float maxStretch = 4.0f;
+	const float thickness = 0.1f;
+	const float colorInlierRange = 0.1f;
+	const float shRidge = 0.01f;
+	const float maxSh1 = 0.5f;
+	const float C1 = 0.4886025119029199f;
+
+	int Nearest(glm::vec2 texCoords) const {
+		int col = glm::clamp(static_cast<int>(std::floor(texCoords.x * intrinsics.width)), 0, intrinsics.width - 1);
+		int row = glm::clamp(static_cast<int>(std::floor(texCoords.y * intrinsics.height)), 0, intrinsics.height - 1);
+		return row * intrinsics.width + col;
+	}
+
+	// GL_LINEAR with GL_CLAMP_TO_EDGE, of channel c of an image with nrChannels bytes per pixel, in [0, 1]
+	float Bilinear(const std::vector<unsigned char>& image, int nrChannels, int c, glm::vec2 texCoords) const {
+		glm::vec2 position = texCoords * glm::vec2(intrinsics.width, intrinsics.height) - 0.5f;
+		glm::vec2 base = glm::floor(position);
+		glm::vec2 fraction = position - base;
+		int col0 = glm::clamp(static_cast<int>(base.x), 0, intrinsics.width - 1);
+		int col1 = glm::clamp(static_cast<int>(base.x) + 1, 0, intrinsics.width - 1);
+		int row0 = glm::clamp(static_cast<int>(base.y), 0, intrinsics.height - 1);
+		int row1 = glm::clamp(static_cast<int>(base.y) + 1, 0, intrinsics.height - 1);
+		auto at = [&](int row, int col) { return image[(row * intrinsics.width + col) * nrChannels + c] / 255.0f; };
+		float top = glm::mix(at(row0, col0), at(row0, col1), fraction.x);
+		float bottom = glm::mix(at(row1, col0), at(row1, col1), fraction.x);
+		return glm::mix(top, bottom, fraction.y);
+	}
+
+	glm::vec3 Color(const View& view, glm::vec2 texCoords) const {
+		return glm::vec3(Bilinear(view.color, 3, 0, texCoords), Bilinear(view.color, 3, 1, texCoords), Bilinear(view.color, 3, 2, texCoords));
+	}
+
+	bool UserMasked(const View& view, glm::vec2 texCoords) const {
+		return !view.userMask.empty() && Bilinear(view.userMask, 1, 0, texCoords) < 0.5f;
+	}
+
+	// see mask_bad_pixels3.fs, returns false to mask off the pixel
+	bool CheckProjectedPixel(glm::vec2 texCoords, const View& from, const View& to, const glm::mat4& model, const glm::mat4& view) const {
+		if (UserMasked(from, texCoords)) return true;
+
+		float width = static_cast<float>(intrinsics.width);
+		float height = static_cast<float>(intrinsics.height);
+		float depth = from.depth[Nearest(texCoords)];
+		float x = (texCoords.x * width - intrinsics.cx) / intrinsics.fx * depth;
+		float y = (texCoords.y * height - (height - intrinsics.cy)) / intrinsics.fy * depth;
+		glm::vec4 worldPosition = model * glm::vec4(x, y, depth, 1.0f);
+		worldPosition /= worldPosition.w;
+
+		glm::vec4 viewPosition = view * worldPosition;
+		viewPosition /= viewPosition.w;
+		if (viewPosition.z <= 0) return true;
+
+		float u = viewPosition.x / viewPosition.z * intrinsics.fx + intrinsics.cx;
+		float v = viewPosition.y / viewPosition.z * intrinsics.fy + (height - intrinsics.cy);
+		glm::vec2 screenTexTo(u / width, v / height);
+		if (screenTexTo.x < 0 || screenTexTo.x > 1 || screenTexTo.y < 0 || screenTexTo.y > 1) return true;
+		if (UserMasked(to, screenTexTo)) return true;
+
+		if (viewPosition.z > to.depth[Nearest(screenTexTo)] * 0.95f) return true;
+		return glm::length(Color(from, texCoords) - Color(to, screenTexTo)) < 0.1f;
+	}
+
+	// the uniforms of write_splats.vs for 1 key view, and its vertex shader
+	class Probe {
+	public:
+		Probe(const CpuSplatter& splatter, int keyCamId, float tfSubdivisions, const std::vector<int>& colorNeighbors, bool fitSh1, const RegionOfInterest& roi) :
+			s(splatter), key(s.views.at(keyCamId)), fitSh1(fitSh1), roi(roi) {
+			const Intrinsics& intrinsics = s.intrinsics;
+			int width_tf = intrinsics.width / tfSubdivisions;
+			int height_tf = intrinsics.height / tfSubdivisions;
+			width = static_cast<float>(width_tf);
+			height = static_cast<float>(height_tf);
+			focal = glm::vec2(intrinsics.fx * width_tf / intrinsics.width, intrinsics.fy * height_tf / intrinsics.height);
+			pp = glm::vec2(intrinsics.cx * width_tf / intrinsics.width, intrinsics.cy * height_tf / intrinsics.height);
+			texelSize = glm::vec2(1.0f / intrinsics.width, 1.0f / intrinsics.height);
+			diameter = tfSubdivisions * 0.5f / intrinsics.fx;
+			const CameraPose& pose = s.extrinsics.poses.at(keyCamId);
+			model = pose.model;
+			cameraPosition = pose.pos;
+			for (int neighborId : colorNeighbors) {
+				const CameraPose& neighborPose = s.extrinsics.poses.at(neighborId);
+				neighbors.push_back({ &s.views.at(neighborId), neighborPose.view, neighborPose.pos });
+			}
+			if (roi.enabled) roiFromWorld = roi.BoxFromWorld();
+		}
+
+		// returns false where the geometry shader would emit nothing
+		bool Extract(glm::vec2 texCoords, float spacingFactor, /*out*/ Splat& splat) const {
+			if (key.mask[s.Nearest(texCoords)] <= 127) return false;
+
+			glm::vec3 localPosition = Unproject(texCoords);
+			glm::vec4 worldPosition = model * glm::vec4(localPosition, 1.0f);
+			worldPosition /= worldPosition.w;
+			if (roi.enabled && glm::any(glm::greaterThan(glm::abs(glm::vec3(roiFromWorld * worldPosition)), glm::vec3(1.0f)))) return false;
+
+			splat.position = glm::vec3(worldPosition);
+			splat.color = s.Color(key, texCoords);
+			for (int k = 0; k < 3; k++) splat.sh1[k] = glm::vec3(0);
+			if (!neighbors.empty()) {
+				MultiViewColor(splat.position, splat);
+			}
+			splat.scale = glm::length(localPosition) * diameter * spacingFactor;
+
+			// surface normal and footprint of 1 pixel, from the depth map
+			glm::vec3 dx = SurfaceDerivative(texCoords, localPosition, glm::vec2(texelSize.x, 0));
+			glm::vec3 dy = SurfaceDerivative(texCoords, localPosition, glm::vec2(0, texelSize.y));
+			glm::vec3 normal = glm::cross(dx, dy);
+			if (glm::length(normal) < 1e-20f) {
+				normal = -localPosition;
+			}
+			normal = glm::normalize(normal);
+			if (glm::dot(normal, localPosition) > 0.0f) {
+				normal = -normal;
+			}
+			glm::vec3 tangent = dx - glm::dot(dx, normal) * normal;
+			tangent = glm::length(tangent) > 1e-20f ? glm::normalize(tangent) : glm::normalize(glm::cross(normal, std::abs(normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0)));
+			glm::vec3 bitangent = glm::cross(normal, tangent);
+
+			glm::vec2 frontoParallel = glm::length(localPosition) * texelSize * glm::vec2(width, height) / focal;
+			float scaleX = splat.scale * glm::clamp(glm::length(dx) / frontoParallel.x, 1.0f, s.maxStretch);
+			float scaleY = splat.scale * glm::clamp(glm::length(dy) / frontoParallel.y, 1.0f, s.maxStretch);
+			splat.scales = glm::vec3(scaleX, scaleY, s.thickness * std::min(scaleX, scaleY));
+			splat.rotation = RotationToQuaternion(glm::mat3(model) * glm::mat3(tangent, bitangent, normal));
+			splat.confidence = key.confidence[s.Nearest(texCoords)] / 255.0f;
+			return true;
+		}
+
+	private:
+		struct Neighbor {
+			const View* view;
+			glm::mat4 viewMatrix;
+			glm::vec3 position;
+		};
+
+		const CpuSplatter& s;
+		const View& key;
+		bool fitSh1;
+		const RegionOfInterest& roi;
+		float width, height, diameter;
+		glm::vec2 focal, pp, texelSize;
+		glm::mat4 model, roiFromWorld;
+		glm::vec3 cameraPosition;
+		std::vector<Neighbor> neighbors;
+
+		glm::vec3 Unproject(glm::vec2 texCoords) const {
+			float depth = key.depth[s.Nearest(texCoords)];
+			float x = (texCoords.x * width - pp.x) / focal.x * depth;
+			float y = (texCoords.y * height - (height - pp.y)) / focal.y * depth;
+			return glm::vec3(x, y, depth);
+		}
+
+		// the branches of write_splats.vs, so both backends pick the same sign of the quaternion
+		static glm::vec4 RotationToQuaternion(const glm::mat3& m) {
+			float trace = m[0][0] + m[1][1] + m[2][2];
+			if (trace > 0.0f) {
+				float s = std::sqrt(trace + 1.0f) * 2.0f;
+				return glm::vec4(0.25f * s, (m[1][2] - m[2][1]) / s, (m[2][0] - m[0][2]) / s, (m[0][1] - m[1][0]) / s);
+			}
+			else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+				float s = std::sqrt(1.0f + m[0][0] - m[1][1] - m[2][2]) * 2.0f;
+				return glm::vec4((m[1][2] - m[2][1]) / s, 0.25f * s, (m[1][0] + m[0][1]) / s, (m[2][0] + m[0][2]) / s);
+			}
+			else if (m[1][1] > m[2][2]) {
+				float s = std::sqrt(1.0f + m[1][1] - m[0][0] - m[2][2]) * 2.0f;
+				return glm::vec4((m[2][0] - m[0][2]) / s, (m[1][0] + m[0][1]) / s, 0.25f * s, (m[2][1] + m[1][2]) / s);
+			}
+			else {
+				float s = std::sqrt(1.0f + m[2][2] - m[0][0] - m[1][1]) * 2.0f;
+				return glm::vec4((m[0][1] - m[1][0]) / s, (m[2][0] + m[0][2]) / s, (m[2][1] + m[1][2]) / s, 0.25f * s);
+			}
+		}
+
+		glm::vec3 SurfaceDerivative(glm::vec2 texCoords, glm::vec3 position, glm::vec2 offset) const {
+			glm::vec3 forward = Unproject(texCoords + offset) - position;
+			glm::vec3 backward = position - Unproject(texCoords - offset);
+			return std::abs(forward.z) < std::abs(backward.z) ? forward : backward;
+		}
+
+		// robust mean over the key view and the neighbors that see the point, and optionally degree-1 SH (see write_splats.vs)
+		void MultiViewColor(glm::vec3 position, /*in and out*/ Splat& splat) const {
+			glm::vec3 colors[5];
+			glm::vec3 directions[5];
+			colors[0] = splat.color;
+			directions[0] = glm::normalize(position - cameraPosition);
+			int n = 1;
+			for (const Neighbor& neighbor : neighbors) {
+				glm::vec4 local = neighbor.viewMatrix * glm::vec4(position, 1.0f);
+				if (local.z <= 0.0f) continue;
+				glm::vec2 coords((local.x / local.z * focal.x + pp.x) / width, (local.y / local.z * focal.y + height - pp.y) / height);
+				if (coords.x < 0 || coords.y < 0 || coords.x > 1 || coords.y > 1) continue;
+				colors[n] = s.Color(*neighbor.view, coords);
+				directions[n] = glm::normalize(position - neighbor.position);
+				n++;
+			}
+
+			glm::vec3 median;
+			for (int c = 0; c < 3; c++) {
+				float values[5];
+				for (int j = 0; j < n; j++) values[j] = colors[j][c];
+				std::sort(values, values + n);
+				median[c] = n % 2 == 1 ? values[n / 2] : 0.5f * (values[n / 2 - 1] + values[n / 2]);
+			}
+
+			float weights[5];
+			float sumWeights = 0.0f;
+			glm::vec3 sumColors(0.0f);
+			for (int j = 0; j < n; j++) {
+				float deviation = glm::length(colors[j] - median) / s.colorInlierRange;
+				weights[j] = 1.0f / (1.0f + deviation * deviation);
+				sumWeights += weights[j];
+				sumColors += weights[j] * colors[j];
+			}
+			splat.color = sumColors / sumWeights;
+			if (!fitSh1 || n < 2) return;
+
+			glm::mat4 normalMatrix(0.0f);
+			glm::vec4 rhs[3] = { glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f) };
+			for (int j = 0; j < n; j++) {
+				glm::vec4 basis(1.0f, -s.C1 * directions[j].y, s.C1 * directions[j].z, -s.C1 * directions[j].x);
+				normalMatrix += weights[j] * glm::outerProduct(basis, basis);
+				for (int c = 0; c < 3; c++) rhs[c] += weights[j] * colors[j][c] * basis;
+			}
+			for (int k = 1; k < 4; k++) normalMatrix[k][k] += s.shRidge * sumWeights;
+			glm::mat4 inverseMatrix = glm::inverse(normalMatrix);
+			glm::vec4 x[3] = { inverseMatrix * rhs[0], inverseMatrix * rhs[1], inverseMatrix * rhs[2] };
+			splat.color = glm::clamp(glm::vec3(x[0].x, x[1].x, x[2].x), 0.0f, 1.0f);
+			splat.sh1[0] = glm::clamp(glm::vec3(x[0].y, x[1].y, x[2].y), -s.maxSh1, s.maxSh1);
+			splat.sh1[1] = glm::clamp(glm::vec3(x[0].z, x[1].z, x[2].z), -s.maxSh1, s.maxSh1);
+			splat.sh1[2] = glm::clamp(glm::vec3(x[0].w, x[1].w, x[2].w), -s.maxSh1, s.maxSh1);
+		}
+	};
+};
+
+#endif // !CPU_SPLATTER_H
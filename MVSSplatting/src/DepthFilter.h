@@ -0,0 +1,121 @@
+#ifndef DEPTH_FILTER_H
+#define DEPTH_FILTER_H
+
+// Masks off floaters and depth discontinuities in the rough depth maps: a pixel is masked off if any pixel within
+// radius (a square window) has a depth more than gap sweep layers nearer or farther away. The min and max depth of
+// every window are computed with a separable van Herk / Gil-Werman filter, so the cost per pixel does not depend on the radius.
+// Pixels without a depth (0: the sweep skipped them for the user mask or the region of interest, see error2depth1.fs)
+// are left out of the windows, so the borders of the masks and of the region of interest are not eroded.
+class DepthFilter {
+
+public:
+	int radius = 5;
+	float gap = 8; // in layers of the plane sweep
+
+	DepthFilter(int radius, float gap = 8) : radius(radius), gap(gap) {}
+
+	// layerDepths: per key camera, the depth of each sweep layer, as chosen by MultiViewStereo
+	void MaskFloaters(const Intrinsics& intrinsics, const std::vector<int>& keyCamIds, std::unordered_map<int, std::vector<float>>& layerDepths) {
+		TexController& textures = TexController::getInstance();
+		int width = intrinsics.width;
+		int height = intrinsics.height;
+		std::vector<float> depth(width * height);
+		std::vector<unsigned char> mask(width * height);
+		std::vector<float> windowMin, windowMax;
+		int64_t nrMasked = 0;
+
+		for (const int& id : keyCamIds) {
+			textures.ReadTexture(textures.mvs_rough[id], GL_RED, GL_FLOAT, depth.data());
+			textures.ReadTexture(textures.masks[id], GL_RED, GL_UNSIGNED_BYTE, mask.data());
+			MinMax2D(depth, width, height, windowMin, windowMax);
+
+			const std::vector<float>& toDepth = layerDepths[id];
+			std::vector<int> nrMaskedPerThread(NrThreads(), 0);
+			ParallelFor(width * height, [&](int begin, int end, int t) {
+				for (int i = begin; i < end; i++) {
+					if (mask[i] == 0) continue;
+					float layer = MultiViewStereo::DepthToLayer(toDepth, depth[i]);
+					float nearLayer = std::max(0.0f, layer - gap);
+					float farLayer = layer + gap;
+					if (windowMin[i] < MultiViewStereo::LayerToDepth(toDepth, nearLayer) || windowMax[i] > MultiViewStereo::LayerToDepth(toDepth, farLayer)) {
+						mask[i] = 0;
+						nrMaskedPerThread[t]++;
+					}
+				}
+			});
+			nrMasked += std::accumulate(nrMaskedPerThread.begin(), nrMaskedPerThread.end(), 0);
+			textures.WriteTexture(textures.masks[id], GL_RED, GL_UNSIGNED_BYTE, mask.data());
+		}
+		printf("Floater filter: masked off %.2f%% of the depth map pixels\n", 100.0 * nrMasked / std::max<int64_t>(1, static_cast<int64_t>(width) * height * keyCamIds.size()));
+	}
+
+private:
+
+	// min and max of every (2 * radius + 1)^2 window, with the borders clamped like a texture lookup. The pixels without
+	// a depth are +inf for the min and -inf for the max, so a window of only those has min > max and rejects nothing.
+	void MinMax2D(const std::vector<float>& image, int width, int height, /*out*/ std::vector<float>& windowMin, std::vector<float>& windowMax) {
+		std::vector<float> rowMin(image.size()), rowMax(image.size());
+		windowMin.resize(image.size());
+		windowMax.resize(image.size());
+
+		ParallelFor(height, [&](int begin, int end, int /*t*/) {
+			std::vector<float> line(width), lineMin(width), lineMax(width), unused(width);
+			for (int y = begin; y < end; y++) {
+				const float* row = &image[y * width];
+				std::transform(row, row + width, line.begin(), [](float depth) { return depth > 0 ? depth : std::numeric_limits<float>::infinity(); });
+				MinMax1D(line, lineMin, unused);
+				std::transform(row, row + width, line.begin(), [](float depth) { return depth > 0 ? depth : -std::numeric_limits<float>::infinity(); });
+				MinMax1D(line, unused, lineMax);
+				std::copy(lineMin.begin(), lineMin.end(), rowMin.begin() + y * width);
+				std::copy(lineMax.begin(), lineMax.end(), rowMax.begin() + y * width);
+			}
+		});
+
+		ParallelFor(width, [&](int begin, int end, int /*t*/) {
+			std::vector<float> line(height), lineMin(height), lineMax(height), unused(height);
+			for (int x = begin; x < end; x++) {
+				for (int y = 0; y < height; y++) line[y] = rowMin[y * width + x];
+				MinMax1D(line, lineMin, unused);
+				for (int y = 0; y < height; y++) line[y] = rowMax[y * width + x];
+				MinMax1D(line, unused, lineMax);
+				for (int y = 0; y < height; y++) {
+					windowMin[y * width + x] = lineMin[y];
+					windowMax[y * width + x] = lineMax[y];
+				}
+			}
+		});
+	}
+
+	// van Herk / Gil-Werman: split the (edge-padded) line in blocks of the window size, and keep a running min/max from
+	// the start (g) and from the end (h) of each block. Every window spans at most 2 blocks, so its min/max is
+	// the min/max of h at its first pixel and g at its last pixel: 3 comparisons per pixel for any radius.
+	void MinMax1D(const std::vector<float>& line, /*out*/ std::vector<float>& lineMin, std::vector<float>& lineMax) {
+		int n = line.size();
+		int window = 2 * radius + 1;
+		int padded = n + 2 * radius;
+		std::vector<float> values(padded);
+		for (int i = 0; i < padded; i++) {
+			values[i] = line[std::min(n - 1, std::max(0, i - radius))];
+		}
+
+		std::vector<float> gMin(padded), gMax(padded), hMin(padded), hMax(padded);
+		for (int i = 0; i < padded; i++) {
+			bool blockStart = i % window == 0;
+			gMin[i] = blockStart ? values[i] : std::min(gMin[i - 1], values[i]);
+			gMax[i] = blockStart ? values[i] : std::max(gMax[i - 1], values[i]);
+		}
+		for (int i = padded - 1; i >= 0; i--) {
+			bool blockEnd = i == padded - 1 || (i + 1) % window == 0;
+			hMin[i] = blockEnd ? values[i] : std::min(hMin[i + 1], values[i]);
+			hMax[i] = blockEnd ? values[i] : std::max(hMax[i + 1], values[i]);
+		}
+
+		// window of pixel i is values[i, i + 2 * radius]
+		for (int i = 0; i < n; i++) {
+			lineMin[i] = std::min(hMin[i], gMin[i + 2 * radius]);
+			lineMax[i] = std::max(hMax[i], gMax[i + 2 * radius]);
+		}
+	}
+};
+
+#endif // !DEPTH_FILTER_H
@@ -31,21 +31,28 @@ private:
 	GLuint pcVAO, pcVBO = 0;
 	int nrPoints;
 	
-	// transform feedback
-	GLuint tfbo;
+public:
+	// transform feedback, with a ring of output buffers so that extracting a key view overlaps the readback of the previous one
+	static constexpr int nrTfBuffers = 3;
+private:
+	GLuint tfbos[nrTfBuffers];
 	GLuint tf;
 	GLuint tfVAO, tfVBO;
-	GLuint tfQuery;
-	int nrPointsTf;
-	
-	GLuint depthRBO;
+	GLuint tfQueries[nrTfBuffers];
+	GLsync tfFences[nrTfBuffers] = { 0, 0, 0 };
+	bool tfMapped[nrTfBuffers] = { false, false, false };
+	std::vector<Splat> tfCopies[nrTfBuffers]; // the splats of a buffer that could not be mapped
+	int nrPointsTf;  // capacity of the transform feedback buffer
+	int nrProbesTf;  // nr of probes currently in tfVBO
+	int imageWidth, imageHeight;
 	
 
 public:
 	float tfSubdivisions = 3;
 	// framebuffers
 	GLuint fbo;
-	GLuint fbo2; // 2 draw buffers
+	GLuint fbo2; // 3 draw buffers
+	GLuint fboMasks; // 2 draw buffers, both masks
 
 	bool Init(SfmPoints sfmPoints, int width, int height, int nrKeyCams) {
 
@@ -55,10 +62,7 @@ public:
 		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 		glBindTexture(GL_TEXTURE_2D, textures.fbo_ca0);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures.fbo_ca0, 0);
-		glGenRenderbuffers(1, &depthRBO);
-		glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height); // TODO only works because everything here has same resolution
-		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+		// no depth buffer: every pass draws 1 quad, and its attachments can have any size (e.g. 1 tile of the image)
 		GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0 };
 		glDrawBuffers(1, drawBuffers);
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
@@ -72,13 +76,25 @@ public:
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures.fbo2_ca0, 0);
 		glBindTexture(GL_TEXTURE_2D, textures.fbo2_ca1);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, textures.fbo2_ca1, 0);
-		GLenum drawBuffers2[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-		glDrawBuffers(2, drawBuffers2);
+		glBindTexture(GL_TEXTURE_2D, textures.fbo2_ca2);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, textures.fbo2_ca2, 0);
+		GLenum drawBuffers2[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(3, drawBuffers2);
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
 			std::cerr << "Framebuffer fbo2 not complete!" << std::endl;
 			return false;
 		}
 
+		glGenFramebuffers(1, &fboMasks);
+		glBindFramebuffer(GL_FRAMEBUFFER, fboMasks);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures.fboMasks_ca0, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, textures.fboMasks_ca1, 0);
+		glDrawBuffers(2, drawBuffers2);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			std::cerr << "Framebuffer fboMasks not complete!" << std::endl;
+			return false;
+		}
+
 
 
 		// Setup a quad that fills the screen for processing an entire texture
@@ -165,60 +181,53 @@ public:
 
 		// Setup transform feedback
 		{
-			// limit the number of outputted splats to 300k
-			const int maxNrSplats = 300000;
-			const int minNrSplats = 100000;
-			int estNrSplats = width * height * nrKeyCams / float(tfSubdivisions * tfSubdivisions) * 0.6f;
-			printf("w = %d, h = %d, cams = %d, tfSubdivisions = %f, estNrSplats = %d\n", width, height, nrKeyCams, tfSubdivisions, estNrSplats);
-			if (estNrSplats < minNrSplats  || estNrSplats > maxNrSplats) {
-				printf("Changed tfSubdivisions from %f", tfSubdivisions);
-				tfSubdivisions = std::sqrt(float(width * height * nrKeyCams * 0.6f) / (estNrSplats > maxNrSplats? maxNrSplats : minNrSplats));
-				printf(" to %f\n", tfSubdivisions);
-			}
-			int width_tf = width / tfSubdivisions;
-			int height_tf = height / tfSubdivisions;
-			nrPointsTf = width_tf * height_tf;
-			float width_f = static_cast<float>(width_tf);
-			float height_f = static_cast<float>(height_tf);
-			float* tfTexCoords = new float[nrPointsTf * 2];
-			int t = 0;
-			for (int row = 0; row < height_tf; row++) {
-				for (int col = 0; col < width_tf; col++) {
-					// 2 floats (u and v) per pixel
-					tfTexCoords[t] = (col + 0.5f) / width_f;
-					tfTexCoords[t + 1] = (row + 0.5f) / height_f;
-					t += 2;
-				}
+			float chosenTfSubdivisions = ChooseTfSubdivisions(width, height, nrKeyCams, tfSubdivisions);
+			printf("w = %d, h = %d, cams = %d, tfSubdivisions = %f, estNrSplats = %d\n", width, height, nrKeyCams, tfSubdivisions,
+				EstimateNrSplats(width, height, nrKeyCams, tfSubdivisions));
+			if (chosenTfSubdivisions != tfSubdivisions) {
+				printf("Changed tfSubdivisions from %f to %f\n", tfSubdivisions, chosenTfSubdivisions);
 			}
-
-			glGenVertexArrays(1, &tfVAO);
-			glBindVertexArray(tfVAO);
-			glGenBuffers(1, &tfVBO);
-			glBindBuffer(GL_ARRAY_BUFFER, tfVBO);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(float)* nrPointsTf * 2, tfTexCoords, GL_STATIC_DRAW);
-			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-			glEnableVertexAttribArray(0);
-			
-			// 7 floats per point: x, y, z, r, g, b, scale
-			glGenBuffers(1, &tfbo);
-			glBindBuffer(GL_ARRAY_BUFFER, tfbo);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(float) * nrPointsTf * 7, nullptr, GL_DYNAMIC_READ);
+			tfSubdivisions = chosenTfSubdivisions;
+			imageWidth = width;
+			imageHeight = height;
+			CreateTfBuffers();
 
 			// Transform feedback setup
 			glGenTransformFeedbacks(1, &tf);
-			glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tf);
-			glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, tfbo);
-
-			glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tf);
-
-			glGenQueries(1, &tfQuery);
-			
-			delete[] tfTexCoords;
+			glGenQueries(nrTfBuffers, tfQueries);
 		}
 
 		return true;
 	}
 	
+	// fraction of the probes that is expected to survive masking
+	static constexpr float expectedSurvivors = 0.6f;
+
+	// the ring of transform feedback buffers and the probes may take at most this much GPU memory
+	static constexpr int64_t maxTfBytes = int64_t(1) << 30;
+	static constexpr int64_t tfBytesPerProbe = nrTfBuffers * sizeof(Splat) + 3 * sizeof(float);
+
+	// the densest probe grid whose buffers fit in maxTfBytes (which also keeps the nr of probes well within an int)
+	static float MinTfSubdivisions(int width, int height) {
+		return std::sqrt(static_cast<float>(static_cast<double>(width) * height * tfBytesPerProbe / maxTfBytes));
+	}
+
+	static int EstimateNrSplats(int width, int height, int nrKeyCams, float tfSubdivisions) {
+		return width * height * nrKeyCams / float(tfSubdivisions * tfSubdivisions) * expectedSurvivors;
+	}
+
+	// spacing of the probes, so that the nr of outputted splats is expected to stay between 100k and 300k.
+	// Silent, so --plan can call it as well (Init prints the choice).
+	static float ChooseTfSubdivisions(int width, int height, int nrKeyCams, float tfSubdivisions) {
+		const int maxNrSplats = 300000;
+		const int minNrSplats = 100000;
+		int estNrSplats = EstimateNrSplats(width, height, nrKeyCams, tfSubdivisions);
+		if (estNrSplats < minNrSplats  || estNrSplats > maxNrSplats) {
+			tfSubdivisions = std::sqrt(float(width * height * nrKeyCams * expectedSurvivors) / (estNrSplats > maxNrSplats? maxNrSplats : minNrSplats));
+		}
+		return tfSubdivisions;
+	}
+
 	void RenderSfmPoints() {
 		glBindVertexArray(sfmVAO);
 		glDrawArrays(GL_POINTS, 0, nrSfmPoints);
@@ -243,7 +252,10 @@ public:
 	}
 	
 	// ------ Rough NVS
-	void RenderQuadWithOneDepth(GLuint mainColorTex, GLuint neighborColorTex, /*out*/ GLuint outputTex) {
+	// the feature textures are only used by the matching costs other than the RGB difference, and the mask textures
+	// only with user masks, they can be 0 otherwise
+	void RenderQuadWithOneDepth(GLuint mainColorTex, GLuint neighborColorTex, GLuint mainFeatureTex, GLuint neighborFeatureTex, /*out*/ GLuint outputTex,
+		GLuint mainMaskTex = 0, GLuint neighborMaskTex = 0, GLuint layerRangeTex = 0) {
 		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, outputTex, 0);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -251,11 +263,34 @@ public:
 		glBindTexture(GL_TEXTURE_2D, mainColorTex);
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, neighborColorTex);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, mainFeatureTex);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, neighborFeatureTex);
+		glActiveTexture(GL_TEXTURE4);
+		glBindTexture(GL_TEXTURE_2D, mainMaskTex);
+		glActiveTexture(GL_TEXTURE5);
+		glBindTexture(GL_TEXTURE_2D, neighborMaskTex);
+		glActiveTexture(GL_TEXTURE6);
+		glBindTexture(GL_TEXTURE_2D, layerRangeTex);
 		glBindVertexArray(quadVAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
 
-	void SumNeighborTextures(GLuint colorTex, std::vector<GLuint> inputTexs, Shader* shader, /*out*/ GLuint outputTex) {
+	void RenderImageFeatures(GLuint colorTex, /*out*/ GLuint featureTex) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, featureTex, 0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, colorTex);
+		glBindVertexArray(quadVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+
+	// featureTex is only used for NCC, priorTex and maskTex only for the depth prior, and userMaskTex only with user masks,
+	// they can be 0 otherwise
+	void SumNeighborTextures(GLuint colorTex, GLuint featureTex, std::vector<GLuint> inputTexs, Shader* shader, /*out*/ GLuint outputTex,
+		GLuint priorTex = 0, GLuint maskTex = 0, GLuint userMaskTex = 0) {
 		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, outputTex, 0);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -268,6 +303,18 @@ public:
 		glActiveTexture(GL_TEXTURE0 + nrTextures);
 		glBindTexture(GL_TEXTURE_2D, colorTex);
 		shader->setInt("colorTex", nrTextures);
+		glActiveTexture(GL_TEXTURE0 + nrTextures + 1);
+		glBindTexture(GL_TEXTURE_2D, featureTex);
+		shader->setInt("featureTex", nrTextures + 1);
+		glActiveTexture(GL_TEXTURE0 + nrTextures + 2);
+		glBindTexture(GL_TEXTURE_2D, priorTex);
+		shader->setInt("priorTex", nrTextures + 2);
+		glActiveTexture(GL_TEXTURE0 + nrTextures + 3);
+		glBindTexture(GL_TEXTURE_2D, maskTex);
+		shader->setInt("maskTex", nrTextures + 3);
+		glActiveTexture(GL_TEXTURE0 + nrTextures + 4);
+		glBindTexture(GL_TEXTURE_2D, userMaskTex);
+		shader->setInt("userMaskTex", nrTextures + 4);
 		glBindVertexArray(quadVAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
@@ -281,28 +328,91 @@ public:
 			glBindTexture(GL_TEXTURE_2D, inputTexs[offset + i]);
 			shader->setInt("errorTex[" + std::to_string(i) + "]", i);
 		}
-		shader->setInt("nrTextures", nrTextures);
 		shader->setInt("offset", offset);
 		glBindVertexArray(quadVAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
 
-	void FindLowestErrorDepth1(std::vector<GLuint> inputTexs, Shader* shader, /*out*/ GLuint depthTex, GLuint maskTex) {
+	// priorTex is only used for the depth prior, and clear = false keeps the pixels that the shader discards (for its 2nd sweep)
+	void FindLowestErrorDepth1(std::vector<GLuint> inputTexs, Shader* shader, /*out*/ GLuint depthTex, GLuint maskTex, GLuint confidenceTex, GLuint priorTex = 0, bool clear = true) {
 		glBindFramebuffer(GL_FRAMEBUFFER, fbo2);
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, depthTex, 0);
 		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, maskTex, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, confidenceTex, 0);
+		if (clear) glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		int nrTextures = inputTexs.size();
 		for (int i = 0; i < nrTextures; i++) {
 			glActiveTexture(GL_TEXTURE0 + i);
 			glBindTexture(GL_TEXTURE_2D, inputTexs[i]);
 			shader->setInt("inputTex[" + std::to_string(i) + "]", i);
 		}
-		shader->setInt("nrTextures", nrTextures);
+		glActiveTexture(GL_TEXTURE0 + nrTextures);
+		glBindTexture(GL_TEXTURE_2D, priorTex);
+		shader->setInt("priorTex", nrTextures);
 		glBindVertexArray(quadVAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
 	
+	// ------ Depth prior
+	void ClearDepthPrior(GLuint priorTex) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, priorTex, 0);
+		const GLfloat noPrior[4] = { 1e30f, 0, 0, 0 };
+		glClearBufferfv(GL_COLOR, 0, noPrior);
+	}
+
+	// Renders the pixels of a depth map as points into the prior of another key view, keeping the nearest depth per pixel
+	void ReprojectDepth(GLuint depthTex, GLuint maskTex, /*out*/ GLuint priorTex) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, priorTex, 0);
+		glEnable(GL_BLEND);
+		glBlendEquation(GL_MIN);
+		glEnable(GL_PROGRAM_POINT_SIZE);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, maskTex);
+		glBindVertexArray(pcVAO);
+		glDrawArrays(GL_POINTS, 0, nrPoints);
+		glDisable(GL_PROGRAM_POINT_SIZE);
+		glBlendEquation(GL_FUNC_ADD);
+		glDisable(GL_BLEND);
+	}
+
+	// nr of pixels in the current viewport that had a prior but no good match near it (see prior_fallback.fs),
+	// scratchTex is only there to render into
+	GLuint CountPriorFallbacks(GLuint priorTex, GLuint maskTex, GLuint userMaskTex, /*scratch*/ GLuint scratchTex) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, scratchTex, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, priorTex);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, maskTex);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, userMaskTex);
+		GLuint query, count = 0;
+		glGenQueries(1, &query);
+		glBeginQuery(GL_SAMPLES_PASSED, query);
+		glBindVertexArray(quadVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		glEndQuery(GL_SAMPLES_PASSED);
+		glGetQueryObjectuiv(query, GL_QUERY_RESULT, &count);
+		glDeleteQueries(1, &query);
+		return count;
+	}
+
+	// the layers that the sweep of the current prior mode needs per block of pixels (see layer_range.fs), in the current viewport
+	void RenderLayerRange(GLuint priorTex, GLuint maskTex, /*out*/ GLuint layerRangeTex) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layerRangeTex, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, priorTex);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, maskTex);
+		glBindVertexArray(quadVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+
 	// ------ Masking off bad pixels
 	void ProcessTex(GLuint inputTex, GLuint outputTex) {
 		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
@@ -314,26 +424,68 @@ public:
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
 
-	void MaskOffBadlyProjectedPixels(GLuint mainColorTex, GLuint mainDepthTex, GLuint neighborColorTex, GLuint neighborDepthTex, /*out*/GLuint maskTex) {
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, maskTex, 0);
-		glClear(GL_DEPTH_BUFFER_BIT);
+	// Checks both directions of a camera pair in 1 pass. The shader outputs 0 (mask off) or 1 (keep),
+	// which is multiplied with the current masks through blending. The user masks can be 0 without them.
+	void MaskOffBadlyProjectedPixels(GLuint colorTexA, GLuint depthTexA, GLuint colorTexB, GLuint depthTexB, /*out*/GLuint maskTexA, GLuint maskTexB,
+		GLuint userMaskTexA = 0, GLuint userMaskTexB = 0) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fboMasks);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, maskTexA, 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, maskTexB, 0);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_DST_COLOR, GL_ZERO);
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, mainColorTex);
+		glBindTexture(GL_TEXTURE_2D, colorTexA);
 		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, mainDepthTex);
+		glBindTexture(GL_TEXTURE_2D, depthTexA);
 		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, neighborColorTex);
+		glBindTexture(GL_TEXTURE_2D, colorTexB);
 		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, neighborDepthTex);
+		glBindTexture(GL_TEXTURE_2D, depthTexB);
+		glActiveTexture(GL_TEXTURE4);
+		glBindTexture(GL_TEXTURE_2D, userMaskTexA);
+		glActiveTexture(GL_TEXTURE5);
+		glBindTexture(GL_TEXTURE_2D, userMaskTexB);
 		glBindVertexArray(quadVAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
+		glDisable(GL_BLEND);
 	}
 	
 	// ------ Write splats to file
-	void WriteSplatsToBuffer(GLuint colorTex, GLuint depthTex, GLuint maskTex, /*out*/std::vector<float> &buffer) {
+	int GetTfCapacity() {
+		return nrPointsTf;
+	}
+
+	// Replace the transform feedback probes: (u, v, spacing relative to tfSubdivisions) per probe.
+	// At most GetTfCapacity() probes are used.
+	void SetTfProbes(const std::vector<glm::vec3>& probes) {
+		nrProbesTf = std::min(static_cast<int>(probes.size()), nrPointsTf);
+		glBindBuffer(GL_ARRAY_BUFFER, tfVBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * nrProbesTf, probes.data());
+	}
+
+	void RenderImportance(GLuint colorTex, GLuint depthTex, GLuint maskTex, GLuint userMaskTex, /*out*/ GLuint importanceTex) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, importanceTex, 0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, colorTex);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, maskTex);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, userMaskTex);
+		glBindVertexArray(quadVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+
+	// Start extracting the splats of a key view into transform feedback buffer <slot>, without waiting for the result.
+	// The slot must not be mapped. neighborColorTexs are the images of the MVS neighbors for a multi-view color (up to 4).
+	void ExtractSplatsAsync(int slot, GLuint colorTex, GLuint depthTex, GLuint maskTex, GLuint confidenceTex, const std::vector<GLuint>& neighborColorTexs = {}) {
 		
 		glBindVertexArray(tfVAO);
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tf);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, tfbos[slot]);
 		glEnable(GL_RASTERIZER_DISCARD); // Skip fragment stage
 		glActiveTexture(GL_TEXTURE0); 
 		glBindTexture(GL_TEXTURE_2D, colorTex);
@@ -341,23 +493,68 @@ public:
 		glBindTexture(GL_TEXTURE_2D, depthTex);
 		glActiveTexture(GL_TEXTURE2);
 		glBindTexture(GL_TEXTURE_2D, maskTex);
-		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, tfQuery);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, confidenceTex);
+		for (int i = 0; i < static_cast<int>(neighborColorTexs.size()); i++) {
+			glActiveTexture(GL_TEXTURE4 + i);
+			glBindTexture(GL_TEXTURE_2D, neighborColorTexs[i]);
+		}
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, tfQueries[slot]);
 		glBeginTransformFeedback(GL_POINTS);
-		glDrawArrays(GL_POINTS, 0, nrPointsTf);
+		glDrawArrays(GL_POINTS, 0, nrProbesTf);
 		glEndTransformFeedback();
 		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
 		glDisable(GL_RASTERIZER_DISCARD);
 
+		tfFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+	}
+
+	// Wait until the splats of <slot> are extracted, and map them for reading. The pointer stays valid (also for other threads)
+	// until UnmapSplats(slot). Returns nullptr if no splats were written. If the driver cannot map the buffer, the splats are
+	// copied to the host instead, and the pointer is to that copy.
+	const Splat* MapSplats(int slot, /*out*/ int& nrSplats) {
+		if (tfFences[slot]) {
+			while (glClientWaitSync(tfFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+			glDeleteSync(tfFences[slot]);
+			tfFences[slot] = 0;
+		}
+
 		// get the exact nr of output points
 		GLuint numOutputPrimitives = 0;
-		glGetQueryObjectuiv(tfQuery, GL_QUERY_RESULT, &numOutputPrimitives);
+		glGetQueryObjectuiv(tfQueries[slot], GL_QUERY_RESULT, &numOutputPrimitives);
+		nrSplats = numOutputPrimitives;
+		if (nrSplats == 0) return nullptr;
+
+		glBindBuffer(GL_ARRAY_BUFFER, tfbos[slot]);
+		const Splat* mapped = (const Splat*)glMapBufferRange(GL_ARRAY_BUFFER, 0, sizeof(Splat) * nrSplats, GL_MAP_READ_BIT);
+		if (mapped) {
+			tfMapped[slot] = true;
+			return mapped;
+		}
+		printf("Warning: could not map transform feedback buffer %d (GL error 0x%x), copying it instead\n", slot, glGetError());
+		tfCopies[slot].resize(nrSplats);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Splat) * nrSplats, tfCopies[slot].data());
+		return tfCopies[slot].data();
+	}
 
-		// copy to buffer
-		GLfloat* feedback = (GLfloat*)glMapBuffer(GL_ARRAY_BUFFER, GL_READ_ONLY);
-		buffer = std::vector<float>(feedback, feedback + numOutputPrimitives * 7);
+	void UnmapSplats(int slot) {
+		if (!tfMapped[slot]) return;
+		glBindBuffer(GL_ARRAY_BUFFER, tfbos[slot]);
 		glUnmapBuffer(GL_ARRAY_BUFFER);
+		tfMapped[slot] = false;
 	}
 	
+	// Change the spacing of the uniform grid of transform feedback probes, and (re)allocate the buffers to match.
+	// The spacing is at least MinTfSubdivisions, check tfSubdivisions for the one that is used.
+	void ResizeTransformFeedback(float newTfSubdivisions) {
+		tfSubdivisions = newTfSubdivisions;
+		glDeleteVertexArrays(1, &tfVAO);
+		glDeleteBuffers(1, &tfVBO);
+		glDeleteBuffers(nrTfBuffers, tfbos);
+		CreateTfBuffers();
+	}
+
 	void Cleanup() {
 		glDeleteVertexArrays(1, &quadVAO);
 		glDeleteVertexArrays(1, &sfmVAO);
@@ -367,10 +564,58 @@ public:
 		glDeleteBuffers(1, &pcVBO);
 		glDeleteBuffers(1, &tfVBO);
 		glDeleteFramebuffers(1, &fbo);
-		glDeleteRenderbuffers(1, &depthRBO);
-		glDeleteBuffers(1, &tfbo);
+		glDeleteFramebuffers(1, &fboMasks);
+		glDeleteBuffers(nrTfBuffers, tfbos);
 		glDeleteTransformFeedbacks(1, &tf);
-		glDeleteQueries(1, &tfQuery);
+		glDeleteQueries(nrTfBuffers, tfQueries);
+	}
+
+private:
+
+	// uniform grid of probes (u, v, spacing) and the buffer they write their splats to
+	void CreateTfBuffers() {
+		float minTfSubdivisions = MinTfSubdivisions(imageWidth, imageHeight);
+		if (tfSubdivisions < minTfSubdivisions) {
+			printf("Warning: tfSubdivisions = %f needs more than %lld MB of transform feedback buffers, using %f\n", tfSubdivisions,
+				(long long)(maxTfBytes >> 20), minTfSubdivisions);
+			tfSubdivisions = minTfSubdivisions;
+		}
+		int width_tf = imageWidth / tfSubdivisions;
+		int height_tf = imageHeight / tfSubdivisions;
+		nrPointsTf = width_tf * height_tf;
+		nrProbesTf = nrPointsTf;
+		float width_f = static_cast<float>(width_tf);
+		float height_f = static_cast<float>(height_tf);
+		float* tfTexCoords = new float[nrPointsTf * 3];
+		int t = 0;
+		for (int row = 0; row < height_tf; row++) {
+			for (int col = 0; col < width_tf; col++) {
+				// 2 floats (u and v) per pixel, and the spacing relative to this grid
+				tfTexCoords[t] = (col + 0.5f) / width_f;
+				tfTexCoords[t + 1] = (row + 0.5f) / height_f;
+				tfTexCoords[t + 2] = 1.0f;
+				t += 3;
+			}
+		}
+
+		glGenVertexArrays(1, &tfVAO);
+		glBindVertexArray(tfVAO);
+		glGenBuffers(1, &tfVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, tfVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float)* nrPointsTf * 3, tfTexCoords, GL_DYNAMIC_DRAW);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(2 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+		
+		// 1 Splat per point: x, y, z, r, g, b, scale, 3 anisotropic scales, rotation quaternion, confidence, degree-1 SH
+		glGenBuffers(nrTfBuffers, tfbos);
+		for (int slot = 0; slot < nrTfBuffers; slot++) {
+			glBindBuffer(GL_ARRAY_BUFFER, tfbos[slot]);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(Splat) * nrPointsTf, nullptr, GL_DYNAMIC_READ);
+		}
+
+		delete[] tfTexCoords;
 	}
 
 };
@@ -0,0 +1,154 @@
+#ifndef JOB_PLANNER_H
+#define JOB_PLANNER_H
+
+// Dry run for --plan: what a run will cost, from the COLMAP model and the key views alone, without a GL context or images.
+// The runtime is modeled as 3 phases that each scale with 1 measure of work:
+//  - loading:     ns per pixel of the loaded images
+//  - plane sweep: ns per pixel x layer x MVS neighbor of the (tiled) key views
+//  - splats:      ns per pixel of the key views, for the consistency check and the extraction
+// A normal run prints the calibration of the machine it ran on (see Calibrate), which --calibration passes back in.
+class JobPlanner {
+
+public:
+	struct Calibration {
+		double loadNs = 0;
+		double sweepNs = 0;
+		double splatNs = 0;
+	};
+
+	// measured with Mesa's llvmpipe (a software renderer), so far too slow for a real GPU: calibrate before trusting the runtime
+	static Calibration DefaultCalibration() {
+		Calibration calibration;
+		calibration.loadNs = 60;
+		calibration.sweepNs = 350;
+		calibration.splatNs = 1000;
+		return calibration;
+	}
+
+	Calibration calibration = DefaultCalibration();
+	bool calibrated = false;
+	// the adaptive sampler keeps as many probes as the uniform grid (see AdaptiveSampler::Sample), so only the plan text differs
+	bool adaptiveSampling = false;
+
+	JobPlanner(Intrinsics intrinsics, Extrinsics extrinsics, std::vector<int> keyCamIds, std::map<int, std::vector<int>> mvsNeighbors) :
+		intrinsics(intrinsics),
+		extrinsics(extrinsics),
+		keyCamIds(keyCamIds),
+		mvsNeighbors(mvsNeighbors) { }
+
+	// the work of each phase (see above), for a sweep in nrTiles of sweepSize
+	double LoadedPixels() const {
+		return static_cast<double>(TexController::ImagesToLoad(keyCamIds, mvsNeighbors).size()) * intrinsics.width * intrinsics.height;
+	}
+
+	double SweepSamples(int nrTiles, glm::ivec2 sweepSize) const {
+		double samples = 0;
+		for (int id : keyCamIds) {
+			auto found = mvsNeighbors.find(id);
+			int nrNeighbors = found == mvsNeighbors.end() ? 0 : found->second.size();
+			samples += static_cast<double>(nrTiles) * sweepSize.x * sweepSize.y * MultiViewStereo::nrLayers * nrNeighbors;
+		}
+		return samples;
+	}
+
+	double KeyViewPixels() const {
+		return static_cast<double>(keyCamIds.size()) * intrinsics.width * intrinsics.height;
+	}
+
+	// the calibration of a finished run, from the seconds it took per phase
+	Calibration Calibrate(double loadSeconds, double sweepSeconds, double splatSeconds, int nrTiles, glm::ivec2 sweepSize) const {
+		Calibration measured;
+		measured.loadNs = 1e9 * loadSeconds / std::max(LoadedPixels(), 1.0);
+		measured.sweepNs = 1e9 * sweepSeconds / std::max(SweepSamples(nrTiles, sweepSize), 1.0);
+		measured.splatNs = 1e9 * splatSeconds / std::max(KeyViewPixels(), 1.0);
+		return measured;
+	}
+
+	// Write the plan to file (e.g. stdout), as text or as JSON. memory: bytes per kind of texture (see TexController::EstimateMemory).
+	// nrMvsSplats and nrSfmSplats: the expected nr of splats from MVS and from the SfM points.
+	void Write(FILE* file, bool json, int nrTiles, glm::ivec2 sweepSize, const std::vector<std::pair<std::string, int64_t>>& memory, float tfSubdivisions, int64_t nrMvsSplats, int64_t nrSfmSplats) const {
+		std::unordered_set<int> imagesToLoad = TexController::ImagesToLoad(keyCamIds, mvsNeighbors);
+		int64_t totalBytes = 0;
+		for (auto& pair : memory) totalBytes += pair.second;
+		double loadSeconds = 1e-9 * calibration.loadNs * LoadedPixels();
+		double sweepSeconds = 1e-9 * calibration.sweepNs * SweepSamples(nrTiles, sweepSize);
+		double splatSeconds = 1e-9 * calibration.splatNs * KeyViewPixels();
+
+		if (!json) {
+			fprintf(file, "Plan for %d images of %d x %d pixels\n", (int)extrinsics.imageIds.size(), intrinsics.width, intrinsics.height);
+			fprintf(file, "Key views: %d, images to load: %d\n", (int)keyCamIds.size(), (int)imagesToLoad.size());
+			for (int id : keyCamIds) {
+				std::string neighbors;
+				for (int neighborId : NeighborsOf(id)) {
+					neighbors += (neighbors.empty() ? "" : ", ") + Name(neighborId);
+				}
+				fprintf(file, "  %s: %s\n", Name(id).c_str(), neighbors.c_str());
+			}
+			fprintf(file, "Plane sweep: %d tile(s) of %d x %d pixels, %d layers\n", nrTiles, sweepSize.x, sweepSize.y, MultiViewStereo::nrLayers);
+			fprintf(file, "GPU memory: %.1f MB\n", totalBytes / 1e6);
+			for (auto& pair : memory) {
+				fprintf(file, "  %s: %.1f MB\n", pair.first.c_str(), pair.second / 1e6);
+			}
+			fprintf(file, "Splats: ~%lld (%lld from MVS with tfSubdivisions = %f and %s sampling, %lld from the SfM points)\n",
+				(long long)(nrMvsSplats + nrSfmSplats), (long long)nrMvsSplats, tfSubdivisions, adaptiveSampling ? "adaptive" : "uniform", (long long)nrSfmSplats);
+			fprintf(file, "Runtime: ~%.1f s (loading %.1f s, plane sweep %.1f s, splats %.1f s)%s\n", loadSeconds + sweepSeconds + splatSeconds,
+				loadSeconds, sweepSeconds, splatSeconds, calibrated ? "" : ", uncalibrated: pass the --calibration a run prints");
+			return;
+		}
+
+		fprintf(file, "{\n");
+		fprintf(file, "  \"images\": %d,\n", (int)extrinsics.imageIds.size());
+		fprintf(file, "  \"resolution\": [%d, %d],\n", intrinsics.width, intrinsics.height);
+		fprintf(file, "  \"key_views\": [\n");
+		for (int k = 0; k < static_cast<int>(keyCamIds.size()); k++) {
+			int id = keyCamIds[k];
+			fprintf(file, "    {\"id\": %d, \"name\": \"%s\", \"neighbors\": [", id, Escape(Name(id)).c_str());
+			std::vector<int> neighbors = NeighborsOf(id);
+			for (int n = 0; n < static_cast<int>(neighbors.size()); n++) {
+				fprintf(file, "%s\"%s\"", n > 0 ? ", " : "", Escape(Name(neighbors[n])).c_str());
+			}
+			fprintf(file, "]}%s\n", k + 1 < static_cast<int>(keyCamIds.size()) ? "," : "");
+		}
+		fprintf(file, "  ],\n");
+		fprintf(file, "  \"images_to_load\": %d,\n", (int)imagesToLoad.size());
+		fprintf(file, "  \"sweep\": {\"tiles\": %d, \"tile_size\": [%d, %d], \"layers\": %d},\n", nrTiles, sweepSize.x, sweepSize.y, MultiViewStereo::nrLayers);
+		fprintf(file, "  \"gpu_bytes\": {");
+		for (auto& pair : memory) {
+			fprintf(file, "\"%s\": %lld, ", Escape(pair.first).c_str(), (long long)pair.second);
+		}
+		fprintf(file, "\"total\": %lld},\n", (long long)totalBytes);
+		fprintf(file, "  \"splats\": {\"mvs\": %lld, \"sfm\": %lld, \"total\": %lld, \"tf_subdivisions\": %f, \"sampling\": \"%s\"},\n",
+			(long long)nrMvsSplats, (long long)nrSfmSplats, (long long)(nrMvsSplats + nrSfmSplats), tfSubdivisions, adaptiveSampling ? "adaptive" : "uniform");
+		fprintf(file, "  \"runtime_seconds\": {\"load\": %.3f, \"sweep\": %.3f, \"splats\": %.3f, \"total\": %.3f, \"calibrated\": %s}\n",
+			loadSeconds, sweepSeconds, splatSeconds, loadSeconds + sweepSeconds + splatSeconds, calibrated ? "true" : "false");
+		fprintf(file, "}\n");
+	}
+
+private:
+	Intrinsics intrinsics;
+	Extrinsics extrinsics;
+	std::vector<int> keyCamIds;
+	std::map<int, std::vector<int>> mvsNeighbors;
+
+	std::vector<int> NeighborsOf(int id) const {
+		auto found = mvsNeighbors.find(id);
+		return found == mvsNeighbors.end() ? std::vector<int>() : found->second;
+	}
+
+	std::string Name(int id) const {
+		auto found = extrinsics.imageNames.find(id);
+		return found == extrinsics.imageNames.end() ? std::to_string(id) : found->second;
+	}
+
+	static std::string Escape(const std::string& text) {
+		std::string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\') escaped += '\\';
+			if (static_cast<unsigned char>(c) < 0x20) continue;
+			escaped += c;
+		}
+		return escaped;
+	}
+};
+
+#endif // !JOB_PLANNER_H
@@ -0,0 +1,114 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+// Static k-d tree over a point set, for exact k-nearest-neighbor queries.
+// Each node splits its points at the median along the axis of largest extent, until at most leafSize points remain.
+class KdTree {
+
+private:
+	struct Node {
+		int begin, end;      // range of the points in tree order
+		int left = -1;       // -1 for a leaf
+		int right = -1;
+		int axis = 0;
+		float split = 0;
+	};
+
+	static constexpr int leafSize = 16;
+
+	std::vector<glm::vec3> points; // in tree order
+	std::vector<int> indices;      // tree order -> index in the input
+	std::vector<Node> nodes;
+
+public:
+
+	KdTree(const std::vector<glm::vec3>& input) : points(input), indices(input.size()) {
+		std::iota(indices.begin(), indices.end(), 0);
+		if (!input.empty()) {
+			Build(0, input.size());
+		}
+
+		// store the points in tree order, so that the points of a leaf are contiguous
+		for (size_t i = 0; i < indices.size(); i++) {
+			points[i] = input[indices[i]];
+		}
+	}
+
+	int Size() const {
+		return points.size();
+	}
+
+	// Finds the k nearest points to query (which includes the point itself if query is part of the set).
+	// Writes the input indices and squared distances sorted from nearest to farthest, and returns how many were found (<= k).
+	int Nearest(const glm::vec3& query, int k, /*out*/ int* neighbors, float* squaredDistances) const {
+		int count = 0;
+		if (!nodes.empty() && k > 0) {
+			Search(0, query, k, neighbors, squaredDistances, count);
+		}
+		return count;
+	}
+
+private:
+
+	int Build(int begin, int end) {
+		int id = nodes.size();
+		nodes.push_back(Node());
+		nodes[id].begin = begin;
+		nodes[id].end = end;
+		if (end - begin <= leafSize) return id;
+
+		glm::vec3 boundsMin = points[indices[begin]];
+		glm::vec3 boundsMax = boundsMin;
+		for (int i = begin; i < end; i++) {
+			boundsMin = glm::min(boundsMin, points[indices[i]]);
+			boundsMax = glm::max(boundsMax, points[indices[i]]);
+		}
+		glm::vec3 extent = boundsMax - boundsMin;
+		int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+		int mid = (begin + end) / 2;
+		std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end, [&](int a, int b) {
+			return points[a][axis] < points[b][axis];
+		});
+		float split = points[indices[mid]][axis];
+
+		int left = Build(begin, mid);
+		int right = Build(mid, end);
+		nodes[id].left = left;
+		nodes[id].right = right;
+		nodes[id].axis = axis;
+		nodes[id].split = split;
+		return id;
+	}
+
+	void Search(int nodeId, const glm::vec3& query, int k, int* neighbors, float* squaredDistances, int& count) const {
+		const Node& node = nodes[nodeId];
+		if (node.left < 0) {
+			for (int i = node.begin; i < node.end; i++) {
+				glm::vec3 d = points[i] - query;
+				float distance = glm::dot(d, d);
+				if (count == k && distance >= squaredDistances[k - 1]) continue;
+
+				// insertion into the sorted list
+				int j = count < k ? count++ : k - 1;
+				while (j > 0 && squaredDistances[j - 1] > distance) {
+					squaredDistances[j] = squaredDistances[j - 1];
+					neighbors[j] = neighbors[j - 1];
+					j--;
+				}
+				squaredDistances[j] = distance;
+				neighbors[j] = indices[i];
+			}
+			return;
+		}
+
+		// visit the side of the split that contains the query first, and the other side only if it can still hold a closer point
+		float diff = query[node.axis] - node.split;
+		Search(diff < 0 ? node.left : node.right, query, k, neighbors, squaredDistances, count);
+		if (count < k || diff * diff < squaredDistances[count - 1]) {
+			Search(diff < 0 ? node.right : node.left, query, k, neighbors, squaredDistances, count);
+		}
+	}
+};
+
+#endif // !KD_TREE_H
@@ -0,0 +1,88 @@
+#ifndef KNN_FILTER_H
+#define KNN_FILTER_H
+
+// Post-processing of the final splats, based on the k nearest neighbors of every splat:
+//  - statistical outlier removal, to drop floaters that survived the masks
+//  - scales from the mean neighbor distance, like 3DGS computes with distCUDA2 when it initializes from a point cloud
+class KnnFilter {
+
+public:
+	int k = 3;
+
+	KnnFilter(int k) : k(k) {}
+
+	// Removes the splats whose mean distance to their k nearest neighbors is more than stdRatio standard deviations
+	// above the mean over all splats. Keeps the order of the remaining splats, and returns per input splat whether it was kept.
+	std::vector<bool> RemoveOutliers(float stdRatio, /*in and out*/ std::vector<Splat>& splats) {
+		std::vector<float> meanDistances;
+		MeanNeighborDistances(splats, /*squared*/ false, meanDistances);
+
+		double sum = 0, sumSquared = 0;
+		for (float distance : meanDistances) {
+			sum += distance;
+			sumSquared += static_cast<double>(distance) * distance;
+		}
+		int nrSplats = splats.size();
+		double mean = nrSplats > 0 ? sum / nrSplats : 0;
+		double deviation = nrSplats > 0 ? std::sqrt(std::max(0.0, sumSquared / nrSplats - mean * mean)) : 0;
+		float threshold = static_cast<float>(mean + stdRatio * deviation);
+
+		std::vector<bool> kept(nrSplats);
+		std::vector<Splat> inliers;
+		inliers.reserve(nrSplats);
+		for (int i = 0; i < nrSplats; i++) {
+			kept[i] = meanDistances[i] <= threshold;
+			if (kept[i]) {
+				inliers.push_back(splats[i]);
+			}
+		}
+		printf("Removed %d outliers of %d splats (mean neighbor distance > %f)\n", nrSplats - (int)inliers.size(), nrSplats, threshold);
+		splats.swap(inliers);
+		return kept;
+	}
+
+	// scale = sqrt(mean squared distance to the k nearest neighbors). Anisotropic scales keep their proportions.
+	void SetScalesFromNeighbors(/*in and out*/ std::vector<Splat>& splats) {
+		std::vector<float> meanSquaredDistances;
+		MeanNeighborDistances(splats, /*squared*/ true, meanSquaredDistances);
+
+		ParallelFor(splats.size(), [&](int begin, int end, int /*t*/) {
+			for (int i = begin; i < end; i++) {
+				float scale = std::sqrt(std::max(meanSquaredDistances[i], 1e-7f));
+				splats[i].scales *= scale / std::max(splats[i].scale, 1e-12f);
+				splats[i].scale = scale;
+			}
+		});
+		printf("Set the scales of %d splats from their %d nearest neighbors\n", (int)splats.size(), k);
+	}
+
+private:
+
+	// per splat, the mean (squared) distance to its k nearest neighbors, excluding itself
+	void MeanNeighborDistances(const std::vector<Splat>& splats, bool squared, /*out*/ std::vector<float>& meanDistances) {
+		std::vector<glm::vec3> positions(splats.size());
+		for (size_t i = 0; i < splats.size(); i++) {
+			positions[i] = splats[i].position;
+		}
+		KdTree tree(positions);
+
+		meanDistances = std::vector<float>(splats.size(), 0.0f);
+		ParallelFor(splats.size(), [&](int begin, int end, int /*t*/) {
+			std::vector<int> neighbors(k + 1);
+			std::vector<float> squaredDistances(k + 1);
+			for (int i = begin; i < end; i++) {
+				int count = tree.Nearest(positions[i], k + 1, neighbors.data(), squaredDistances.data());
+				float sum = 0;
+				int nrNeighbors = 0;
+				for (int j = 0; j < count && nrNeighbors < k; j++) {
+					if (neighbors[j] == i) continue;
+					sum += squared ? squaredDistances[j] : std::sqrt(squaredDistances[j]);
+					nrNeighbors++;
+				}
+				meanDistances[i] = nrNeighbors > 0 ? sum / nrNeighbors : 0.0f;
+			}
+		});
+	}
+};
+
+#endif // !KNN_FILTER_H
@@ -17,6 +17,60 @@ private:
 public:
 
 	static const int nrLayers = 50;
+	static_assert(nrLayers <= 64, "sum_radius2.fs and error2depth1.fs hold at most 64 layer depths");
+	// the best layer of each chunk of (at most) 32 layers is found in 1 pass, which error2depth0.fs is compiled for
+	static constexpr int layerChunk = 32;
+	// the result of each chunk goes to 1 of these vec3 textures
+	static constexpr int nrVec3 = (nrLayers + layerChunk - 1) / layerChunk;
+
+	// how quad_depth_error.fs compares a pixel of the key camera with its reprojection in a neighbor
+	enum class MatchingCost { Color = 0, Census = 1, Ncc = 2, Gradient = 3 };
+	MatchingCost cost = MatchingCost::Color;
+
+	// whether the features of a cost can be 16-bit with TexController::halfFloat: not the exact census code, and not those
+	// of NCC, whose normalization amplifies their rounding (~8% of the pixels changed their best layer in tests)
+	static bool HalfFeatures(MatchingCost cost) {
+		return cost != MatchingCost::Census && cost != MatchingCost::Ncc;
+	}
+
+	// parse "color", "census", "ncc" or "gradient", returns false for anything else
+	static bool ParseCost(const std::string& name, /*out*/ MatchingCost& cost) {
+		if (name == "color") cost = MatchingCost::Color;
+		else if (name == "census") cost = MatchingCost::Census;
+		else if (name == "ncc") cost = MatchingCost::Ncc;
+		else if (name == "gradient") cost = MatchingCost::Gradient;
+		else return false;
+		return true;
+	}
+
+	// sweep the key views in tiles of at most tileSize x tileSize pixels (including an apron of the aggregation radius),
+	// so the memory of the intermediates does not grow with the image size. 0 = only tile images that need more than
+	// maxUntiledSweepBytes in 1 piece.
+	int tileSize = 0;
+	static const int minTileSize = 64; // well above the 2 aprons
+
+	// Depth prior for sequential captures, where consecutive key views overlap: the finished depth maps of the previous
+	// priorViews key views are reprojected into each key view, and its pixels with a prior only sweep the layers within
+	// priorBand of it. The pixels without a prior, and those that find no good match near their prior, sweep all layers.
+	bool depthPrior = false;
+	int priorViews = 2;
+	int priorBand = 3;
+
+	// Place the layers where the SfM points of each key view are (depthHistograms, set before CalculateRoughDepth()),
+	// instead of only quadratically denser towards the camera
+	bool histogramLayers = false;
+	std::unordered_map<int, DepthHistogram> depthHistograms;
+
+	// only sweep the depths where the rays are inside this box, if enabled
+	RegionOfInterest roi;
+
+	// [nearest, farthest] depth the plane sweep can assign per key camera, filled by CalculateRoughDepth()
+	std::unordered_map<int, glm::vec2> depthBounds;
+	// per key camera, the (increasing) depth of each sweep layer, filled by CalculateRoughDepth()
+	std::unordered_map<int, std::vector<float>> layerDepths;
+	// the nr of tiles per key view and the size of the sweep textures, filled by CalculateRoughDepth()
+	int sweepTiles = 0;
+	glm::ivec2 sweepTileSize = glm::ivec2(0);
 
 
     MultiViewStereo(Intrinsics intrinsics, Extrinsics extrinsics, std::map<int, std::vector<int>> mvsNeighbors, std::vector<int> keyCamIds, std::unordered_map<int, glm::vec2> depthRanges) :
@@ -29,79 +83,355 @@ public:
 		keyCamIds(keyCamIds),
 		depthRanges(depthRanges) { }
 
-	void CalculateRoughDepth() {
+	// fractional layer of a depth in an increasing table of layer depths (0 in front of it), and its inverse,
+	// both piecewise linear and extrapolated beyond the last layer
+	static float DepthToLayer(const std::vector<float>& layerDepths, float depth) {
+		if (depth <= layerDepths.front()) return 0;
+		int upper = std::upper_bound(layerDepths.begin(), layerDepths.end(), depth) - layerDepths.begin();
+		int lower = std::min(upper, static_cast<int>(layerDepths.size()) - 1) - 1;
+		return lower + (depth - layerDepths[lower]) / (layerDepths[lower + 1] - layerDepths[lower]);
+	}
+
+	static float LayerToDepth(const std::vector<float>& layerDepths, float layer) {
+		int lower = glm::clamp(static_cast<int>(layer), 0, static_cast<int>(layerDepths.size()) - 2);
+		return layerDepths[lower] + (layer - lower) * (layerDepths[lower + 1] - layerDepths[lower]);
+	}
+
+	// false if a variant of the sweep shaders does not compile
+	bool CalculateRoughDepth() {
 
 		std::vector<float> depthPerLayer;
-		glm::vec2 layer_to_depth;
-		textures.CreateTmpVec3(static_cast<int>(std::ceil(nrLayers / 32.0f)));
+		if (textures.halfFloat) {
+			// 16-bit floats end at 65504: sweep a deeper scene in 32-bit floats instead (before the sweep textures are created)
+			for (int& mainId : keyCamIds) {
+				ChooseDepthPerLayer(mainId, /*out*/depthPerLayer);
+				if (depthPerLayer.back() > maxHalfFloat) {
+					printf("Warning: depths up to %f do not fit in 16-bit floats (at most %.0f), sweeping in 32-bit floats\n", depthPerLayer.back(), maxHalfFloat);
+					textures.halfFloat = false;
+					textures.ReallocateDepthMaps();
+					break;
+				}
+			}
+		}
+
+		std::vector<Tile> tiles;
+		glm::ivec2 sweepSize;
+		int apron = ChooseTiles(tiles, sweepSize);
+		sweepTiles = tiles.size();
+		sweepTileSize = sweepSize;
+		textures.CreateSweepTextures(sweepSize.x, sweepSize.y, nrVec3);
+		if (depthPrior) textures.CreateDepthPriorTex();
 		glViewport(0, 0, intrinsics.width, intrinsics.height);
+		CalculateImageFeatures();
 
-		for (int& mainId : keyCamIds) {
-			ChooseDepthPerLayer(mainId, /*out*/depthPerLayer, layer_to_depth);
+		// the variants of the shaders that find the best layer, the one that aggregates the errors depends on the key view
+		errorToDepthShader1 = shaders.ErrorToDepthShader1(nrVec3);
+		if (!errorToDepthShader1) return false;
+		for (int offset = 0; offset < nrLayers; offset += layerChunk) {
+			int chunk = std::min(layerChunk, nrLayers - offset);
+			errorToDepthShaders0[chunk] = shaders.ErrorToDepthShader0(chunk);
+			if (!errorToDepthShaders0[chunk]) return false;
+		}
+
+		// pixels masked off by the user (see TexController::LoadUserMasks) and rays outside the region of interest are skipped
+		int useUserMasks = textures.userMasks.empty() ? 0 : 1;
+		shaders.quadDepthErrorShader.use();
+		shaders.quadDepthErrorShader.setInt("useUserMasks", useUserMasks);
+		shaders.priorFallbackShader.use();
+		shaders.priorFallbackShader.setInt("useUserMasks", useUserMasks);
+		if (depthPrior) {
+			shaders.quadDepthErrorShader.use();
+			shaders.quadDepthErrorShader.setInt("layerBlock", TexController::layerRangeBlock);
+			shaders.layerRangeShader.use();
+			shaders.layerRangeShader.setInt("layerBlock", TexController::layerRangeBlock);
+			shaders.layerRangeShader.setInt("apron", aggregationRadius);
+			shaders.layerRangeShader.setInt("priorBand", priorBand);
+			shaders.layerRangeShader.setInt("nrLayers", nrLayers);
+		}
+
+		for (int k = 0; k < static_cast<int>(keyCamIds.size()); k++) {
+			int mainId = keyCamIds[k];
+			ChooseDepthPerLayer(mainId, /*out*/depthPerLayer);
+			depthBounds[mainId] = glm::vec2(depthPerLayer.front(), depthPerLayer.back());
+			layerDepths[mainId] = depthPerLayer;
+
+			int nrPriorViews = depthPrior ? std::min(k, priorViews) : 0;
+			if (nrPriorViews > 0) {
+				RenderDepthPrior(k, nrPriorViews);
+			}
 
 			shaders.quadDepthErrorShader.use();
 			shaders.quadDepthErrorShader.setMat4("model", extrinsics.poses[mainId].model);
+			shaders.quadDepthErrorShader.setInt("useLayerRange", nrPriorViews > 0 ? 1 : 0);
+			if (nrPriorViews > 0) {
+				shaders.layerRangeShader.use();
+				shaders.layerRangeShader.setFloatArray("layerDepths", depthPerLayer);
+			}
+
+			sumRadiusShader = shaders.SumRadiusShader(aggregationRadius, aggregationStep, mvsNeighbors[mainId].size());
+			if (!sumRadiusShader) return false;
+			sumRadiusShader->use();
+			sumRadiusShader->setInt("cost", static_cast<int>(cost));
+			sumRadiusShader->setInt("useUserMasks", useUserMasks);
+			sumRadiusShader->setInt("useRoi", roi.enabled ? 1 : 0);
+			sumRadiusShader->setInt("priorBand", priorBand);
+			sumRadiusShader->setFloatArray("layerDepths", depthPerLayer);
+			sumRadiusShader->setInt("nrLayers", nrLayers);
+			if (roi.enabled) {
+				sumRadiusShader->setMat4("roiFromCamera", roi.BoxFromWorld() * extrinsics.poses[mainId].model);
+			}
+			errorToDepthShader1->use();
+			errorToDepthShader1->setFloatArray("layerDepths", depthPerLayer);
+			errorToDepthShader1->setInt("nrLayers", nrLayers);
 
-			shaders.sumRadiusShader.use();
-			shaders.sumRadiusShader.setInt("radius", 12);
-			shaders.sumRadiusShader.setInt("step", 3);
-			shaders.sumRadiusShader.setInt("nrTextures", mvsNeighbors[mainId].size());
-
-			// for each neighbor, and for each layer, calculate the error map
-			for (int layer = 0; layer < nrLayers; layer++) {
-				float depth = depthPerLayer[layer];
-				int n = 0;
-				for (int& neighborId : mvsNeighbors[mainId]) {
-					// calculate the error for a certain depth
-					shaders.quadDepthErrorShader.use();
-					shaders.quadDepthErrorShader.setFloat("depth", depth);
-					shaders.quadDepthErrorShader.setMat4("view", extrinsics.poses[neighborId].view);
-					framebuffers.RenderQuadWithOneDepth(textures.images[mainId], textures.images[neighborId], /*out*/ textures.tmpFloat_neighbors[n]);
-					n++;
+			int nrFallbacks = 0;
+			for (Tile& tile : tiles) {
+				if (nrPriorViews > 0) RenderLayerRange(mainId, tile, apron, 1);
+				SweepTile(mainId, tile, apron, sweepSize, depthPerLayer, nrPriorViews > 0 ? 1 : 0);
+				if (nrPriorViews == 0) continue;
+
+				// sweep all layers again for the pixels whose prior was wrong, e.g. where an occluder moved away
+				shaders.priorFallbackShader.use();
+				shaders.priorFallbackShader.setVec4("texRegion", glm::vec4(tile.x / float(intrinsics.width), tile.y / float(intrinsics.height),
+					tile.width / float(intrinsics.width), tile.height / float(intrinsics.height)));
+				glViewport(0, 0, tile.width, tile.height);
+				int nrTileFallbacks = framebuffers.CountPriorFallbacks(textures.depthPrior, textures.masks[mainId], textures.UserMask(mainId), textures.tmpFloat_neighbors[0]);
+				if (nrTileFallbacks > 0) {
+					RenderLayerRange(mainId, tile, apron, 2);
+					SweepTile(mainId, tile, apron, sweepSize, depthPerLayer, 2);
+					nrFallbacks += nrTileFallbacks;
 				}
+			}
+			if (nrPriorViews > 0) {
+				printf("%s: swept %d layers around the depth of %d earlier key views, and all layers for the rest and %d pixels with a bad prior\n",
+					extrinsics.imageNames[mainId].c_str(), 2 * priorBand + 1, nrPriorViews, nrFallbacks);
+			}
+		}
+		glViewport(0, 0, intrinsics.width, intrinsics.height);
+		return true;
+	}
+
+	// the nr of tiles and size of the sweep textures that CalculateRoughDepth() will use, without any GL calls (for --plan)
+	int PlanTiles(/*out*/ glm::ivec2& sweepSize) {
+		std::vector<Tile> tiles;
+		ChooseTiles(tiles, sweepSize);
+		return tiles.size();
+	}
 
-				// smooth and sum the error of each neighbor
-				shaders.sumRadiusShader.use();
-				framebuffers.SumNeighborTextures(textures.images[mainId], textures.tmpFloat_neighbors, &shaders.sumRadiusShader, /*out*/textures.tmpFloat_layers[layer]);
+private:
+	// window of sum_radius2.fs, in which the errors are aggregated
+	const int aggregationRadius = 12;
+	const int aggregationStep = 3;
+
+	std::map<int, GLuint> features; // empty for the RGB difference
+
+	// the variants of the sweep shaders (see ShaderController::SumRadiusShader), of the key view being swept
+	Shader* sumRadiusShader = nullptr;
+	std::map<int, Shader*> errorToDepthShaders0; // by nr of layers in the chunk
+	Shader* errorToDepthShader1 = nullptr;
+
+	// layers that follow the depth histogram: the share of the SfM points, and the least nr of points to trust the histogram
+	const float histogramWeight = 0.5f;
+	const int minHistogramPoints = 50;
+
+	// automatic tiling: only when the sweep textures of the whole image would need more than 2 GB
+	static constexpr int64_t maxUntiledSweepBytes = 2000000000;
+	static constexpr int autoTileSize = 2048;
+
+	// the largest finite 16-bit float (see TexController::halfFloat)
+	static constexpr float maxHalfFloat = 65504.0f;
+
+	struct Tile {
+		int x, y, width, height; // in pixels, without the apron
+	};
+
+	// Divide the image in tiles whose sweep textures are at most tileSize x tileSize, including an apron of the aggregation
+	// radius on each side, so that sum_radius2.fs sees the same errors as without tiles. Returns the apron, and the
+	// size of the sweep textures. Without tiling, there is 1 tile with the whole image and no apron.
+	int ChooseTiles(/*out*/ std::vector<Tile>& tiles, glm::ivec2& sweepSize) {
+		int width = intrinsics.width;
+		int height = intrinsics.height;
+		int size = tileSize;
+		if (size <= 0) {
+			int nrNeighbors = 0;
+			for (auto& pair : mvsNeighbors) {
+				nrNeighbors = std::max(nrNeighbors, static_cast<int>(pair.second.size()));
+			}
+			int64_t bytesPerPixel = TexController::SweepBytesPerPixel(nrNeighbors, nrLayers, nrVec3, textures.halfFloat);
+			size = static_cast<int64_t>(width) * height * bytesPerPixel > maxUntiledSweepBytes ? autoTileSize : 0;
+		}
+
+		tiles.clear();
+		if (size <= 0 || (width <= size && height <= size)) {
+			tiles.push_back({ 0, 0, width, height });
+			sweepSize = glm::ivec2(width, height);
+			return 0;
+		}
+
+		int apron = aggregationRadius;
+		int inner = size - 2 * apron;
+		for (int y = 0; y < height; y += inner) {
+			for (int x = 0; x < width; x += inner) {
+				tiles.push_back({ x, y, std::min(inner, width - x), std::min(inner, height - y) });
 			}
+		}
+		sweepSize = glm::min(glm::ivec2(size), glm::ivec2(width, height) + 2 * apron);
+		printf("Plane sweep in %d tiles of %d x %d pixels (+ an apron of %d)\n", (int)tiles.size(), std::min(inner, width), std::min(inner, height), apron);
+		return apron;
+	}
 
-			// For each pixel, find the depth that gives the lowest error.
-			// Can have up to 32 textures binded as input textures.
-			// Outputs a vec3, which is actually:
-			//  - float (actually int) : the best layer
-			//	- float                : the lowest error
-			//  - float (actually int) : nr layers close to lowest error
-			shaders.errorToDepthShader0.use();
-			int i = 0;
-			for (int offset = 0; offset < nrLayers; offset += 32) {
-				int nrTexturesToProcess = std::min(32, nrLayers - offset);
-				shaders.errorToDepthShader0.use();
-				framebuffers.FindLowestErrorDepth0(textures.tmpFloat_layers, nrTexturesToProcess, offset, &shaders.errorToDepthShader0, textures.tmpVec3[i]);
-				i++;
+	// Sweep all layers for 1 tile of key camera mainId, and write the tile of its depth, mask and confidence.
+	// priorMode (see sum_radius2.fs): 0 = all pixels over all layers, 1 = only near the prior where there is one,
+	// 2 = all layers, but only for the pixels whose prior gave no good match; the other pixels keep their result.
+	void SweepTile(int mainId, const Tile& tile, int apron, glm::ivec2 sweepSize, const std::vector<float>& depthPerLayer, int priorMode) {
+		// the region of the image that the sweep textures cover: the tile and its apron
+		glm::vec2 imageSize(intrinsics.width, intrinsics.height);
+		glm::vec4 sweepRegion(glm::vec2(tile.x - apron, tile.y - apron) / imageSize, glm::vec2(sweepSize) / imageSize);
+		shaders.quadDepthErrorShader.use();
+		shaders.quadDepthErrorShader.setVec4("texRegion", sweepRegion);
+		sumRadiusShader->use();
+		sumRadiusShader->setVec4("texRegion", sweepRegion);
+		sumRadiusShader->setInt("priorMode", priorMode);
+		glViewport(0, 0, sweepSize.x, sweepSize.y);
+
+		// for each neighbor, and for each layer, calculate the error map
+		for (int layer = 0; layer < nrLayers; layer++) {
+			float depth = depthPerLayer[layer];
+			int n = 0;
+			for (int& neighborId : mvsNeighbors[mainId]) {
+				// calculate the error for a certain depth
+				shaders.quadDepthErrorShader.use();
+				shaders.quadDepthErrorShader.setFloat("depth", depth);
+				shaders.quadDepthErrorShader.setMat4("view", extrinsics.poses[neighborId].view);
+				shaders.quadDepthErrorShader.setInt("layer", layer);
+				framebuffers.RenderQuadWithOneDepth(textures.images[mainId], textures.images[neighborId], features[mainId], features[neighborId], /*out*/ textures.tmpFloat_neighbors[n],
+					textures.UserMask(mainId), textures.UserMask(neighborId), textures.layerRange);
+				n++;
 			}
 
-			// Since only 32 error maps could be processed at a time, combine all the 
-			// results here into 1 depth
-			shaders.errorToDepthShader1.use();
-			shaders.errorToDepthShader1.setVec2("layer_to_depth", layer_to_depth);
-			framebuffers.FindLowestErrorDepth1(textures.tmpVec3, &shaders.errorToDepthShader1, /*out*/ textures.mvs_rough[mainId], textures.masks[mainId]);
+			// smooth and sum the error of each neighbor
+			sumRadiusShader->use();
+			sumRadiusShader->setInt("layer", layer);
+			framebuffers.SumNeighborTextures(textures.images[mainId], features[mainId], textures.tmpFloat_neighbors, sumRadiusShader, /*out*/textures.tmpFloat_layers[layer],
+				textures.depthPrior, textures.masks[mainId], textures.UserMask(mainId));
+		}
+
+		// For each pixel, find the depth that gives the lowest error.
+		// Can have up to 32 (layerChunk) textures binded as input textures.
+		// Outputs a vec3, which is actually:
+		//  - float (actually int) : the best layer
+		//	- float                : the lowest error
+		//  - float (actually int) : nr layers close to lowest error
+		int i = 0;
+		for (int offset = 0; offset < nrLayers; offset += layerChunk) {
+			int nrTexturesToProcess = std::min(layerChunk, nrLayers - offset);
+			Shader* errorToDepthShader0 = errorToDepthShaders0[nrTexturesToProcess];
+			errorToDepthShader0->use();
+			framebuffers.FindLowestErrorDepth0(textures.tmpFloat_layers, nrTexturesToProcess, offset, errorToDepthShader0, textures.tmpVec3[i]);
+			i++;
 		}
+
+		// Since only 32 error maps could be processed at a time, combine all the 
+		// results here into 1 depth. The tile without its apron goes to its part of the full-size maps,
+		// and the scissor test keeps the clear of the framebuffer from erasing the other tiles.
+		errorToDepthShader1->use();
+		errorToDepthShader1->setVec4("texRegion", glm::vec4(glm::vec2(apron) / glm::vec2(sweepSize), glm::vec2(tile.width, tile.height) / glm::vec2(sweepSize)));
+		errorToDepthShader1->setInt("priorMode", priorMode);
+		errorToDepthShader1->setInt("priorBand", priorBand);
+		glViewport(tile.x, tile.y, tile.width, tile.height);
+		glScissor(tile.x, tile.y, tile.width, tile.height);
+		glEnable(GL_SCISSOR_TEST);
+		framebuffers.FindLowestErrorDepth1(textures.tmpVec3, errorToDepthShader1, /*out*/ textures.mvs_rough[mainId], textures.masks[mainId], textures.confidences[mainId],
+			textures.depthPrior, /*clear*/ priorMode != 2);
+		glDisable(GL_SCISSOR_TEST);
 	}
 
-private:
+	// The layers per block of a tile and its apron for which quad_depth_error.fs calculates the errors in priorMode
+	// (see SweepTile): the union of what sum_radius2.fs sweeps for the pixels whose windows reach into the block
+	void RenderLayerRange(int mainId, const Tile& tile, int apron, int priorMode) {
+		int block = TexController::layerRangeBlock;
+		glm::ivec2 first = glm::max(glm::ivec2(tile.x, tile.y) - apron, glm::ivec2(0)) / block;
+		glm::ivec2 last(TexController::LayerRangeBlocks(std::min(tile.x + tile.width + apron, intrinsics.width)),
+			TexController::LayerRangeBlocks(std::min(tile.y + tile.height + apron, intrinsics.height)));
+		glViewport(first.x, first.y, last.x - first.x, last.y - first.y);
+		shaders.layerRangeShader.use();
+		shaders.layerRangeShader.setInt("priorMode", priorMode);
+		framebuffers.RenderLayerRange(textures.depthPrior, textures.masks[mainId], /*out*/ textures.layerRange);
+	}
+
+	// the depth of the nrPriorViews key views before keyCamIds[k], in key view k (clear where none of them sees anything)
+	void RenderDepthPrior(int k, int nrPriorViews) {
+		framebuffers.ClearDepthPrior(textures.depthPrior);
+		glViewport(0, 0, intrinsics.width, intrinsics.height);
+		shaders.reprojectDepthShader.use();
+		shaders.reprojectDepthShader.setMat4("view", extrinsics.poses[keyCamIds[k]].view);
+		for (int p = k - nrPriorViews; p < k; p++) {
+			int priorId = keyCamIds[p];
+			shaders.reprojectDepthShader.setMat4("model", extrinsics.poses[priorId].model);
+			framebuffers.ReprojectDepth(textures.mvs_rough[priorId], textures.masks[priorId], /*out*/ textures.depthPrior);
+		}
+	}
+
+	// the features of the census, NCC and gradient costs only depend on the image, so they are calculated once per image
+	void CalculateImageFeatures() {
+		shaders.quadDepthErrorShader.use();
+		shaders.quadDepthErrorShader.setInt("cost", static_cast<int>(cost));
+		if (cost == MatchingCost::Color) return;
+
+		textures.CreateFeatureTextures(/*fullPrecision*/ !HalfFeatures(cost));
+		shaders.imageFeaturesShader.use();
+		shaders.imageFeaturesShader.setInt("cost", static_cast<int>(cost));
+		for (auto const& pair : textures.features) {
+			framebuffers.RenderImageFeatures(textures.images[pair.first], pair.second);
+		}
+		features = textures.features;
+	}
 
-	void ChooseDepthPerLayer(int keyCamId, /*out*/std::vector<float>& depthPerLayer, glm::vec2& layer_to_depth) {
+	void ChooseDepthPerLayer(int keyCamId, /*out*/std::vector<float>& depthPerLayer) {
 		// wider margin
 		float near = depthRanges[keyCamId].x * 0.95f;
 		float far  = depthRanges[keyCamId].y * 1.2f;
+
+		// no layers in front of or behind the region of interest
+		if (roi.enabled) {
+			glm::vec2 roiRange = roi.DepthRange(extrinsics.poses[keyCamId].view);
+			if (std::max(near, roiRange.x) < std::min(far, roiRange.y)) {
+				near = std::max(near, roiRange.x);
+				far = std::min(far, roiRange.y);
+			}
+		}
 		//printf("---> %s depth range = [%f, %f]:\n", extrinsics.imageNames[keyCamId].c_str(), near, far);
 
+		// depth = x * layer^2 + y
+		glm::vec2 layer_to_depth((far - near) / (nrLayers * nrLayers - 2 * nrLayers), near);
+		auto quadratic = [&](float layer) { return layer_to_depth.x * (layer * layer) + layer_to_depth.y; };
 		depthPerLayer = std::vector<float>(nrLayers, 0);
-		layer_to_depth = glm::vec2((far - near) / (nrLayers * nrLayers - 2 * nrLayers), near);
 		for (int layer = 0; layer < nrLayers; layer++) {
-			depthPerLayer[layer] = layer_to_depth.x * layer * layer + layer_to_depth.y;
+			depthPerLayer[layer] = quadratic(layer);
+		}
+
+		const DepthHistogram& histogram = depthHistograms[keyCamId];
+		if (!histogramLayers || histogram.count < static_cast<uint32_t>(minHistogramPoints)) return;
+
+		// Layer l at the depth where the mix of the quadratic spacing and the fraction of the SfM points between near
+		// and far reaches l / (nrLayers - 1). The quadratic part keeps layers in regions without SfM points, e.g. textureless walls.
+		float cdfNear = histogram.Cdf(quadratic(0));
+		float cdfFar = histogram.Cdf(quadratic(nrLayers - 1));
+		if (cdfFar - cdfNear <= 0) return;
+		const int substeps = 16;
+		std::vector<float> mixedCdf(substeps * (nrLayers - 1) + 1);
+		for (int i = 0; i < static_cast<int>(mixedCdf.size()); i++) {
+			float q = static_cast<float>(i) / substeps;
+			float cdf = (histogram.Cdf(quadratic(q)) - cdfNear) / (cdfFar - cdfNear);
+			mixedCdf[i] = (1 - histogramWeight) * q / (nrLayers - 1) + histogramWeight * cdf;
+		}
+		int i = 0;
+		for (int layer = 1; layer < nrLayers - 1; layer++) {
+			float target = static_cast<float>(layer) / (nrLayers - 1);
+			while (mixedCdf[i + 1] < target) i++;
+			float q = (i + (target - mixedCdf[i]) / (mixedCdf[i + 1] - mixedCdf[i])) / substeps;
+			depthPerLayer[layer] = quadratic(q);
 		}
-		
 	}
 
 };
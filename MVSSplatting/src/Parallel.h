@@ -0,0 +1,93 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+inline int NrThreads() {
+	return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// Splits [0, n) in NrThreads() contiguous ranges and calls func(begin, end, threadIndex) for each of them in parallel.
+template <typename Func>
+void ParallelFor(int n, Func func) {
+	int nrThreads = std::min(NrThreads(), std::max(1, n));
+	std::vector<std::thread> threads;
+	for (int t = 0; t < nrThreads; t++) {
+		int begin = static_cast<int>(static_cast<int64_t>(n) * t / nrThreads);
+		int end = static_cast<int>(static_cast<int64_t>(n) * (t + 1) / nrThreads);
+		threads.emplace_back(func, begin, end, t);
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+// Runs jobs one by one on a separate thread, in the order they were pushed
+class BackgroundWorker {
+
+private:
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<std::function<void()>> jobs;
+	int nrPushed = 0;
+	int nrDone = 0;
+	bool stopping = false;
+	std::thread thread; // last, so that everything above is initialized before it starts
+
+public:
+	BackgroundWorker() : thread([this]() { Run(); }) {}
+
+	// finishes the remaining jobs first
+	~BackgroundWorker() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		condition.notify_all();
+		thread.join();
+	}
+
+	// returns a ticket to wait for
+	int Push(std::function<void()> job) {
+		int ticket;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+			ticket = nrPushed++;
+		}
+		condition.notify_all();
+		return ticket;
+	}
+
+	void WaitFor(int ticket) {
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [&]() { return nrDone > ticket; });
+	}
+
+	void WaitForAll() {
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [&]() { return nrDone == nrPushed; });
+	}
+
+private:
+	void Run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			condition.wait(lock, [&]() { return stopping || !jobs.empty(); });
+			if (jobs.empty()) return;
+			std::function<void()> job = std::move(jobs.front());
+			jobs.pop_front();
+			lock.unlock();
+			job();
+			lock.lock();
+			nrDone++;
+			condition.notify_all();
+		}
+	}
+};
+
+#endif // !PARALLEL_H
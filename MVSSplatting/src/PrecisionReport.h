@@ -0,0 +1,109 @@
+#ifndef PRECISION_REPORT_H
+#define PRECISION_REPORT_H
+
+// Error report of --precision compare: the key views are swept in full precision, ReadReference keeps their depth maps,
+// masks and confidences, and after the same sweep with TexController::halfFloat, Compare prints per key view (and in total)
+// how many pixels changed their mask or their best layer, the depth error of the pixels that kept their layer (the rounding
+// of the 16-bit depth map itself), and the mean change of the confidence.
+class PrecisionReport {
+
+public:
+	PrecisionReport(Intrinsics intrinsics, Extrinsics extrinsics, std::vector<int> keyCamIds) :
+		textures(TexController::getInstance()),
+		intrinsics(intrinsics),
+		extrinsics(extrinsics),
+		keyCamIds(keyCamIds) { }
+
+	void ReadReference() {
+		for (int& id : keyCamIds) {
+			Read(id, reference[id]);
+		}
+	}
+
+	// layerDepths: of the sweep (see MultiViewStereo::layerDepths), which is the same in both precisions
+	void Compare(std::unordered_map<int, std::vector<float>>& layerDepths) {
+		printf("Half precision vs full precision (mask: pixels good in only 1 of both, layer: good pixels with another best layer):\n");
+		Difference total;
+		Maps half;
+		for (int& id : keyCamIds) {
+			Read(id, half);
+			Difference difference = Measure(reference[id], half, layerDepths[id]);
+			Print(extrinsics.imageNames[id], difference);
+			total.Add(difference);
+		}
+		Print("total", total);
+	}
+
+private:
+	TexController& textures;
+	Intrinsics intrinsics;
+	Extrinsics extrinsics;
+	std::vector<int> keyCamIds;
+
+	struct Maps {
+		std::vector<float> depth;
+		std::vector<unsigned char> mask;
+		std::vector<unsigned char> confidence;
+	};
+	std::unordered_map<int, Maps> reference;
+
+	struct Difference {
+		int64_t nrPixels = 0;
+		int64_t nrMaskChanged = 0;
+		int64_t nrGood = 0;          // good in both
+		int64_t nrLayerChanged = 0;
+		double maxRelativeDepthError = 0; // of the good pixels with the same layer
+		double sumConfidenceError = 0;    // of the good pixels
+
+		void Add(const Difference& other) {
+			nrPixels += other.nrPixels;
+			nrMaskChanged += other.nrMaskChanged;
+			nrGood += other.nrGood;
+			nrLayerChanged += other.nrLayerChanged;
+			maxRelativeDepthError = std::max(maxRelativeDepthError, other.maxRelativeDepthError);
+			sumConfidenceError += other.sumConfidenceError;
+		}
+	};
+
+	void Read(int id, /*out*/ Maps& maps) {
+		int nrPixels = intrinsics.width * intrinsics.height;
+		maps.depth.resize(nrPixels);
+		maps.mask.resize(nrPixels);
+		maps.confidence.resize(nrPixels);
+		textures.ReadTexture(textures.mvs_rough[id], GL_RED, GL_FLOAT, maps.depth.data());
+		textures.ReadTexture(textures.masks[id], GL_RED, GL_UNSIGNED_BYTE, maps.mask.data());
+		textures.ReadTexture(textures.confidences[id], GL_RED, GL_UNSIGNED_BYTE, maps.confidence.data());
+	}
+
+	static Difference Measure(const Maps& full, const Maps& half, const std::vector<float>& layerDepths) {
+		Difference difference;
+		difference.nrPixels = full.depth.size();
+		for (size_t i = 0; i < full.depth.size(); i++) {
+			bool goodFull = full.mask[i] > 127;
+			bool goodHalf = half.mask[i] > 127;
+			if (goodFull != goodHalf) difference.nrMaskChanged++;
+			if (!goodFull || !goodHalf) continue;
+
+			difference.nrGood++;
+			difference.sumConfidenceError += std::abs(full.confidence[i] - half.confidence[i]) / 255.0;
+			int layerFull = static_cast<int>(std::round(MultiViewStereo::DepthToLayer(layerDepths, full.depth[i])));
+			int layerHalf = static_cast<int>(std::round(MultiViewStereo::DepthToLayer(layerDepths, half.depth[i])));
+			if (layerFull != layerHalf) {
+				difference.nrLayerChanged++;
+			}
+			else if (full.depth[i] > 0) {
+				difference.maxRelativeDepthError = std::max(difference.maxRelativeDepthError, std::abs(static_cast<double>(half.depth[i]) - full.depth[i]) / full.depth[i]);
+			}
+		}
+		return difference;
+	}
+
+	static void Print(const std::string& name, const Difference& difference) {
+		double nrGood = std::max<int64_t>(difference.nrGood, 1);
+		printf("  %s: mask %.3f%%, layer %.3f%%, depth error %.2e (relative), confidence error %.4f\n", name.c_str(),
+			100.0 * difference.nrMaskChanged / std::max<int64_t>(difference.nrPixels, 1), 100.0 * difference.nrLayerChanged / nrGood,
+			difference.maxRelativeDepthError, difference.sumConfidenceError / nrGood);
+	}
+};
+
+#endif // !PRECISION_REPORT_H
@@ -0,0 +1,169 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+// On-disk cache of linked GL programs (glGetProgramBinary, GL 4.1 or ARB_get_program_binary), so that a warm start skips
+// compiling and linking the shaders. A program is stored in <folder>/<key>.bin, where the key hashes the driver (vendor,
+// renderer and version), the GLSL sources and everything else that changes the program (e.g. transform feedback varyings).
+// A binary that the driver rejects is recompiled and overwritten. Files are written under a temporary name and renamed,
+// so concurrent runs never read a half-written program.
+class ProgramCache {
+
+public:
+	ProgramCache() {}
+
+	// the folder for the cache of the current user, "" if there is none
+	static std::string DefaultFolder() {
+#ifdef _WIN32
+		const char* base = std::getenv("LOCALAPPDATA");
+		return base ? std::string(base) + "/MVSSplatting/programs/" : "";
+#else
+		const char* xdg = std::getenv("XDG_CACHE_HOME");
+		if (xdg && *xdg) return std::string(xdg) + "/mvssplatting/programs/";
+		const char* home = std::getenv("HOME");
+		return home ? std::string(home) + "/.cache/mvssplatting/programs/" : "";
+#endif
+	}
+
+	// Enables the cache if the driver can return program binaries, with a GL context current. folder "" = disabled.
+	bool Init(std::string folder) {
+		enabled = false;
+		if (folder.empty()) return false;
+		if (folder.back() != '/' && folder.back() != '\\') folder += '/';
+
+		GLint nrFormats = 0;
+		if (HasProgramBinary()) {
+			getProgramBinary = (GetProgramBinaryProc)glfwGetProcAddress("glGetProgramBinary");
+			programBinary = (ProgramBinaryProc)glfwGetProcAddress("glProgramBinary");
+			programParameteri = (ProgramParameteriProc)glfwGetProcAddress("glProgramParameteri");
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nrFormats);
+		}
+		if (!getProgramBinary || !programBinary || !programParameteri || nrFormats == 0) {
+			printf("The GL driver cannot cache programs, the shaders are compiled every run\n");
+			return false;
+		}
+		std::error_code error;
+		std::filesystem::create_directories(folder, error);
+		if (error) {
+			printf("Warning: cannot create the program cache %s, the shaders are compiled every run\n", folder.c_str());
+			return false;
+		}
+
+		this->folder = folder;
+		driver = std::string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + "|" + reinterpret_cast<const char*>(glGetString(GL_RENDERER)) + "|" +
+			reinterpret_cast<const char*>(glGetString(GL_VERSION));
+		enabled = true;
+		return true;
+	}
+
+	bool Enabled() const {
+		return enabled;
+	}
+
+	// the key of a program: the driver and the given parts (sources, varyings, ...), which are hashed with a separator
+	std::string Key(const std::vector<std::string>& parts) const {
+		uint64_t hash = Fnv1a(driver + "|" + std::to_string(formatVersion), 14695981039346656037ull);
+		for (const std::string& part : parts) {
+			hash = Fnv1a(part + '\0', hash);
+		}
+		char key[17];
+		snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+		return key;
+	}
+
+	// a linked program from the cache, 0 if there is none or the driver rejects it
+	GLuint Load(const std::string& key) const {
+		if (!enabled) return 0;
+		std::ifstream file(folder + key + ".bin", std::ios::binary);
+		if (!file) return 0;
+		std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (data.size() <= sizeof(GLenum)) return 0;
+
+		GLenum format;
+		std::memcpy(&format, data.data(), sizeof(GLenum));
+		GLuint program = glCreateProgram();
+		programBinary(program, format, data.data() + sizeof(GLenum), static_cast<GLsizei>(data.size() - sizeof(GLenum)));
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!linked) {
+			glDeleteProgram(program);
+			return 0;
+		}
+		return program;
+	}
+
+	// call before linking a program that will be stored
+	void SetRetrievable(GLuint program) const {
+		if (enabled) programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	void Store(const std::string& key, GLuint program) const {
+		if (!enabled) return;
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) return;
+		std::vector<char> data(sizeof(GLenum) + length);
+		GLenum format;
+		getProgramBinary(program, length, nullptr, &format, data.data() + sizeof(GLenum));
+		std::memcpy(data.data(), &format, sizeof(GLenum));
+
+		std::string path = folder + key + ".bin";
+		std::string temporary = path + ".tmp" + std::to_string(std::random_device()());
+		{
+			std::ofstream file(temporary, std::ios::binary);
+			file.write(data.data(), data.size());
+			if (!file) {
+				file.close();
+				std::remove(temporary.c_str());
+				return;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary, path, error);
+		if (error) std::remove(temporary.c_str()); // e.g. another run stored it first
+	}
+
+private:
+	// not in the GL 3.3 headers of glad
+	static constexpr GLenum GL_PROGRAM_BINARY_RETRIEVABLE_HINT = 0x8257;
+	static constexpr GLenum GL_PROGRAM_BINARY_LENGTH = 0x8741;
+	static constexpr GLenum GL_NUM_PROGRAM_BINARY_FORMATS = 0x87FE;
+	typedef void (GLAD_API_PTR* GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+	typedef void (GLAD_API_PTR* ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+	typedef void (GLAD_API_PTR* ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+	// bump when the way programs are built changes without a change of their sources
+	static const int formatVersion = 1;
+
+	bool enabled = false;
+	std::string folder;
+	std::string driver;
+	GetProgramBinaryProc getProgramBinary = nullptr;
+	ProgramBinaryProc programBinary = nullptr;
+	ProgramParameteriProc programParameteri = nullptr;
+
+	static bool HasProgramBinary() {
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (major > 4 || (major == 4 && minor >= 1)) return true;
+		GLint nrExtensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &nrExtensions);
+		for (int i = 0; i < nrExtensions; i++) {
+			if (std::strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_get_program_binary") == 0) return true;
+		}
+		return false;
+	}
+
+	static uint64_t Fnv1a(const std::string& text, uint64_t hash) {
+		for (unsigned char c : text) {
+			hash = (hash ^ c) * 1099511628211ull;
+		}
+		return hash;
+	}
+};
+
+#endif // !PROGRAM_CACHE_H
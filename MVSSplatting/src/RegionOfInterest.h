@@ -0,0 +1,117 @@
+#ifndef REGION_OF_INTEREST_H
+#define REGION_OF_INTEREST_H
+
+// Oriented box around the part of the scene that matters, e.g. the object of an object-centric capture.
+// The plane sweep only searches the depths where a pixel's ray is inside the box, and splats outside of it are dropped.
+// The box is either given as an axis-aligned box in world coordinates, or estimated from the dense core of the SfM points.
+class RegionOfInterest {
+
+public:
+	bool enabled = false;
+	glm::vec3 center = glm::vec3(0);
+	glm::mat3 axes = glm::mat3(1);        // columns: the unit axes of the box
+	glm::vec3 halfSize = glm::vec3(0);
+
+	RegionOfInterest() {}
+
+	static RegionOfInterest FromBounds(glm::vec3 boundsMin, glm::vec3 boundsMax) {
+		RegionOfInterest roi;
+		roi.enabled = true;
+		roi.center = 0.5f * (boundsMin + boundsMax);
+		roi.halfSize = 0.5f * glm::abs(boundsMax - boundsMin);
+		return roi;
+	}
+
+	// Box along the principal axes of the coreFraction of the SfM points nearest to their median, which leaves out the
+	// sparse background around an object, grown by margin and at least minThickness x its largest size along every axis
+	// (for a flat core). Returns false if there are too few points.
+	static bool Estimate(SfmPoints& sfmPoints, /*out*/ RegionOfInterest& roi, float coreFraction = 0.5f, float margin = 1.2f) {
+		std::vector<glm::vec3> points;
+		for (auto& pair : sfmPoints.points) {
+			points.insert(points.end(), pair.second.begin(), pair.second.end());
+		}
+		if (points.size() < minPoints) return false;
+
+		glm::vec3 median;
+		std::vector<float> values(points.size());
+		for (int axis = 0; axis < 3; axis++) {
+			for (size_t i = 0; i < points.size(); i++) values[i] = points[i][axis];
+			std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+			median[axis] = values[values.size() / 2];
+		}
+
+		std::sort(points.begin(), points.end(), [&](const glm::vec3& a, const glm::vec3& b) {
+			return glm::dot(a - median, a - median) < glm::dot(b - median, b - median);
+		});
+		points.resize(std::max<size_t>(minPoints, static_cast<size_t>(coreFraction * points.size())));
+
+		glm::vec3 mean(0);
+		for (const glm::vec3& p : points) mean += p;
+		mean /= static_cast<float>(points.size());
+		glm::mat3 covariance(0);
+		for (const glm::vec3& p : points) covariance += glm::outerProduct(p - mean, p - mean);
+		roi.axes = PrincipalAxes(covariance / static_cast<float>(points.size()));
+
+		glm::vec3 boundsMin(std::numeric_limits<float>::max());
+		glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+		for (const glm::vec3& p : points) {
+			glm::vec3 local = glm::transpose(roi.axes) * (p - mean);
+			boundsMin = glm::min(boundsMin, local);
+			boundsMax = glm::max(boundsMax, local);
+		}
+		roi.enabled = true;
+		roi.center = mean + roi.axes * (0.5f * (boundsMin + boundsMax));
+		roi.halfSize = margin * 0.5f * (boundsMax - boundsMin);
+		roi.halfSize = glm::max(roi.halfSize, glm::vec3(minThickness * std::max(roi.halfSize.x, std::max(roi.halfSize.y, roi.halfSize.z))));
+		return roi.halfSize.x > 0;
+	}
+
+	bool Contains(const glm::vec3& position) const {
+		glm::vec3 local = glm::transpose(axes) * (position - center);
+		return glm::all(glm::lessThanEqual(glm::abs(local), halfSize));
+	}
+
+	// world coordinates -> box coordinates, in which the box is [-1, 1]^3
+	glm::mat4 BoxFromWorld() const {
+		glm::mat4 boxToWorld(glm::vec4(axes[0] * halfSize.x, 0), glm::vec4(axes[1] * halfSize.y, 0), glm::vec4(axes[2] * halfSize.z, 0), glm::vec4(center, 1));
+		return glm::inverse(boxToWorld);
+	}
+
+	// [nearest, farthest] depth of the corners of the box in a camera, the near depth is 0 if the box reaches behind it
+	glm::vec2 DepthRange(const glm::mat4& view) const {
+		glm::vec2 range(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec3 offset((corner & 1 ? 1 : -1) * halfSize.x, (corner & 2 ? 1 : -1) * halfSize.y, (corner & 4 ? 1 : -1) * halfSize.z);
+			float depth = (view * glm::vec4(center + axes * offset, 1)).z;
+			range = glm::vec2(std::min(range.x, depth), std::max(range.y, depth));
+		}
+		range.x = std::max(range.x, 0.0f);
+		return range;
+	}
+
+	// keeps the splats inside the box, in order, and returns how many were removed
+	int Crop(/*in and out*/ std::vector<Splat>& splats) const {
+		int nrSplats = splats.size();
+		splats.erase(std::remove_if(splats.begin(), splats.end(), [&](const Splat& splat) { return !Contains(splat.position); }), splats.end());
+		return nrSplats - static_cast<int>(splats.size());
+	}
+
+	void Print() const {
+		printf("Region of interest: center %s, size %s, axes %s\n", glm::to_string(center).c_str(), glm::to_string(2.0f * halfSize).c_str(), glm::to_string(axes).c_str());
+	}
+
+private:
+	static const int minPoints = 10;
+	static constexpr float minThickness = 0.1f;
+
+	// eigenvectors of a symmetric 3x3 matrix, as a right-handed rotation
+	static glm::mat3 PrincipalAxes(const glm::mat3& a) {
+		glm::vec3 eigenvalues;
+		glm::mat3 v;
+		SymmetricEigen3(a, eigenvalues, v);
+		if (glm::determinant(v) < 0) v[2] = -v[2];
+		return v;
+	}
+};
+
+#endif // !REGION_OF_INTEREST_H
@@ -9,6 +9,7 @@
 #include <sstream>
 #include <iostream>
 #include <unordered_map>
+#include <functional>
 
 class Shader
 {
@@ -28,51 +29,18 @@ public:
 		std::string vertexCode;
 		std::string fragmentCode;
 		std::string geometryCode;
-		std::ifstream vShaderFile;
-		std::ifstream fShaderFile;
-		std::ifstream gShaderFile;
-		// ensure ifstream objects can throw exceptions:
-		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		try
-		{
-			// open files
-			vShaderFile.open(vertexPath);
-			std::stringstream vShaderStream, fShaderStream;
-			// read file's buffer contents into streams
-			vShaderStream << vShaderFile.rdbuf();
-			// close file handlers
-			vShaderFile.close();
-			// convert stream into string
-			vertexCode = vShaderStream.str();
-
-			// fragment shader
-			if (fragmentPath == "") {
-				fragmentPath = nullptr;
-			}
-			if (fragmentPath != nullptr) {
-				fShaderFile.open(fragmentPath);
-				fShaderStream << fShaderFile.rdbuf();
-				fShaderFile.close();
-				fragmentCode = fShaderStream.str();
-			}
+		if (!readFile(vertexPath, vertexCode)) return false;
+		if (fragmentPath != nullptr && !readFile(fragmentPath, fragmentCode)) return false;
+		if (geometryPath != nullptr && !readFile(geometryPath, geometryCode)) return false;
+		return initFromSource(vertexCode, fragmentCode, geometryCode);
+	}
 
-			// if geometry shader path is present, also load a geometry shader
-			if (geometryPath != nullptr)
-			{
-				gShaderFile.open(geometryPath);
-				std::stringstream gShaderStream;
-				gShaderStream << gShaderFile.rdbuf();
-				gShaderFile.close();
-				geometryCode = gShaderStream.str();
-			}
-		}
-		catch (std::ifstream::failure)
-		{
-			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-			return false;
-		}
+	// compile and link the program from GLSL sources (fragmentCode and geometryCode may be empty), with the given transform
+	// feedback varyings. beforeLink is called with the program right before it is linked.
+	// ------------------------------------------------------------------------
+	bool initFromSource(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode,
+		const std::vector<const char*>& varyings = {}, std::function<void(GLuint)> beforeLink = nullptr)
+	{
 		const char* vShaderCode = vertexCode.c_str();
 		// 2. compile shaders
 		unsigned int vertex;
@@ -85,8 +53,8 @@ public:
 		}
 		
 		// fragment Shader
-		unsigned int fragment;
-		if (fragmentPath != nullptr) {
+		unsigned int fragment = 0;
+		if (!fragmentCode.empty()) {
 			const char* fShaderCode = fragmentCode.c_str();
 			fragment = glCreateShader(GL_FRAGMENT_SHADER);
 			glShaderSource(fragment, 1, &fShaderCode, NULL);
@@ -97,8 +65,8 @@ public:
 		}
 
 		// if geometry shader is given, compile geometry shader
-		unsigned int geometry;
-		if (geometryPath != nullptr)
+		unsigned int geometry = 0;
+		if (!geometryCode.empty())
 		{
 			const char* gShaderCode = geometryCode.c_str();
 			geometry = glCreateShader(GL_GEOMETRY_SHADER);
@@ -110,28 +78,44 @@ public:
 		}
 		// shader Program
 		ID = glCreateProgram();
+		uniformLocationMap.clear();
 		glAttachShader(ID, vertex);
-		if (fragmentPath != nullptr) 
+		if (!fragmentCode.empty()) 
 			glAttachShader(ID, fragment);
-		if (geometryPath != nullptr)
+		if (!geometryCode.empty())
 			glAttachShader(ID, geometry);
 
-		if (fragmentPath != nullptr) {
-			glLinkProgram(ID);
-			if (!checkCompileErrors(ID, "PROGRAM")) {
-				return false;
-			}
+		if (!varyings.empty()) {
+			glTransformFeedbackVaryings(ID, varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+		}
+		if (beforeLink) {
+			beforeLink(ID);
+		}
+		glLinkProgram(ID);
+		if (!checkCompileErrors(ID, "PROGRAM")) {
+			return false;
 		}
 		
 		// delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
-		if (fragmentPath != nullptr)
+		if (!fragmentCode.empty())
 			glDeleteShader(fragment);
-		if (geometryPath != nullptr)
+		if (!geometryCode.empty())
 			glDeleteShader(geometry);
 		return true;
 
 	}
+	// use a program that is linked already (e.g. see ProgramCache)
+	// ------------------------------------------------------------------------
+	void initFromProgram(GLuint program)
+	{
+		ID = program;
+		uniformLocationMap.clear();
+	}
+	GLuint getID() const
+	{
+		return ID;
+	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use()
@@ -165,6 +149,11 @@ public:
 		glUniform1f(getUniformLocation(name), value);
 	}
 	// ------------------------------------------------------------------------
+	void setFloatArray(const std::string& name, const std::vector<float>& values) const
+	{
+		glUniform1fv(getUniformLocation(name), values.size(), values.data());
+	}
+	// ------------------------------------------------------------------------
 	void setVec2(const std::string& name, const glm::vec2& value) const
 	{
 		glUniform2fv(getUniformLocation(name), 1, &value[0]);
@@ -207,17 +196,21 @@ public:
 		glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 	}
 
-	bool InitTransformFeedShader(int nrVaryings, const char* varyings[]) {
-		glTransformFeedbackVaryings(ID, nrVaryings, varyings, GL_INTERLEAVED_ATTRIBS);
-		glLinkProgram(ID);
-		if (!checkCompileErrors(ID, "PROGRAM")) {
+
+private:
+	static bool readFile(const char* path, /*out*/ std::string& code)
+	{
+		std::ifstream file(path);
+		if (!file) {
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
 			return false;
 		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		code = stream.str();
 		return true;
 	}
 
-
-private:
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	bool checkCompileErrors(GLuint shader, std::string type)
@@ -24,33 +24,53 @@ public:
 	Shader showImageShader;
 
 	// rough depth map
+	Shader imageFeaturesShader;
 	Shader quadDepthErrorShader;
-	Shader sumRadiusShader;
-	Shader errorToDepthShader0;
-	Shader errorToDepthShader1;
+	Shader reprojectDepthShader;
+	Shader priorFallbackShader;
+	Shader layerRangeShader;
 
 	// splat generation
 	Shader maskBadPixelsShader;
 	Shader writeSplats;
+	Shader importanceShader;
 
-	const std::string basePath = cmakelists_dir + "/src/shaders/";
+	// The GLSL sources are embedded in the executable (see cmake/EmbedShaders.cmake). To edit shaders without rebuilding,
+	// set shadersPath to a folder (ending in /) with the .vs, .gs and .fs files before Init.
+	std::string shadersPath = "";
+	// linked programs of earlier runs, Init() skips compiling the programs it finds in there
+	ProgramCache programCache;
 
 public:
 
-	bool Init(Intrinsics intrinsics, int width_g, int height_g, float scale_g) {
+	// cacheFolder: of the ProgramCache, "" = compile every run
+	bool Init(Intrinsics intrinsics, int width_g, int height_g, float scale_g, std::string cacheFolder = "") {
+		this->intrinsics = intrinsics;
+		variants.clear();
 
-		std::cout << "Reading GLSL files from " << basePath << std::endl;
+		if (!shadersPath.empty()) {
+			std::cout << "Reading GLSL files from " << shadersPath << std::endl;
+		}
+		programCache.Init(cacheFolder);
+		nrPrograms = 0;
+		nrCompiled = 0;
 
 		// render mesh
 		if (!CompileShader(sfmPointsShaders, "sfm_points.vs", "sfm_points.fs")) return false;
 		if (!CompileShader(depthMapShader, "depthmap.vs", "depthmap.fs")) return false;
 		if (!CompileShader(showImageShader, "copy_tex.vs", "copy_tex.fs")) return false;
-		if (!CompileShader(quadDepthErrorShader, "copy_tex.vs", "quad_depth_error.fs")) return false;
-		if (!CompileShader(sumRadiusShader, "copy_tex.vs", "sum_radius2.fs")) return false;
-		if (!CompileShader(errorToDepthShader0, "copy_tex.vs", "error2depth0.fs")) return false;
-		if (!CompileShader(errorToDepthShader1, "copy_tex.vs", "error2depth1.fs")) return false;
+		if (!CompileShader(imageFeaturesShader, "copy_tex.vs", "image_features.fs")) return false;
+		if (!CompileShader(quadDepthErrorShader, "tile.vs", "quad_depth_error.fs")) return false;
+		if (!CompileShader(reprojectDepthShader, "reproject_depth.vs", "reproject_depth.fs")) return false;
+		if (!CompileShader(priorFallbackShader, "tile.vs", "prior_fallback.fs")) return false;
+		if (!CompileShader(layerRangeShader, "copy_tex.vs", "layer_range.fs")) return false;
 		if (!CompileShader(maskBadPixelsShader, "copy_tex.vs", "mask_bad_pixels3.fs")) return false;
-		if (!CompileShader(writeSplats, "write_splats.vs", "", "write_splats.gs")) return false;
+		if (!CompileShader(writeSplats, "write_splats.vs", "", "write_splats.gs",
+			{ "out_position", "out_color", "out_scale", "out_scales", "out_rotation", "out_confidence", "out_sh1" })) return false;
+		if (!CompileShader(importanceShader, "copy_tex.vs", "importance.fs")) return false;
+		if (programCache.Enabled()) {
+			printf("Program cache: compiled %d of %d programs\n", nrCompiled, nrPrograms);
+		}
 
 		sfmPointsShaders.use();
 		sfmPointsShaders.setFloat("width", static_cast<float>(width_g));
@@ -79,61 +99,220 @@ public:
 		showImageShader.use();
 		showImageShader.setInt("inputTex", 0);
 
+		imageFeaturesShader.use();
+		imageFeaturesShader.setInt("colorTex", 0);
+		imageFeaturesShader.setFloat("width", static_cast<float>(intrinsics.width));
+		imageFeaturesShader.setFloat("height", static_cast<float>(intrinsics.height));
+
 		quadDepthErrorShader.use();
 		quadDepthErrorShader.setInt("mainColorTex", 0);
 		quadDepthErrorShader.setInt("neighborColorTex", 1);
+		quadDepthErrorShader.setInt("mainFeatureTex", 2);
+		quadDepthErrorShader.setInt("neighborFeatureTex", 3);
+		quadDepthErrorShader.setInt("mainMaskTex", 4);
+		quadDepthErrorShader.setInt("neighborMaskTex", 5);
+		quadDepthErrorShader.setInt("useUserMasks", 0);
+		quadDepthErrorShader.setInt("layerRangeTex", 6);
+		quadDepthErrorShader.setInt("useLayerRange", 0);
+		quadDepthErrorShader.setInt("cost", 0);
 		quadDepthErrorShader.setFloat("width", static_cast<float>(intrinsics.width));
 		quadDepthErrorShader.setFloat("height", static_cast<float>(intrinsics.height));
 		quadDepthErrorShader.setVec2("focal", glm::vec2(intrinsics.fx, intrinsics.fy));
 		quadDepthErrorShader.setVec2("pp", glm::vec2(intrinsics.cx, intrinsics.cy));
+		quadDepthErrorShader.setVec4("texRegion", glm::vec4(0, 0, 1, 1));
+
+		reprojectDepthShader.use();
+		reprojectDepthShader.setInt("depthTex", 0);
+		reprojectDepthShader.setInt("maskTex", 1);
+		reprojectDepthShader.setFloat("width", static_cast<float>(intrinsics.width));
+		reprojectDepthShader.setFloat("height", static_cast<float>(intrinsics.height));
+		reprojectDepthShader.setVec2("focal", glm::vec2(intrinsics.fx, intrinsics.fy));
+		reprojectDepthShader.setVec2("pp", glm::vec2(intrinsics.cx, intrinsics.cy));
+
+		priorFallbackShader.use();
+		priorFallbackShader.setInt("priorTex", 0);
+		priorFallbackShader.setInt("maskTex", 1);
+		priorFallbackShader.setInt("userMaskTex", 2);
+		priorFallbackShader.setInt("useUserMasks", 0);
+		priorFallbackShader.setVec4("texRegion", glm::vec4(0, 0, 1, 1));
 
-		sumRadiusShader.use();
-		sumRadiusShader.setFloat("width", static_cast<float>(intrinsics.width));
-		sumRadiusShader.setFloat("height", static_cast<float>(intrinsics.height));
+		layerRangeShader.use();
+		layerRangeShader.setInt("priorTex", 0);
+		layerRangeShader.setInt("maskTex", 1);
+		layerRangeShader.setFloat("width", static_cast<float>(intrinsics.width));
+		layerRangeShader.setFloat("height", static_cast<float>(intrinsics.height));
 		
 		maskBadPixelsShader.use();
-		maskBadPixelsShader.setInt("mainColorTex", 0);
-		maskBadPixelsShader.setInt("mainDepthTex", 1);
-		maskBadPixelsShader.setInt("neighborColorTex", 2);
-		maskBadPixelsShader.setInt("neighborDepthTex", 3);
+		maskBadPixelsShader.setInt("colorTexA", 0);
+		maskBadPixelsShader.setInt("depthTexA", 1);
+		maskBadPixelsShader.setInt("colorTexB", 2);
+		maskBadPixelsShader.setInt("depthTexB", 3);
+		maskBadPixelsShader.setInt("userMaskTexA", 4);
+		maskBadPixelsShader.setInt("userMaskTexB", 5);
+		maskBadPixelsShader.setInt("useUserMasks", 0);
 		maskBadPixelsShader.setFloat("width", static_cast<float>(intrinsics.width));
 		maskBadPixelsShader.setFloat("height", static_cast<float>(intrinsics.height));
 		maskBadPixelsShader.setVec2("focal", glm::vec2(intrinsics.fx, intrinsics.fy));
 		maskBadPixelsShader.setVec2("pp", glm::vec2(intrinsics.cx, intrinsics.cy));
 
-		const char* varyings[] = { "out_position", "out_color", "out_scale" };
-		if (!writeSplats.InitTransformFeedShader(3, varyings)) return false;
+		importanceShader.use();
+		importanceShader.setInt("colorTex", 0);
+		importanceShader.setInt("depthTex", 1);
+		importanceShader.setInt("maskTex", 2);
+		importanceShader.setInt("userMaskTex", 3);
+		importanceShader.setInt("useUserMasks", 0);
+		importanceShader.setFloat("width", static_cast<float>(intrinsics.width));
+		importanceShader.setFloat("height", static_cast<float>(intrinsics.height));
+
 		writeSplats.use();
 		writeSplats.setInt("colorTex", 0);
 		writeSplats.setInt("depthTex", 1);
 		writeSplats.setInt("maskTex", 2);
+		writeSplats.setInt("confidenceTex", 3);
+		for (int i = 0; i < 4; i++) {
+			writeSplats.setInt("neighborColorTex[" + std::to_string(i) + "]", 4 + i);
+		}
+		writeSplats.setInt("nrNeighbors", 0);
+		writeSplats.setInt("useRoi", 0);
 
 		return true;
 	}
 
+	// The shaders of the plane sweep are specialized per configuration: its constants are #defines, so that the driver can
+	// unroll their loops. A variant is compiled (or loaded from the programCache) the first time it is asked for, and kept
+	// for the rest of the run. They return nullptr if the variant does not compile.
+
+	// sum_radius2.fs, aggregating the errors of nrNeighbors neighbors over the taps of a disk with radius, every step pixels
+	Shader* SumRadiusShader(int radius, int step, int nrNeighbors) {
+		// the taps, in the order of the loops they replace: by row, then by column
+		std::string taps;
+		int nrTaps = 0;
+		for (int y = -radius; y <= radius; y += step) {
+			for (int x = -radius; x <= radius; x += step) {
+				if (x * x + y * y > radius * radius) continue;
+				taps += (nrTaps > 0 ? ", ivec2(" : "ivec2(") + std::to_string(x) + ", " + std::to_string(y) + ")";
+				nrTaps++;
+			}
+		}
+		Defines defines = { { "NR_NEIGHBORS", std::to_string(nrNeighbors) }, { "NR_TAPS", std::to_string(nrTaps) }, { "TAPS", taps } };
+		return Variant("tile.vs", "sum_radius2.fs", defines, [&](Shader& shader) {
+			shader.setFloat("width", static_cast<float>(intrinsics.width));
+			shader.setFloat("height", static_cast<float>(intrinsics.height));
+			shader.setVec4("texRegion", glm::vec4(0, 0, 1, 1));
+			shader.setInt("priorMode", 0);
+			shader.setInt("useUserMasks", 0);
+			shader.setVec2("focal", glm::vec2(intrinsics.fx, intrinsics.fy));
+			shader.setVec2("pp", glm::vec2(intrinsics.cx, intrinsics.cy));
+			shader.setInt("useRoi", 0);
+		});
+	}
+
+	// error2depth0.fs, for a chunk of nrLayers (at most 32) error textures
+	Shader* ErrorToDepthShader0(int nrLayers) {
+		return Variant("copy_tex.vs", "error2depth0.fs", { { "LAYER_CHUNK", std::to_string(nrLayers) } }, [](Shader&) {});
+	}
+
+	// error2depth1.fs, combining the results of nrChunks chunks
+	Shader* ErrorToDepthShader1(int nrChunks) {
+		return Variant("tile.vs", "error2depth1.fs", { { "NR_CHUNKS", std::to_string(nrChunks) } }, [](Shader& shader) {
+			shader.setVec4("texRegion", glm::vec4(0, 0, 1, 1));
+			shader.setInt("priorMode", 0);
+		});
+	}
+
 private:
-	bool CompileShader(Shader& shaderToCompile, std::string vertex, std::string fragment) {
-		if (!shaderToCompile.init((basePath + vertex).c_str(), (basePath + fragment).c_str())) {
-			printf("Error: failed to compile %s or %s\n", vertex.c_str(), fragment.c_str());
+	typedef std::vector<std::pair<std::string, std::string>> Defines; // name, value
+
+	Intrinsics intrinsics;
+	std::map<std::string, Shader> variants; // by files and defines
+
+	// the variant of a program with the given defines, which setUniforms initializes after it is linked
+	Shader* Variant(const std::string& vertex, const std::string& fragment, const Defines& defines, std::function<void(Shader&)> setUniforms) {
+		std::string key = vertex + "|" + fragment;
+		for (auto& define : defines) {
+			key += "|" + define.first + "=" + define.second;
+		}
+		auto found = variants.find(key);
+		if (found != variants.end()) return &found->second;
+
+		Shader& shader = variants[key];
+		if (!CompileShader(shader, vertex, fragment, "", {}, defines)) {
+			variants.erase(key);
+			return nullptr;
+		}
+		shader.use();
+		setUniforms(shader);
+		return &shader;
+	}
+
+	// code with a #define for each of defines, after its #version line (which must come first in GLSL)
+	static std::string Specialize(const std::string& code, const Defines& defines) {
+		if (code.empty() || defines.empty()) return code;
+		std::string lines;
+		for (auto& define : defines) {
+			lines += "#define " + define.first + " " + define.second + "\n";
+		}
+		size_t version = code.find("#version");
+		size_t end = version == std::string::npos ? 0 : code.find('\n', version);
+		if (end == std::string::npos) return code + "\n" + lines;
+		if (version != std::string::npos) end++;
+		return code.substr(0, end) + lines + code.substr(end);
+	}
+
+	int nrPrograms = 0; // linked by the last Init
+	int nrCompiled = 0; // of those, the others came from the programCache
+
+	// Link a program from the given shader files (fragment and geometry may be ""), with the given transform feedback varyings
+	// and #defines. The linked program comes from the programCache if it is there, otherwise it is compiled and stored in the cache.
+	bool CompileShader(Shader& shaderToCompile, std::string vertex, std::string fragment, std::string geometry = "", std::vector<const char*> varyings = {},
+		const Defines& defines = {}) {
+		std::string vertexCode, fragmentCode, geometryCode;
+		if (!Source(vertex, vertexCode) || !Source(fragment, fragmentCode) || !Source(geometry, geometryCode)) return false;
+		vertexCode = Specialize(vertexCode, defines);
+		fragmentCode = Specialize(fragmentCode, defines);
+		geometryCode = Specialize(geometryCode, defines);
+
+		std::vector<std::string> keyParts = { vertexCode, fragmentCode, geometryCode };
+		keyParts.insert(keyParts.end(), varyings.begin(), varyings.end());
+		std::string key = programCache.Key(keyParts);
+		nrPrograms++;
+		GLuint program = programCache.Load(key);
+		if (program != 0) {
+			shaderToCompile.initFromProgram(program);
+			return true;
+		}
+
+		auto beforeLink = [&](GLuint id) { programCache.SetRetrievable(id); };
+		if (!shaderToCompile.initFromSource(vertexCode, fragmentCode, geometryCode, varyings, beforeLink)) {
+			printf("Error: failed to compile %s %s %s\n", vertex.c_str(), fragment.c_str(), geometry.c_str());
 			return false;
 		}
+		programCache.Store(key, shaderToCompile.getID());
+		nrCompiled++;
 		return true;
 	}
 
-	bool CompileShader(Shader& shaderToCompile, std::string vertex, std::string fragment, std::string geometry) {
-		if (fragment == "") {
-			if (!shaderToCompile.init((basePath + vertex).c_str(), nullptr, (basePath + geometry).c_str())) {
-				printf("Error: failed to compile %s or %s\n", vertex.c_str(), geometry.c_str());
+	// the GLSL source of a shader file, from shadersPath or else embedded in the executable ("" for no file)
+	bool Source(const std::string& name, /*out*/ std::string& code) {
+		code.clear();
+		if (name.empty()) return true;
+		if (!shadersPath.empty()) {
+			std::ifstream file(shadersPath + name);
+			if (!file) {
+				printf("Error: could not read %s%s\n", shadersPath.c_str(), name.c_str());
 				return false;
 			}
+			std::stringstream stream;
+			stream << file.rdbuf();
+			code = stream.str();
+			return true;
 		}
-		else {
-			if (!shaderToCompile.init((basePath + vertex).c_str(), (basePath + fragment).c_str(), (basePath + geometry).c_str())) {
-				printf("Error: failed to compile %s or %s or %s\n", vertex.c_str(), fragment.c_str(), geometry.c_str());
-				return false;
-			}
+		auto found = embeddedShaders.find(name);
+		if (found == embeddedShaders.end()) {
+			printf("Error: shader %s is not embedded in the executable, rebuild it\n", name.c_str());
+			return false;
 		}
-		
+		code = found->second;
 		return true;
 	}
 };
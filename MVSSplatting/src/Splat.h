@@ -0,0 +1,28 @@
+#ifndef SPLAT_H
+#define SPLAT_H
+
+// One gaussian splat, laid out exactly like a transform feedback record of write_splats.gs
+struct Splat {
+	glm::vec3 position;
+	glm::vec3 color;
+	float scale;       // isotropic scale
+	glm::vec3 scales;  // anisotropic scales, along the 2 surface tangents and the normal
+	glm::vec4 rotation; // quaternion (w, x, y, z), rotates the axes of the scales onto the tangents and normal
+	float confidence;   // [0, 1] how reliable the MVS depth was
+	// degree-1 spherical harmonics in the convention of 3DGS: RGB coefficients of the basis functions -C1 y, C1 z and -C1 x
+	// of the view direction, on top of color. 0 unless fitted from multiple views (see write_splats.vs).
+	glm::vec3 sh1[3] = { glm::vec3(0), glm::vec3(0), glm::vec3(0) };
+
+	static Splat Isotropic(glm::vec3 position, glm::vec3 color, float scale, float confidence) {
+		return { position, color, scale, glm::vec3(scale), glm::vec4(1, 0, 0, 0), confidence };
+	}
+};
+
+static_assert(sizeof(Splat) == 24 * sizeof(float), "Splat must match the transform feedback layout");
+
+// the first 7 floats of a Splat (x, y, z, r, g, b, scale), as stored in the raw .bin format
+const int nrRawSplatFloats = 7;
+// the floats of a Splat before sh1
+const int nrSplatFloatsWithoutSh = 15;
+
+#endif // !SPLAT_H
@@ -13,40 +13,289 @@ private:
     std::vector<int> keyCamIds;
     std::map<int, std::vector<int>> neighborIds;
     std::map<int, std::vector<int>> mvsNeighbors;
+    std::unordered_map<int, glm::vec2> depthBounds; // [near, far] of each key camera's depth map
+    CpuSplatter host; // copies of the textures, if cpu
 
 public:
-    SplatGenerator(Intrinsics intrinsics, Extrinsics extrinsics, std::vector<int> keyCamIds) :
+    // merge near-duplicate splats of overlapping key views, with cells of mergeCellFactor x the splat size (0 = disabled)
+    float mergeCellFactor = 0;
+    // place the splats according to the detail in each key view, instead of on a uniform grid
+    bool adaptiveSampling = false;
+    // nr of splats (MVS + Colmap) to write, 0 = let tfSubdivisions decide
+    int targetNrSplats = 0;
+    // fuse the depth maps of all key views in a TSDF volume with voxels of tsdfVoxelFactor x the splat spacing, and
+    // extract the splats from its surface instead of from each key view (0 = disabled)
+    float tsdfVoxelFactor = 0;
+    // drop the MVS splats whose confidence (see Splat::confidence) is below minConfidence (0 = keep all)
+    float minConfidence = 0;
+    // nearest neighbor post-processing: remove splats whose mean neighbor distance is more than outlierStdRatio standard
+    // deviations above average (0 = disabled), and/or set the scales from the mean neighbor distance
+    int knnNeighbors = 3;
+    float outlierStdRatio = 0;
+    bool knnScales = false;
+    // color the splats with a robust mean over the key view and its MVS neighbors instead of the key view alone,
+    // and optionally fit degree-1 SH to the colors per view direction (Splat::sh1)
+    bool multiViewColor = false;
+    bool fitSh1 = false;
+    // also write a level-of-detail octree of the splats, to <path without extension>_lod.mvss
+    bool lod = false;
+    // only keep the splats inside the region of interest, if enabled
+    RegionOfInterest roi;
+    // run the consistency check and the extraction on the CPU threads (CpuSplatter) instead of the GPU
+    bool cpu = false;
+    // host.views were loaded by LoadHostViews instead of copied from the textures: there is no GL context (implies cpu)
+    bool hostOnly = false;
+    // output format of WriteToFile
+    SplatWriter writer;
+
+    SplatGenerator(Intrinsics intrinsics, Extrinsics extrinsics, std::map<int, std::vector<int>> mvsNeighbors, std::vector<int> keyCamIds, std::unordered_map<int, glm::vec2> depthBounds) :
         shaders(ShaderController::getInstance()),
         framebuffers(FrameBufferController::getInstance()),
         textures(TexController::getInstance()),
         intrinsics(intrinsics),
         extrinsics(extrinsics),
-        keyCamIds(keyCamIds) { }
+        keyCamIds(keyCamIds),
+        mvsNeighbors(mvsNeighbors),
+        depthBounds(depthBounds),
+        host(intrinsics, extrinsics) { }
 
     // textures.masks: 1 means good pixel, 0 means throw away pixel
     void MaskAwayUnnecessaryPixels() {
 
-        // render neighbor to main and mask off bad neighbor pixels
-        shaders.maskBadPixelsShader.use();
-        for (int& mainId : keyCamIds) {
-            shaders.maskBadPixelsShader.setMat4("view", extrinsics.poses[mainId].view);
+        // only key cameras whose depth maps can see each other's points need to be checked
+        std::vector<std::pair<int, int>> pairs;
+        CalculateOverlappingPairs(/*out*/ pairs);
 
-            for (int& neighborId : keyCamIds) {
-                if (neighborId == mainId) continue; // skip same cameras
-                shaders.maskBadPixelsShader.setMat4("model", extrinsics.poses[neighborId].model);
-                framebuffers.MaskOffBadlyProjectedPixels(textures.images[mainId], textures.mvs_rough[mainId], textures.images[neighborId], textures.mvs_rough[neighborId], textures.masks[neighborId]);
+        if (cpu) {
+            ReadHostViews(/*colorNeighbors*/ false);
+            for (auto& pair : pairs) {
+                host.MaskBadPixels(pair.first, pair.second);
             }
+            if (hostOnly) return;
+            // the rest of the pipeline (and the GUI) reads the masks from the textures
+            for (int& id : keyCamIds) {
+                textures.WriteTexture(textures.masks[id], GL_RED, GL_UNSIGNED_BYTE, host.views[id].mask.data());
+            }
+            return;
+        }
+
+        // render each camera of a pair to the other one, and mask off the badly projected pixels of both
+        shaders.maskBadPixelsShader.use();
+        shaders.maskBadPixelsShader.setInt("useUserMasks", textures.userMasks.empty() ? 0 : 1);
+        for (auto& pair : pairs) {
+            int idA = pair.first;
+            int idB = pair.second;
+            shaders.maskBadPixelsShader.setMat4("modelA", extrinsics.poses[idA].model);
+            shaders.maskBadPixelsShader.setMat4("viewA", extrinsics.poses[idA].view);
+            shaders.maskBadPixelsShader.setMat4("modelB", extrinsics.poses[idB].model);
+            shaders.maskBadPixelsShader.setMat4("viewB", extrinsics.poses[idB].view);
+            framebuffers.MaskOffBadlyProjectedPixels(textures.images[idA], textures.mvs_rough[idA], textures.images[idB], textures.mvs_rough[idB], textures.masks[idA], textures.masks[idB],
+                textures.UserMask(idA), textures.UserMask(idB));
         }
     }
 
     void WriteToFile(std::string path, float tfSubdivisions, SfmPoints sfmPoints) {
 
-        std::ofstream file(path, std::ios::binary);
-        int totalNrPoints = 0;
+        if (adaptiveSampling) {
+            textures.CreateImportanceTex();
+        }
+        if (roi.enabled) {
+            CropSfmPoints(sfmPoints);
+        }
+
+        // the raw format needs no post-processing of the whole set of splats, so it is written while the key views are extracted
+        bool streaming = writer.format == SplatWriter::Format::Bin && mergeCellFactor == 0 && targetNrSplats == 0 && tsdfVoxelFactor == 0 && minConfidence <= 0 && outlierStdRatio <= 0 && !knnScales && !lod;
+        if (streaming && !writer.Open(path)) return;
+
+        std::vector<Splat> splats;
+        int nrMvsSplats = 0;
+        int targetNrMvsSplats = 0;
+        if (tsdfVoxelFactor > 0) {
+            nrMvsSplats = FuseSplats(tfSubdivisions, splats);
+            if (roi.enabled) {
+                nrMvsSplats -= roi.Crop(splats);
+            }
+        }
+        else if (targetNrSplats > 0) {
+            targetNrMvsSplats = ExtractTargetNrSplats(sfmPoints, /*in and out*/ tfSubdivisions, splats);
+            nrMvsSplats = splats.size();
+        }
+        else {
+            nrMvsSplats = ExtractSplats(tfSubdivisions, splats, streaming ? &writer : nullptr);
+        }
+        float diameter = tfSubdivisions * 0.5f / intrinsics.fx;
+        printf("Nr of splats from MVS: %d\n", nrMvsSplats);
+
+        // also convert the Colmap point cloud to splats
+        std::vector<Splat> sfmSplats;
+        for (int& id : extrinsics.imageIds) {
+            std::vector<glm::vec3>& points = sfmPoints.points[id];
+            std::vector<glm::vec3>& colors = sfmPoints.colors[id];
+            for (int i = 0; i < points.size(); i++) {
+                // Colmap points are triangulated from many views, so consider them reliable
+                sfmSplats.push_back(Splat::Isotropic(points[i], colors[i], glm::length(points[i] - extrinsics.poses[id].pos) * diameter, 1.0f));
+            }
+        }
+        printf("Nr of splats from Colmap: %d %s\n", (int)sfmSplats.size(), extrinsics.eval? "(removed test set points)":"");
+        if (tsdfVoxelFactor > 0 && targetNrSplats > 0) {
+            targetNrMvsSplats = std::max(0, targetNrSplats - static_cast<int>(sfmSplats.size()));
+        }
+
+        bool written;
+        if (streaming) {
+            writer.Append(sfmSplats.data(), sfmSplats.size());
+            written = writer.Close();
+        }
+        else {
+            splats.insert(splats.end(), sfmSplats.begin(), sfmSplats.end());
+            PostProcess(nrMvsSplats, targetNrMvsSplats, splats);
+            written = writer.Write(path, splats);
+        }
+        if (written) {
+            printf("Wrote splats to %s\n", path.c_str());
+        }
+
+        if (lod) {
+            std::string lodPath = path.substr(0, path.find_last_of('.')) + "_lod.mvss";
+            SplatOctree octree;
+            octree.Build(splats);
+            if (writer.WriteLod(lodPath, octree)) {
+                printf("Wrote the splat hierarchy to %s\n", lodPath.c_str());
+            }
+        }
+    }
+
+    // Write the depth maps of the key views to folder (see DepthMapPath), with 0 where they are masked off, for --host-depth
+    bool SaveDepthMaps(const std::string& folder) {
+        std::vector<float> depth(intrinsics.width * intrinsics.height);
+        std::vector<unsigned char> mask(depth.size());
+        for (int& id : keyCamIds) {
+            textures.ReadTexture(textures.mvs_rough[id], GL_RED, GL_FLOAT, depth.data());
+            textures.ReadTexture(textures.masks[id], GL_RED, GL_UNSIGNED_BYTE, mask.data());
+            for (size_t i = 0; i < depth.size(); i++) {
+                if (mask[i] <= 127) depth[i] = 0;
+            }
+            std::string path = DepthMapPath(folder, id);
+            std::error_code error;
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+            if (!CpuSplatter::WriteDepthMap(path, depth)) return false;
+        }
+        printf("Wrote %d depth maps to %s\n", (int)keyCamIds.size(), folder.c_str());
+        return true;
+    }
+
+    // Fill host.views without GL, for --host-depth: the depth maps of the key views from folder (as SaveDepthMaps writes them),
+    // and the images of the key views and of their (first 4) MVS neighbors if colorNeighbors. The depth bounds of the
+    // consistency check are taken from the depth maps.
+    bool LoadHostViews(const std::string& folder, const std::string& imagesPath, bool colorNeighbors) {
+        std::map<uint32_t, Undistorter> remaps;
+        for (auto& pair : intrinsics.cameras) {
+            if (intrinsics.NeedsRemap(pair.second)) remaps[pair.first].Init(pair.second, intrinsics);
+        }
+        auto remapOf = [&](int id) -> const Undistorter* {
+            auto found = remaps.find(extrinsics.cameraIds[id]);
+            return found == remaps.end() ? nullptr : &found->second;
+        };
+
+        for (int& id : keyCamIds) {
+            if (!host.LoadView(id, imagesPath + extrinsics.imageNames[id], DepthMapPath(folder, id), remapOf(id))) return false;
+            glm::vec2 bounds(std::numeric_limits<float>::max(), 0.0f);
+            for (float depth : host.views[id].depth) {
+                if (depth > 0) bounds = glm::vec2(std::min(bounds.x, depth), std::max(bounds.y, depth));
+            }
+            depthBounds[id] = bounds.y > 0 ? bounds : glm::vec2(0);
+        }
+        if (colorNeighbors) {
+            for (int& id : keyCamIds) {
+                std::vector<int>& neighbors = mvsNeighbors[id];
+                for (size_t n = 0; n < neighbors.size() && n < 4; n++) {
+                    if (host.views.count(neighbors[n]) > 0) continue;
+                    if (!host.LoadView(neighbors[n], imagesPath + extrinsics.imageNames[neighbors[n]], "", remapOf(neighbors[n]))) return false;
+                }
+            }
+        }
+        printf("Loaded %d depth maps from %s\n", (int)keyCamIds.size(), folder.c_str());
+        hostOnly = true;
+        cpu = true;
+        return true;
+    }
+
+    std::string DepthMapPath(const std::string& folder, int id) {
+        return folder + extrinsics.imageNames[id] + ".depth";
+    }
+
+private:
+
+    // removes the Colmap points outside the region of interest
+    void CropSfmPoints(/*in and out*/ SfmPoints& sfmPoints) {
+        int nrRemoved = 0;
+        for (int& id : extrinsics.imageIds) {
+            std::vector<glm::vec3>& points = sfmPoints.points[id];
+            std::vector<glm::vec3>& colors = sfmPoints.colors[id];
+            int nrKept = 0;
+            for (size_t i = 0; i < points.size(); i++) {
+                if (!roi.Contains(points[i])) continue;
+                points[nrKept] = points[i];
+                colors[nrKept] = colors[i];
+                nrKept++;
+            }
+            nrRemoved += points.size() - nrKept;
+            points.resize(nrKept);
+            colors.resize(nrKept);
+        }
+        printf("Removed %d Colmap points outside the region of interest\n", nrRemoved);
+    }
+
+    // Post-processing of the final set of splats, of which the first nrMvsSplats come from MVS: dropping unconfident MVS
+    // splats, outlier removal, reducing the MVS splats to targetNrMvsSplats (if > 0), and scales from the nearest neighbors
+    void PostProcess(int nrMvsSplats, int targetNrMvsSplats, /*in and out*/ std::vector<Splat>& splats) {
+        if (minConfidence > 0) {
+            auto unconfident = [&](const Splat& splat) { return splat.confidence < minConfidence; };
+            auto kept = std::remove_if(splats.begin(), splats.begin() + nrMvsSplats, unconfident);
+            int nrDropped = static_cast<int>(splats.begin() + nrMvsSplats - kept);
+            splats.erase(kept, splats.begin() + nrMvsSplats);
+            nrMvsSplats -= nrDropped;
+            printf("Dropped %d MVS splats with a confidence below %f\n", nrDropped, minConfidence);
+        }
+
+        KnnFilter knn(knnNeighbors);
+        if (outlierStdRatio > 0) {
+            int nrSfmSplats = splats.size() - nrMvsSplats;
+            std::vector<bool> kept = knn.RemoveOutliers(outlierStdRatio, splats);
+            nrMvsSplats = std::count(kept.begin(), kept.begin() + nrMvsSplats, true);
+            if (targetNrMvsSplats > 0) {
+                // make up for removed Colmap splats, to keep the total at targetNrSplats
+                targetNrMvsSplats += nrSfmSplats - (static_cast<int>(splats.size()) - nrMvsSplats);
+            }
+        }
+
+        if (targetNrMvsSplats > 0) {
+            if (nrMvsSplats < targetNrMvsSplats) {
+                printf("Warning: could only extract %d of the targeted %d MVS splats\n", nrMvsSplats, targetNrMvsSplats);
+            }
+            std::vector<Splat> mvsSplats(splats.begin(), splats.begin() + nrMvsSplats);
+            Subsample(targetNrMvsSplats, mvsSplats);
+            mvsSplats.insert(mvsSplats.end(), splats.begin() + nrMvsSplats, splats.end());
+            splats.swap(mvsSplats);
+        }
+
+        if (knnScales) {
+            knn.SetScalesFromNeighbors(splats);
+        }
+    }
+
+    // Turn the key views into splats, with a probe every tfSubdivisions pixels.
+    // If stream is given, the splats are appended to it instead of to splats (which requires mergeCellFactor == 0).
+    // Returns the nr of extracted splats.
+    int ExtractSplats(float tfSubdivisions, /*out*/ std::vector<Splat>& splats, SplatWriter* stream = nullptr) {
+        if (cpu) {
+            return ExtractSplatsOnHost(tfSubdivisions, splats, stream);
+        }
 
         float diameter = tfSubdivisions * 0.5f / intrinsics.fx;
         shaders.writeSplats.use();
         shaders.writeSplats.setFloat("diameter", diameter);
+        shaders.writeSplats.setVec2("texelSize", glm::vec2(1.0f / intrinsics.width, 1.0f / intrinsics.height));
 
         int width_tf = intrinsics.width / tfSubdivisions;
         int height_tf = intrinsics.height / tfSubdivisions;
@@ -55,45 +304,328 @@ public:
         shaders.writeSplats.setFloat("height", static_cast<float>(height_tf));
         shaders.writeSplats.setVec2("focal", glm::vec2(intrinsics.fx * width_tf / intrinsics.width, intrinsics.fy * height_tf / intrinsics.height));
         shaders.writeSplats.setVec2("pp", glm::vec2(intrinsics.cx * width_tf / intrinsics.width, intrinsics.cy * height_tf / intrinsics.height));
-        
-        for (int& mainId : keyCamIds) {
+        shaders.writeSplats.setInt("fitSh1", fitSh1 ? 1 : 0);
+        shaders.writeSplats.setInt("nrNeighbors", 0);
+        shaders.writeSplats.setInt("useRoi", roi.enabled ? 1 : 0);
+        if (roi.enabled) {
+            shaders.writeSplats.setMat4("roiFromWorld", roi.BoxFromWorld());
+        }
+
+        // Pipeline the key views over the ring of transform feedback buffers: while the GPU extracts key view k, key view k - 1
+        // is mapped, and the worker thread copies (or writes) it out of the mapped buffer. A buffer is only unmapped and reused
+        // once the worker is done with it.
+        const int nrBuffers = FrameBufferController::nrTfBuffers;
+        int nrKeyCams = keyCamIds.size();
+        std::vector<std::vector<Splat>> splatsPerView(nrKeyCams);
+        std::vector<int> nrSplatsPerView(nrKeyCams, 0);
+        std::vector<int> jobs(nrBuffers, -1); // worker ticket per buffer, -1 if the buffer is free
+        BackgroundWorker worker;
+
+        auto readBack = [&](int k) {
+            int slot = k % nrBuffers;
+            const Splat* mapped = framebuffers.MapSplats(slot, nrSplatsPerView[k]);
+            int nrSplats = nrSplatsPerView[k];
+            if (stream) {
+                jobs[slot] = worker.Push([=]() { stream->Append(mapped, nrSplats); });
+            }
+            else {
+                std::vector<Splat>& destination = splatsPerView[k];
+                jobs[slot] = worker.Push([=, &destination]() { destination.assign(mapped, mapped + nrSplats); });
+            }
+        };
+        auto release = [&](int slot) {
+            if (jobs[slot] < 0) return;
+            worker.WaitFor(jobs[slot]);
+            framebuffers.UnmapSplats(slot);
+            jobs[slot] = -1;
+        };
+
+        for (int k = 0; k < nrKeyCams; k++) {
+            int mainId = keyCamIds[k];
+            if (adaptiveSampling) {
+                std::vector<glm::vec3> probes;
+                CalculateAdaptiveProbes(mainId, tfSubdivisions, probes);
+                framebuffers.SetTfProbes(probes);
+                shaders.writeSplats.use();
+            }
             shaders.writeSplats.setMat4("model", extrinsics.poses[mainId].model);
-            std::vector<float> buffer;
-            framebuffers.WriteSplatsToBuffer(textures.images[mainId], textures.mvs_rough[mainId], textures.masks[mainId], buffer);
-        
-            int nrPoints = buffer.size() / 7;
-            file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(float));
-            totalNrPoints += nrPoints;
+            std::vector<GLuint> neighborImages;
+            if (multiViewColor || fitSh1) {
+                SetColorNeighbors(mainId, neighborImages);
+            }
+            release(k % nrBuffers);
+            framebuffers.ExtractSplatsAsync(k % nrBuffers, textures.images[mainId], textures.mvs_rough[mainId], textures.masks[mainId], textures.confidences[mainId], neighborImages);
+            if (k > 0) readBack(k - 1);
+        }
+        if (nrKeyCams > 0) readBack(nrKeyCams - 1);
+        for (int slot = 0; slot < nrBuffers; slot++) {
+            release(slot);
+        }
+
+        splats.clear();
+        for (std::vector<Splat>& buffer : splatsPerView) {
+            splats.insert(splats.end(), buffer.begin(), buffer.end());
+        }
+
+        if (mergeCellFactor > 0) {
+            SplatMerger merger(mergeCellFactor);
+            merger.Merge(splats);
+        }
+        return stream ? std::accumulate(nrSplatsPerView.begin(), nrSplatsPerView.end(), 0) : splats.size();
+    }
+
+    // ExtractSplats with CpuSplatter: the key views are extracted one after the other, each by all threads
+    int ExtractSplatsOnHost(float tfSubdivisions, /*out*/ std::vector<Splat>& splats, SplatWriter* stream) {
+        ReadHostViews(/*colorNeighbors*/ multiViewColor || fitSh1);
+        splats.clear();
+        int nrSplats = 0;
+        std::vector<Splat> viewSplats;
+        for (int& mainId : keyCamIds) {
+            std::vector<glm::vec3> probes; // empty: the uniform grid
+            if (adaptiveSampling) {
+                CalculateAdaptiveProbes(mainId, tfSubdivisions, probes);
+            }
+            std::vector<int> colorNeighbors;
+            if (multiViewColor || fitSh1) {
+                std::vector<int>& neighbors = mvsNeighbors[mainId];
+                colorNeighbors.assign(neighbors.begin(), neighbors.begin() + std::min<size_t>(neighbors.size(), 4));
+            }
+            std::vector<Splat>& destination = stream ? viewSplats : splats;
+            int nrBefore = destination.size();
+            host.ExtractSplats(mainId, tfSubdivisions, probes, colorNeighbors, fitSh1, roi, destination);
+            nrSplats += destination.size() - nrBefore;
+            if (stream) {
+                stream->Append(viewSplats.data(), viewSplats.size());
+                viewSplats.clear();
+            }
+        }
+
+        if (mergeCellFactor > 0) {
+            SplatMerger merger(mergeCellFactor);
+            merger.Merge(splats);
+        }
+        return stream ? nrSplats : splats.size();
+    }
+
+    // Copy the textures that CpuSplatter needs to host.views: the depth, masks and colors of the key views, and the colors of
+    // their (first 4) MVS neighbors if colorNeighbors. The colors are only read once.
+    void ReadHostViews(bool colorNeighbors) {
+        if (hostOnly) return;
+        int nrPixels = intrinsics.width * intrinsics.height;
+        auto readColor = [&](int id) {
+            CpuSplatter::View& view = host.views[id];
+            if (!view.color.empty()) return;
+            view.color.resize(3 * nrPixels);
+            textures.ReadTexture(textures.images[id], GL_RGB, GL_UNSIGNED_BYTE, view.color.data());
+            GLuint userMask = textures.UserMask(id);
+            if (userMask != 0 && userMask != textures.keepAllMask) {
+                view.userMask.resize(nrPixels);
+                textures.ReadTexture(userMask, GL_RED, GL_UNSIGNED_BYTE, view.userMask.data());
+            }
+        };
+
+        for (int& id : keyCamIds) {
+            readColor(id);
+            CpuSplatter::View& view = host.views[id];
+            view.depth.resize(nrPixels);
+            view.mask.resize(nrPixels);
+            view.confidence.resize(nrPixels);
+            textures.ReadTexture(textures.mvs_rough[id], GL_RED, GL_FLOAT, view.depth.data());
+            textures.ReadTexture(textures.masks[id], GL_RED, GL_UNSIGNED_BYTE, view.mask.data());
+            textures.ReadTexture(textures.confidences[id], GL_RED, GL_UNSIGNED_BYTE, view.confidence.data());
+            if (!colorNeighbors) continue;
+            std::vector<int>& neighbors = mvsNeighbors[id];
+            for (size_t n = 0; n < neighbors.size() && n < 4; n++) {
+                readColor(neighbors[n]);
+            }
+        }
+    }
+
+    // Set the uniforms of write_splats.vs for the multi-view color of key view keyCamId, and return the images of its MVS neighbors
+    void SetColorNeighbors(int keyCamId, /*out*/ std::vector<GLuint>& neighborImages) {
+        neighborImages.clear();
+        for (int& neighborId : mvsNeighbors[keyCamId]) {
+            std::string index = "[" + std::to_string(neighborImages.size()) + "]";
+            shaders.writeSplats.setMat4("neighborView" + index, extrinsics.poses[neighborId].view);
+            shaders.writeSplats.setVec3("neighborPosition" + index, extrinsics.poses[neighborId].pos);
+            neighborImages.push_back(textures.images[neighborId]);
+            if (neighborImages.size() == 4) break;
+        }
+        shaders.writeSplats.setInt("nrNeighbors", neighborImages.size());
+        shaders.writeSplats.setVec3("cameraPosition", extrinsics.poses[keyCamId].pos);
+    }
+
+    // Fuse the depth maps of all key views in a TsdfVolume, and extract its surface as splats. The voxel size is
+    // tsdfVoxelFactor x the spacing of the uniform grid of probes at the median depth. Returns the nr of splats.
+    int FuseSplats(float tfSubdivisions, /*out*/ std::vector<Splat>& splats) {
+        int nrPixels = intrinsics.width * intrinsics.height;
+        std::vector<float> depth(nrPixels);
+        std::vector<unsigned char> mask(nrPixels);
+        std::vector<unsigned char> confidence(nrPixels);
+        std::vector<unsigned char> color(3 * nrPixels);
+
+        // median depth of (a sample of) the unmasked pixels
+        std::vector<float> depthSamples;
+        for (int& id : keyCamIds) {
+            textures.ReadTexture(textures.mvs_rough[id], GL_RED, GL_FLOAT, depth.data());
+            textures.ReadTexture(textures.masks[id], GL_RED, GL_UNSIGNED_BYTE, mask.data());
+            for (int i = 0; i < nrPixels; i += 7) {
+                if (mask[i] > 127 && depth[i] > 0) depthSamples.push_back(depth[i]);
+            }
         }
+        splats.clear();
+        if (depthSamples.empty()) return 0;
+        std::nth_element(depthSamples.begin(), depthSamples.begin() + depthSamples.size() / 2, depthSamples.end());
+        float medianDepth = depthSamples[depthSamples.size() / 2];
+        float voxelSize = tsdfVoxelFactor * tfSubdivisions * medianDepth / intrinsics.fx;
 
-        printf("Nr of splats from MVS: %d\n", totalNrPoints);
-        totalNrPoints = 0;
+        TsdfVolume volume(voxelSize);
+        for (int& id : keyCamIds) {
+            textures.ReadTexture(textures.mvs_rough[id], GL_RED, GL_FLOAT, depth.data());
+            textures.ReadTexture(textures.masks[id], GL_RED, GL_UNSIGNED_BYTE, mask.data());
+            textures.ReadTexture(textures.confidences[id], GL_RED, GL_UNSIGNED_BYTE, confidence.data());
+            textures.ReadTexture(textures.images[id], GL_RGB, GL_UNSIGNED_BYTE, color.data());
+            volume.Integrate(depth, color, confidence, mask, intrinsics, extrinsics.poses[id]);
+        }
+        volume.ExtractSplats(splats);
+        printf("TSDF fusion: voxel size = %f, %d blocks, %d splats\n", voxelSize, volume.NrBlocks(), (int)splats.size());
+        return splats.size();
+    }
 
-        // also convert the Colmap point cloud to splats and write to file
+    // Like ExtractSplats, but chooses tfSubdivisions from the nr of pixels that survived masking, so that the MVS splats
+    // plus the Colmap splats add up to targetNrSplats. Slightly more splats are extracted than needed, and PostProcess
+    // removes the surplus by random subsampling that prefers confident splats. Returns the targeted nr of MVS splats.
+    int ExtractTargetNrSplats(SfmPoints& sfmPoints, /*in and out*/ float& tfSubdivisions, /*out*/ std::vector<Splat>& splats) {
+        int nrSfmSplats = 0;
         for (int& id : extrinsics.imageIds) {
-            std::vector<glm::vec3> points = sfmPoints.points[id];
-            std::vector<glm::vec3> colors = sfmPoints.colors[id];
+            nrSfmSplats += sfmPoints.points[id].size();
+        }
+        int targetNrMvsSplats = targetNrSplats - nrSfmSplats;
+        if (targetNrMvsSplats <= 0) {
+            printf("Warning: the Colmap point cloud alone already has %d splats, more than the target of %d\n", nrSfmSplats, targetNrSplats);
+            splats.clear();
+            return 0;
+        }
 
-            // per point, put (x,y,z,r,g,b,scale) in buffer
-            std::vector<float> buffer(points.size() * 7);
-            for (int i = 0; i < points.size(); i++) {
-                int j = i * 7;
-                buffer[j    ] = points[i].x;
-                buffer[j + 1] = points[i].y;
-                buffer[j + 2] = points[i].z;
-                buffer[j + 3] = colors[i].x;
-                buffer[j + 4] = colors[i].y;
-                buffer[j + 5] = colors[i].z;
-                buffer[j + 6] = glm::length(points[i] - extrinsics.poses[id].pos) * diameter;
+        // measure how many pixels survived masking
+        std::vector<unsigned char> mask(intrinsics.width * intrinsics.height);
+        int64_t nrSurvivors = 0;
+        for (int& id : keyCamIds) {
+            textures.ReadTexture(textures.masks[id], GL_RED, GL_UNSIGNED_BYTE, mask.data());
+            nrSurvivors += std::count_if(mask.begin(), mask.end(), [](unsigned char m) { return m > 127; });
+        }
+        printf("Target of %d splats: %lld pixels survived masking\n", targetNrSplats, (long long)nrSurvivors);
+        if (nrSurvivors == 0) {
+            splats.clear();
+            return 0;
+        }
+
+        // each probe of the uniform grid covers tfSubdivisions^2 pixels, aim 5% over the target
+        const float oversampling = 1.05f;
+        const int maxAttempts = 3;
+        // at most 16 probes per pixel, and no more than the transform feedback buffers can hold
+        const float minTfSubdivisions = std::max(0.25f, FrameBufferController::MinTfSubdivisions(intrinsics.width, intrinsics.height));
+        float newTfSubdivisions = std::max(minTfSubdivisions, std::sqrt(nrSurvivors / (oversampling * targetNrMvsSplats)));
+        for (int attempt = 0; attempt < maxAttempts; attempt++) {
+            if (newTfSubdivisions != tfSubdivisions) {
+                tfSubdivisions = newTfSubdivisions;
+                framebuffers.ResizeTransformFeedback(tfSubdivisions);
             }
+            ExtractSplats(tfSubdivisions, splats);
+            // the splats that PostProcess keeps after minConfidence
+            int nrUsable = std::count_if(splats.begin(), splats.end(), [&](const Splat& splat) { return splat.confidence >= minConfidence; });
+            printf("Extracted %d splats with tfSubdivisions = %f\n", nrUsable, tfSubdivisions);
+            if (nrUsable >= targetNrMvsSplats || nrUsable == 0 || tfSubdivisions <= minTfSubdivisions) break;
 
-            file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(float));
-            totalNrPoints += points.size();
+            // fewer probes survived than pixels (e.g. merging, the depth test or minConfidence), so sample more densely
+            newTfSubdivisions = std::max(minTfSubdivisions, tfSubdivisions * std::sqrt(nrUsable / (oversampling * targetNrMvsSplats)));
         }
-        
-        printf("Nr of splats from Colmap: %d %s\n", totalNrPoints, extrinsics.eval? "(removed test set points)":"");
-        printf("Wrote splats to %s\n", path.c_str());
-        file.close();
+        return targetNrMvsSplats;
+    }
+
+    // Randomly keep nrSplats of the splats (in their original order), preferring confident ones, and enlarge them to cover the same surface.
+    // Weighted sampling without replacement: each splat gets the key u^(1 / confidence), and the highest keys are kept.
+    void Subsample(int nrSplats, /*in and out*/ std::vector<Splat>& splats) {
+        if (static_cast<int>(splats.size()) <= nrSplats) return;
+
+        std::mt19937 rng(0);
+        std::uniform_real_distribution<float> uniform(1e-30f, 1.0f);
+        std::vector<std::pair<float, int>> keys(splats.size());
+        for (int i = 0; i < static_cast<int>(splats.size()); i++) {
+            float weight = std::max(splats[i].confidence, 0.0f) + 1e-3f;
+            keys[i] = std::pair<float, int>(std::log(uniform(rng)) / weight, i);
+        }
+        std::nth_element(keys.begin(), keys.begin() + nrSplats, keys.end(), std::greater<std::pair<float, int>>());
+        std::vector<int> indices(nrSplats);
+        for (int i = 0; i < nrSplats; i++) {
+            indices[i] = keys[i].second;
+        }
+        std::sort(indices.begin(), indices.end());
+
+        float scaleFactor = std::sqrt(static_cast<float>(splats.size()) / nrSplats);
+        std::vector<Splat> kept(nrSplats);
+        for (int i = 0; i < nrSplats; i++) {
+            kept[i] = splats[indices[i]];
+            kept[i].scale *= scaleFactor;
+            kept[i].scales *= scaleFactor;
+        }
+        splats.swap(kept);
+    }
+
+    void CalculateAdaptiveProbes(int keyCamId, float tfSubdivisions, /*out*/ std::vector<glm::vec3>& probes) {
+        shaders.importanceShader.use();
+        shaders.importanceShader.setInt("useUserMasks", textures.UserMask(keyCamId) != 0 ? 1 : 0);
+        framebuffers.RenderImportance(textures.images[keyCamId], textures.mvs_rough[keyCamId], textures.masks[keyCamId], textures.UserMask(keyCamId), textures.importance);
+        std::vector<glm::vec2> importance(intrinsics.width * intrinsics.height);
+        textures.ReadTexture(textures.importance, GL_RG, GL_FLOAT, importance.data());
+
+        AdaptiveSampler sampler;
+        sampler.Sample(importance, intrinsics.width, intrinsics.height, tfSubdivisions, framebuffers.GetTfCapacity(), keyCamId, probes);
+    }
+
+    // Fill pairs with every (unordered) pair of key cameras whose truncated view frusta intersect.
+    // The frusta are truncated by the depth map bounds, so they enclose every point of the depth maps.
+    void CalculateOverlappingPairs(/*out*/ std::vector<std::pair<int, int>>& pairs) {
+        pairs.clear();
+        int nrKeyCams = keyCamIds.size();
+        for (int a = 0; a < nrKeyCams; a++) {
+            for (int b = a + 1; b < nrKeyCams; b++) {
+                if (SeparatedByFrustumPlane(keyCamIds[a], keyCamIds[b])) continue;
+                if (SeparatedByFrustumPlane(keyCamIds[b], keyCamIds[a])) continue;
+                pairs.push_back(std::pair<int, int>(keyCamIds[a], keyCamIds[b]));
+            }
+        }
+        int nrOrderedPairs = nrKeyCams * (nrKeyCams - 1);
+        printf("Consistency check: %d of %d key camera pairs overlap\n", (int)pairs.size(), nrOrderedPairs / 2);
+    }
+
+    // Returns true if all 8 corners of the frustum of camera idB lie outside the same plane of the frustum of camera idA,
+    // which means the frusta cannot intersect. Returning false does not guarantee that they do.
+    bool SeparatedByFrustumPlane(int idA, int idB) {
+        // image bounds of x/z and y/z, using the same (flipped y) convention as the shaders
+        glm::vec2 lowerBound(-intrinsics.cx / intrinsics.fx, (intrinsics.cy - intrinsics.height) / intrinsics.fy);
+        glm::vec2 upperBound((intrinsics.width - intrinsics.cx) / intrinsics.fx, intrinsics.cy / intrinsics.fy);
+
+        glm::mat4 bToA = extrinsics.poses[idA].view * extrinsics.poses[idB].model;
+        glm::vec2 rangeA = depthBounds[idA];
+        glm::vec2 rangeB = depthBounds[idB];
+
+        // count per plane (near, far, left, right, bottom, top) how many corners lie outside of it
+        int outside[6] = { 0, 0, 0, 0, 0, 0 };
+        for (int i = 0; i < 8; i++) {
+            float z = (i & 4) ? rangeB.y : rangeB.x;
+            float x = ((i & 1) ? upperBound.x : lowerBound.x) * z;
+            float y = ((i & 2) ? upperBound.y : lowerBound.y) * z;
+            glm::vec3 p = glm::vec3(bToA * glm::vec4(x, y, z, 1));
+
+            if (p.z < rangeA.x) outside[0]++;
+            if (p.z > rangeA.y) outside[1]++;
+            if (p.x < lowerBound.x * p.z) outside[2]++;
+            if (p.x > upperBound.x * p.z) outside[3]++;
+            if (p.y < lowerBound.y * p.z) outside[4]++;
+            if (p.y > upperBound.y * p.z) outside[5]++;
+        }
+        return std::any_of(std::begin(outside), std::end(outside), [](int count) { return count == 8; });
     }
 };
 
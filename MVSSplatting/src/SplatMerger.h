@@ -0,0 +1,131 @@
+#ifndef SPLAT_MERGER_H
+#define SPLAT_MERGER_H
+
+// Overlapping key views each output splats for the same surfaces. The SplatMerger removes these near-duplicates
+// by hashing every splat into a voxel grid with a cell size relative to the splat's scale, and merging all splats
+// that end up in the same cell.
+class SplatMerger {
+
+private:
+	struct CellKey {
+		int level; // cell size = 2^level
+		int x, y, z;
+
+		bool operator==(const CellKey& other) const {
+			return level == other.level && x == other.x && y == other.y && z == other.z;
+		}
+	};
+
+	struct CellKeyHash {
+		size_t operator()(const CellKey& key) const {
+			return (static_cast<size_t>(key.x) * 73856093u) ^ (static_cast<size_t>(key.y) * 19349663u) ^ (static_cast<size_t>(key.z) * 83492791u) ^ (static_cast<size_t>(key.level) * 2654435761u);
+		}
+	};
+
+	struct Cell {
+		glm::vec3 colorSum = glm::vec3(0);
+		float scaleSum = 0;
+		int count = 0;
+		int first = 0; // index of the first splat in this cell, to keep the output order deterministic
+		int best = 0;  // index of the splat with the highest confidence
+		float bestConfidence = 0;
+	};
+
+	float cellFactor;
+
+public:
+
+	// cellFactor: the cell size relative to the distance between neighboring splats of 1 key view (= 2 * scale)
+	SplatMerger(float cellFactor) : cellFactor(cellFactor) {}
+
+	// Per cell, the color and scale are averaged, and the position and orientation of the splat with the highest confidence are kept.
+	// Only splats of a similar scale (the same power of 2) can end up in the same cell.
+	void Merge(/*in and out*/ std::vector<Splat>& splats) {
+		int nrSplats = splats.size();
+		int nrShards = NrThreads();
+		CellKeyHash hash;
+
+		// 1. calculate the cell of each splat, and split the splats in shards by their hash, so that each
+		//    thread can merge its own shard without locking
+		std::vector<CellKey> keys(nrSplats);
+		std::vector<std::vector<std::vector<int>>> shardsPerThread(nrShards);
+		ParallelFor(nrSplats, [&](int begin, int end, int t) {
+			shardsPerThread[t] = std::vector<std::vector<int>>(nrShards);
+			for (int i = begin; i < end; i++) {
+				keys[i] = CalculateCellKey(splats[i]);
+				shardsPerThread[t][hash(keys[i]) % nrShards].push_back(i);
+			}
+		});
+
+		// 2. merge all splats per cell
+		std::vector<std::vector<std::pair<int, Splat>>> mergedPerShard(nrShards);
+		ParallelFor(nrShards, [&](int begin, int end, int /*t*/) {
+			for (int shard = begin; shard < end; shard++) {
+				std::unordered_map<CellKey, Cell, CellKeyHash> cells;
+				for (auto& shards : shardsPerThread) {
+					if (shards.empty()) continue;
+					for (int i : shards[shard]) {
+						float confidence = Confidence(splats[i]);
+						auto it = cells.find(keys[i]);
+						if (it == cells.end()) {
+							it = cells.emplace(keys[i], Cell()).first;
+							it->second.first = i;
+							it->second.best = i;
+							it->second.bestConfidence = confidence;
+						}
+						Cell& cell = it->second;
+						cell.colorSum += splats[i].color;
+						cell.scaleSum += splats[i].scale;
+						cell.count++;
+						if (confidence > cell.bestConfidence) {
+							cell.best = i;
+							cell.bestConfidence = confidence;
+						}
+					}
+				}
+
+				for (auto& pair : cells) {
+					const Cell& cell = pair.second;
+					Splat merged = splats[cell.best];
+					merged.color = cell.colorSum / static_cast<float>(cell.count);
+					merged.scale = cell.scaleSum / cell.count;
+					merged.scales *= merged.scale / std::max(splats[cell.best].scale, 1e-12f);
+					mergedPerShard[shard].push_back(std::pair<int, Splat>(cell.first, merged));
+				}
+			}
+		});
+
+		// 3. gather the merged splats, in the order of the original splats
+		std::vector<std::pair<int, Splat>> merged;
+		for (auto& shard : mergedPerShard) {
+			merged.insert(merged.end(), shard.begin(), shard.end());
+		}
+		std::sort(merged.begin(), merged.end(), [](const auto& a, const auto& b) {
+			return a.first < b.first;
+		});
+
+		splats.clear();
+		for (auto& pair : merged) {
+			splats.push_back(pair.second);
+		}
+
+		printf("Merged %d splats into %d (%.1f%% fewer)\n", nrSplats, (int)splats.size(), nrSplats > 0 ? 100.0f * (nrSplats - splats.size()) / nrSplats : 0.0f);
+	}
+
+private:
+
+	CellKey CalculateCellKey(const Splat& splat) {
+		// round the cell size down to a power of 2
+		int level = static_cast<int>(std::floor(std::log2(std::max(2.0f * splat.scale * cellFactor, 1e-12f))));
+		float cellSize = std::exp2(static_cast<float>(level));
+		glm::vec3 cell = glm::floor(splat.position / cellSize);
+		return { level, static_cast<int>(cell.x), static_cast<int>(cell.y), static_cast<int>(cell.z) };
+	}
+
+	// MVS confidence first; among equally confident splats, those seen from closer by (smaller scale) sampled the surface more finely
+	static float Confidence(const Splat& splat) {
+		return splat.confidence + 1e-3f / (1.0f + splat.scale);
+	}
+};
+
+#endif // !SPLAT_MERGER_H
@@ -0,0 +1,209 @@
+#ifndef SPLAT_OCTREE_H
+#define SPLAT_OCTREE_H
+
+#include <gtx/component_wise.hpp>
+#include <gtx/matrix_operation.hpp>
+
+// Level-of-detail hierarchy over the splats, for viewers and hierarchical training that load a coarse version of the
+// whole scene first and refine it region by region. Each octree node covers a cube, and is split in 8 until at most
+// leafCapacity splats remain. The leaves hold the original splats. Every other node holds an approximation of its
+// whole subtree: its cube is divided in gridResolution^3 cells, and the splats per cell are merged into 1 parent splat
+// that matches their combined position, color (and SH) and covariance (moment matching, weighted by opacity x footprint).
+class SplatOctree {
+
+public:
+	struct Node {
+		glm::vec3 boundsMin;
+		float size = 0;     // edge length of the cube
+		int level = 0;      // 0 = root
+		int parent = -1;
+		int children[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+		std::vector<Splat> splats; // original splats for a leaf, merged splats otherwise
+
+		bool IsLeaf() const {
+			return std::all_of(std::begin(children), std::end(children), [](int child) { return child < 0; });
+		}
+	};
+
+	// in breadth-first order, so every level is contiguous and parents come before their children
+	std::vector<Node> nodes;
+
+	SplatOctree(int leafCapacity = 4096, int gridResolution = 16) : leafCapacity(leafCapacity), gridResolution(gridResolution) {}
+
+	void Build(const std::vector<Splat>& splats) {
+		nodes.clear();
+		if (splats.empty()) return;
+
+		glm::vec3 boundsMin = splats[0].position;
+		glm::vec3 boundsMax = boundsMin;
+		for (const Splat& splat : splats) {
+			boundsMin = glm::min(boundsMin, splat.position);
+			boundsMax = glm::max(boundsMax, splat.position);
+		}
+		float size = std::max(glm::compMax(boundsMax - boundsMin), 1e-6f) * 1.0001f;
+
+		// split the nodes level by level
+		nodes.push_back(Node());
+		nodes[0].boundsMin = boundsMin;
+		nodes[0].size = size;
+		std::vector<std::vector<int>> indicesPerNode(1);
+		indicesPerNode[0].resize(splats.size());
+		std::iota(indicesPerNode[0].begin(), indicesPerNode[0].end(), 0);
+		for (int n = 0; n < static_cast<int>(nodes.size()); n++) {
+			std::vector<int> indices;
+			indices.swap(indicesPerNode[n]);
+			if (static_cast<int>(indices.size()) <= leafCapacity || nodes[n].level >= maxLevel) {
+				nodes[n].splats.reserve(indices.size());
+				for (int i : indices) {
+					nodes[n].splats.push_back(splats[i]);
+				}
+				continue;
+			}
+
+			std::vector<int> octants[8];
+			float half = 0.5f * nodes[n].size;
+			glm::vec3 center = nodes[n].boundsMin + half;
+			for (int i : indices) {
+				const glm::vec3& p = splats[i].position;
+				octants[(p.x >= center.x ? 1 : 0) | (p.y >= center.y ? 2 : 0) | (p.z >= center.z ? 4 : 0)].push_back(i);
+			}
+			for (int octant = 0; octant < 8; octant++) {
+				if (octants[octant].empty()) continue;
+				Node child;
+				child.boundsMin = nodes[n].boundsMin + half * glm::vec3(octant & 1, (octant >> 1) & 1, (octant >> 2) & 1);
+				child.size = half;
+				child.level = nodes[n].level + 1;
+				child.parent = n;
+				nodes[n].children[octant] = nodes.size();
+				nodes.push_back(child);
+				indicesPerNode.push_back(std::vector<int>());
+				indicesPerNode.back().swap(octants[octant]);
+			}
+		}
+
+		// merge bottom-up, 1 level at a time
+		std::vector<std::vector<Gaussian>> gaussians(nodes.size());
+		int nrLevels = nodes.back().level + 1;
+		for (int level = nrLevels - 1; level >= 0; level--) {
+			int begin = std::lower_bound(nodes.begin(), nodes.end(), level, [](const Node& node, int l) { return node.level < l; }) - nodes.begin();
+			int end = std::upper_bound(nodes.begin(), nodes.end(), level, [](int l, const Node& node) { return l < node.level; }) - nodes.begin();
+			ParallelFor(end - begin, [&](int b, int e, int /*t*/) {
+				for (int n = begin + b; n < begin + e; n++) {
+					if (nodes[n].IsLeaf()) {
+						gaussians[n].reserve(nodes[n].splats.size());
+						for (const Splat& splat : nodes[n].splats) {
+							gaussians[n].push_back(Gaussian(splat));
+						}
+					}
+					else {
+						MergeChildren(n, gaussians);
+					}
+				}
+			});
+			// the children are not needed anymore
+			for (int n = begin; n < end; n++) {
+				for (int child : nodes[n].children) {
+					if (child >= 0) std::vector<Gaussian>().swap(gaussians[child]);
+				}
+			}
+		}
+
+		int nrLeaves = std::count_if(nodes.begin(), nodes.end(), [](const Node& node) { return node.IsLeaf(); });
+		printf("Octree: %d levels, %d nodes of which %d leaves, %d splats in the root\n", nrLevels, (int)nodes.size(), nrLeaves, (int)nodes[0].splats.size());
+	}
+
+private:
+	static constexpr int maxLevel = 20;
+	int leafCapacity;
+	int gridResolution;
+
+	// a splat as a weighted 3D gaussian, which can be merged by adding the weighted moments
+	struct Gaussian {
+		float weight = 0;
+		glm::vec3 mean = glm::vec3(0);
+		glm::mat3 covariance = glm::mat3(0);
+		glm::vec3 color = glm::vec3(0);
+		glm::vec3 sh1[3] = { glm::vec3(0), glm::vec3(0), glm::vec3(0) };
+		float confidence = 0;
+
+		Gaussian() {}
+
+		Gaussian(const Splat& splat) : mean(splat.position), color(splat.color), sh1{ splat.sh1[0], splat.sh1[1], splat.sh1[2] }, confidence(splat.confidence) {
+			glm::mat3 rotation = glm::mat3_cast(glm::quat(splat.rotation[0], splat.rotation[1], splat.rotation[2], splat.rotation[3]));
+			glm::mat3 scaled = rotation * glm::mat3(glm::diagonal3x3(splat.scales));
+			covariance = scaled * glm::transpose(scaled);
+
+			// how much the splat contributes to the image: its opacity (as in SplatWriter) x its footprint on the surface
+			glm::vec3 s = splat.scales;
+			float footprint = s.x * s.y * s.z / std::max(glm::compMin(s), 1e-30f);
+			weight = (0.1f + 0.8f * glm::clamp(splat.confidence, 0.0f, 1.0f)) * std::max(footprint, 1e-30f);
+		}
+
+		Splat ToSplat() const {
+			glm::vec3 eigenvalues;
+			glm::mat3 eigenvectors;
+			SymmetricEigen3(covariance, eigenvalues, eigenvectors);
+
+			// scales along the 2 largest axes first, and the smallest axis (the normal) last
+			Splat splat;
+			splat.position = mean;
+			splat.color = color;
+			splat.scales = glm::sqrt(glm::max(eigenvalues, glm::vec3(1e-24f)));
+			splat.scale = std::sqrt(splat.scales.x * splat.scales.y);
+			if (glm::determinant(eigenvectors) < 0) eigenvectors[2] = -eigenvectors[2];
+			glm::quat q = glm::quat_cast(eigenvectors);
+			splat.rotation = glm::vec4(q.w, q.x, q.y, q.z);
+			splat.confidence = confidence;
+			std::copy(std::begin(sh1), std::end(sh1), std::begin(splat.sh1));
+			return splat;
+		}
+	};
+
+	// merge the gaussians of all children per grid cell of node n
+	void MergeChildren(int n, /*in and out*/ std::vector<std::vector<Gaussian>>& gaussians) {
+		Node& node = nodes[n];
+		float cellSize = node.size / gridResolution;
+		std::unordered_map<int, int> cellToMerged;
+		std::vector<Gaussian> sums; // weighted sums of the moments per cell, relative to the corner of the cell (for precision)
+		std::vector<glm::vec3> corners;
+
+		for (int child : node.children) {
+			if (child < 0) continue;
+			for (const Gaussian& g : gaussians[child]) {
+				glm::ivec3 cell = glm::clamp(glm::ivec3((g.mean - node.boundsMin) / cellSize), glm::ivec3(0), glm::ivec3(gridResolution - 1));
+				int cellId = (cell.z * gridResolution + cell.y) * gridResolution + cell.x;
+				auto inserted = cellToMerged.insert(std::pair<int, int>(cellId, sums.size()));
+				if (inserted.second) {
+					sums.push_back(Gaussian());
+					corners.push_back(node.boundsMin + glm::vec3(cell) * cellSize);
+				}
+				Gaussian& sum = sums[inserted.first->second];
+				glm::vec3 offset = g.mean - corners[inserted.first->second];
+				sum.weight += g.weight;
+				sum.mean += g.weight * offset;
+				sum.covariance += g.weight * (g.covariance + glm::outerProduct(offset, offset));
+				sum.color += g.weight * g.color;
+				for (int k = 0; k < 3; k++) sum.sh1[k] += g.weight * g.sh1[k];
+				sum.confidence += g.weight * g.confidence;
+			}
+		}
+
+		std::vector<Gaussian>& merged = gaussians[n];
+		merged.resize(sums.size());
+		node.splats.resize(sums.size());
+		for (size_t i = 0; i < sums.size(); i++) {
+			const Gaussian& sum = sums[i];
+			Gaussian& g = merged[i];
+			g.weight = sum.weight;
+			glm::vec3 offset = sum.mean / sum.weight;
+			g.mean = corners[i] + offset;
+			g.covariance = sum.covariance / sum.weight - glm::outerProduct(offset, offset);
+			g.color = sum.color / sum.weight;
+			for (int k = 0; k < 3; k++) g.sh1[k] = sum.sh1[k] / sum.weight;
+			g.confidence = sum.confidence / sum.weight;
+			node.splats[i] = g.ToSplat();
+		}
+	}
+};
+
+#endif // !SPLAT_OCTREE_H
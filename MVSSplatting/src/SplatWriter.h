@@ -0,0 +1,382 @@
+#ifndef SPLAT_WRITER_H
+#define SPLAT_WRITER_H
+
+// Writes the splats to disk in one of 3 formats:
+//  - Bin : headerless float32 x 7 (x, y, z, r, g, b, scale) per splat, in the order they were generated (isotropic only)
+//  - Mvss: versioned format with a header, an attribute table and Morton-ordered chunks that can be read (and mmapped) one by one,
+//          optionally quantized to 26 bytes per splat (+ 18 with sh1). See SplatWriter::WriteMvss for the layout. WriteLod stores a level-of-detail
+//          hierarchy (SplatOctree) in the same format, with 1 chunk per octree node.
+//  - Ply : the layout of a trained 3DGS model (x, y, z, nx, ny, nz, f_dc_*, f_rest_*, opacity, scale_*, rot_*), for standard viewers
+class SplatWriter {
+
+public:
+	enum class Format { Bin, Mvss, Ply };
+
+	static constexpr uint32_t mvssVersion = 2; // version 2 added hierarchies, flat files are still written as version 1
+	static constexpr int chunkSize = 4096; // max nr of splats per Mvss chunk
+
+	Format format = Format::Bin;
+	bool quantize = false; // Mvss only: 16-bit positions relative to the chunk bounds, RGB8 color and confidence, and half-precision scales and rotation
+	bool sh1 = false;      // Mvss only: add the degree-1 SH coefficients as attribute "sh1" (Ply always has them)
+
+	// the file extension that belongs to a format
+	static std::string Extension(Format format) {
+		switch (format) {
+		case Format::Mvss: return ".mvss";
+		case Format::Ply: return ".ply";
+		default: return ".bin";
+		}
+	}
+
+	// parse "bin", "mvss" or "ply", returns false for anything else
+	static bool ParseFormat(const std::string& name, /*out*/ Format& format) {
+		if (name == "bin") format = Format::Bin;
+		else if (name == "mvss") format = Format::Mvss;
+		else if (name == "ply") format = Format::Ply;
+		else return false;
+		return true;
+	}
+
+	bool Write(const std::string& path, const std::vector<Splat>& splats) {
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			printf("Error: could not open %s for writing\n", path.c_str());
+			return false;
+		}
+
+		switch (format) {
+		case Format::Mvss: WriteMvss(file, splats); break;
+		case Format::Ply: WritePly(file, splats); break;
+		default: WriteRaw(file, splats.data(), splats.size()); break;
+		}
+
+		file.close();
+		return true;
+	}
+
+	// Writes the octree as an Mvss file (regardless of format) with 1 chunk per node, in breadth-first order
+	bool WriteLod(const std::string& path, const SplatOctree& octree) {
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			printf("Error: could not open %s for writing\n", path.c_str());
+			return false;
+		}
+
+		std::vector<Chunk> chunks(octree.nodes.size());
+		for (int n = 0; n < static_cast<int>(octree.nodes.size()); n++) {
+			chunks[n].splats = &octree.nodes[n].splats;
+			chunks[n].parent = octree.nodes[n].parent;
+		}
+		WriteMvssChunks(file, chunks, /*hierarchy*/ true);
+
+		file.close();
+		return true;
+	}
+
+	// Streaming, only for the Bin format: Open, Append any nr of times, and Close
+	bool Open(const std::string& path) {
+		stream.open(path, std::ios::binary);
+		if (!stream.is_open()) {
+			printf("Error: could not open %s for writing\n", path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	void Append(const Splat* splats, size_t nrSplats) {
+		WriteRaw(stream, splats, nrSplats);
+	}
+
+	bool Close() {
+		stream.close();
+		return !stream.fail();
+	}
+
+private:
+	std::ofstream stream;
+
+	// attribute types of the Mvss attribute table
+	enum AttributeType : uint32_t {
+		Float32 = 0,
+		Float16 = 1,
+		Unorm16 = 2, // positions are relative to the chunk bounds, other attributes are in [0, 1]
+		Unorm8 = 3,
+	};
+
+	struct Attribute {
+		char name[16];
+		AttributeType type;
+		uint32_t nrComponents;
+	};
+	static_assert(sizeof(Attribute) == 24, "Attribute must match the Mvss attribute table layout");
+
+	struct Chunk {
+		const std::vector<Splat>* splats;
+		int parent = -1; // chunk index of the parent node in a hierarchy
+	};
+
+	static void WriteRaw(std::ofstream& file, const Splat* splats, size_t nrSplats) {
+		std::vector<float> raw(nrSplats * nrRawSplatFloats);
+		for (size_t i = 0; i < nrSplats; i++) {
+			memcpy(&raw[i * nrRawSplatFloats], &splats[i], nrRawSplatFloats * sizeof(float));
+		}
+		file.write(reinterpret_cast<const char*>(raw.data()), raw.size() * sizeof(float));
+	}
+
+	template <typename T>
+	static void WriteValue(std::ofstream& file, const T& value) {
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	// Mvss layout (little endian):
+	//   header         : char[4] "MVSS", uint32 version, uint64 nrSplats, uint32 nrChunks, uint32 nrAttributes, uint32 chunkSize,
+	//                    uint32 flags (bit 0: quantized), float32[3] bounds min, float32[3] bounds max                          (56 bytes)
+	//   attribute table: per attribute char[16] name, uint32 type, uint32 nrComponents                                         (24 bytes each)
+	//   chunk table    : per chunk uint64 offset (from the start of the file), uint32 nrSplats, uint32 parent,
+	//                    float32[3] bounds min, float32[3] bounds max                                                         (40 bytes each)
+	//   chunk data     : per chunk, nrSplats packed records that hold the attributes in table order
+	// A flat file (version 1) has Morton-ordered chunks of at most chunkSize splats, and parent = 0.
+	// A hierarchy (version 2, flags bit 1) has a chunk per octree node in breadth-first order, with parent the index of the
+	// parent chunk (0xffffffff for the root). The leaves hold the original splats, the other nodes merged splats that
+	// approximate their subtree, so a reader can load any cut through the tree. chunkSize is then the largest chunk.
+	void WriteMvss(std::ofstream& file, const std::vector<Splat>& splats) {
+		std::vector<Splat> sorted;
+		glm::vec3 boundsMin, boundsMax;
+		SortByMortonCode(splats, sorted, boundsMin, boundsMax);
+
+		int nrChunks = (sorted.size() + chunkSize - 1) / chunkSize;
+		std::vector<std::vector<Splat>> chunkSplats(nrChunks);
+		std::vector<Chunk> chunks(nrChunks);
+		for (int c = 0; c < nrChunks; c++) {
+			int begin = c * chunkSize;
+			int end = std::min(static_cast<int>(sorted.size()), begin + chunkSize);
+			chunkSplats[c].assign(sorted.begin() + begin, sorted.begin() + end);
+			chunks[c].splats = &chunkSplats[c];
+		}
+		WriteMvssChunks(file, chunks, /*hierarchy*/ false);
+	}
+
+	void WriteMvssChunks(std::ofstream& file, const std::vector<Chunk>& chunks, bool hierarchy) {
+		std::vector<Attribute> attributes = {
+			{ "position", quantize ? Unorm16 : Float32, 3 },
+			{ "color", quantize ? Unorm8 : Float32, 3 },
+			{ "scale", quantize ? Float16 : Float32, 1 },
+			{ "scales", quantize ? Float16 : Float32, 3 },
+			{ "rotation", quantize ? Float16 : Float32, 4 },
+			{ "confidence", quantize ? Unorm8 : Float32, 1 },
+		};
+		if (sh1) {
+			attributes.push_back({ "sh1", quantize ? Float16 : Float32, 9 });
+		}
+		int recordSize = 0;
+		for (const Attribute& attribute : attributes) {
+			recordSize += TypeSize(attribute.type) * attribute.nrComponents;
+		}
+
+		int nrChunks = chunks.size();
+		uint64_t nrSplats = 0;
+		int maxChunkSize = hierarchy ? 0 : chunkSize;
+		glm::vec3 boundsMin(0), boundsMax(0);
+		std::vector<glm::vec3> chunkMin(nrChunks), chunkMax(nrChunks);
+		for (int c = 0; c < nrChunks; c++) {
+			const std::vector<Splat>& splats = *chunks[c].splats;
+			nrSplats += splats.size();
+			maxChunkSize = std::max(maxChunkSize, static_cast<int>(splats.size()));
+			chunkMin[c] = chunkMax[c] = splats.empty() ? glm::vec3(0) : splats[0].position;
+			for (const Splat& splat : splats) {
+				chunkMin[c] = glm::min(chunkMin[c], splat.position);
+				chunkMax[c] = glm::max(chunkMax[c], splat.position);
+			}
+			boundsMin = c == 0 ? chunkMin[c] : glm::min(boundsMin, chunkMin[c]);
+			boundsMax = c == 0 ? chunkMax[c] : glm::max(boundsMax, chunkMax[c]);
+		}
+
+		file.write("MVSS", 4);
+		WriteValue(file, hierarchy ? mvssVersion : static_cast<uint32_t>(1));
+		WriteValue(file, nrSplats);
+		WriteValue(file, static_cast<uint32_t>(nrChunks));
+		WriteValue(file, static_cast<uint32_t>(attributes.size()));
+		WriteValue(file, static_cast<uint32_t>(maxChunkSize));
+		WriteValue(file, static_cast<uint32_t>((quantize ? 1 : 0) | (hierarchy ? 2 : 0)));
+		WriteValue(file, boundsMin);
+		WriteValue(file, boundsMax);
+
+		for (const Attribute& attribute : attributes) {
+			WriteValue(file, attribute);
+		}
+
+		uint64_t offset = 56 + attributes.size() * sizeof(Attribute) + nrChunks * 40;
+		for (int c = 0; c < nrChunks; c++) {
+			uint32_t count = chunks[c].splats->size();
+			WriteValue(file, offset);
+			WriteValue(file, count);
+			WriteValue(file, static_cast<uint32_t>(hierarchy ? chunks[c].parent : 0)); // -1 becomes 0xffffffff
+			WriteValue(file, chunkMin[c]);
+			WriteValue(file, chunkMax[c]);
+			offset += static_cast<uint64_t>(count) * recordSize;
+		}
+
+		std::vector<char> records;
+		for (int c = 0; c < nrChunks; c++) {
+			const std::vector<Splat>& splats = *chunks[c].splats;
+			records.resize(splats.size() * recordSize);
+			char* record = records.data();
+			for (const Splat& splat : splats) {
+				if (quantize) {
+					glm::vec3 extent = chunkMax[c] - chunkMin[c];
+					glm::vec3 relative = glm::clamp((splat.position - chunkMin[c]) / glm::max(extent, glm::vec3(1e-30f)), 0.0f, 1.0f);
+					uint16_t position[3];
+					uint8_t color[3];
+					for (int k = 0; k < 3; k++) {
+						position[k] = static_cast<uint16_t>(std::round(relative[k] * 65535.0f));
+						color[k] = static_cast<uint8_t>(std::round(glm::clamp(splat.color[k], 0.0f, 1.0f) * 255.0f));
+					}
+					uint16_t halfs[8] = { glm::packHalf1x16(splat.scale) };
+					for (int k = 0; k < 3; k++) halfs[1 + k] = glm::packHalf1x16(splat.scales[k]);
+					for (int k = 0; k < 4; k++) halfs[4 + k] = glm::packHalf1x16(splat.rotation[k]);
+					memcpy(record, position, sizeof(position));
+					memcpy(record + 6, color, sizeof(color));
+					uint8_t confidence = static_cast<uint8_t>(std::round(glm::clamp(splat.confidence, 0.0f, 1.0f) * 255.0f));
+					memcpy(record + 9, halfs, sizeof(halfs));
+					memcpy(record + 25, &confidence, sizeof(confidence));
+					if (sh1) {
+						uint16_t shHalfs[9];
+						for (int k = 0; k < 9; k++) shHalfs[k] = glm::packHalf1x16(splat.sh1[k / 3][k % 3]);
+						memcpy(record + 26, shHalfs, sizeof(shHalfs));
+					}
+				}
+				else {
+					memcpy(record, &splat, sh1 ? sizeof(Splat) : nrSplatFloatsWithoutSh * sizeof(float));
+				}
+				record += recordSize;
+			}
+			file.write(records.data(), records.size());
+		}
+
+		printf("Wrote %d splats in %d %s (%s, %d bytes per splat)\n", (int)nrSplats, nrChunks, hierarchy ? "octree nodes" : "chunks", quantize ? "quantized" : "float32", recordSize);
+	}
+
+	// same layout and activations as GaussianModel.save_ply of the 3DGS code base, with SH degree 3 (bands 2 and 3 are 0)
+	void WritePly(std::ofstream& file, const std::vector<Splat>& splats) {
+		std::vector<Splat> sorted;
+		glm::vec3 boundsMin, boundsMax;
+		SortByMortonCode(splats, sorted, boundsMin, boundsMax);
+
+		const int nrRestCoefficients = 45;
+		const float SH_C0 = 0.28209479177387814f;
+
+		file << "ply\n";
+		file << "format binary_little_endian 1.0\n";
+		file << "element vertex " << sorted.size() << "\n";
+		const char* names[] = { "x", "y", "z", "nx", "ny", "nz", "f_dc_0", "f_dc_1", "f_dc_2" };
+		for (const char* name : names) {
+			file << "property float " << name << "\n";
+		}
+		for (int i = 0; i < nrRestCoefficients; i++) {
+			file << "property float f_rest_" << i << "\n";
+		}
+		file << "property float opacity\n";
+		for (int i = 0; i < 3; i++) {
+			file << "property float scale_" << i << "\n";
+		}
+		for (int i = 0; i < 4; i++) {
+			file << "property float rot_" << i << "\n";
+		}
+		file << "end_header\n";
+
+		const int nrFloats = 9 + nrRestCoefficients + 1 + 3 + 4;
+		std::vector<float> vertices(sorted.size() * nrFloats, 0.0f);
+		ParallelFor(sorted.size(), [&](int begin, int end, int /*t*/) {
+			for (int i = begin; i < end; i++) {
+				const Splat& splat = sorted[i];
+				float* v = &vertices[static_cast<size_t>(i) * nrFloats];
+				v[0] = splat.position.x;
+				v[1] = splat.position.y;
+				v[2] = splat.position.z;
+				// normals stay 0
+				for (int k = 0; k < 3; k++) {
+					v[6 + k] = (splat.color[k] - 0.5f) / SH_C0;
+				}
+				// f_rest holds 15 coefficients per color channel, band 1 first
+				for (int k = 0; k < 3; k++) {
+					for (int c = 0; c < 3; c++) {
+						v[9 + c * nrRestCoefficients / 3 + k] = splat.sh1[k][c];
+					}
+				}
+				float* rest = v + 9 + nrRestCoefficients;
+				rest[0] = InverseSigmoid(ConfidenceToOpacity(splat.confidence));
+				for (int k = 0; k < 3; k++) {
+					rest[1 + k] = std::log(std::max(splat.scales[k], 1e-12f));
+				}
+				for (int k = 0; k < 4; k++) {
+					rest[4 + k] = splat.rotation[k]; // (w, x, y, z)
+				}
+			}
+		});
+		file.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(float));
+
+		printf("Wrote %d splats as 3DGS ply\n", (int)sorted.size());
+	}
+
+	// same mapping as GaussianModel.create_from_mvs_bin: confidence 0.5 gives the default opacity of 0.5
+	static float ConfidenceToOpacity(float confidence) {
+		return 0.1f + 0.8f * glm::clamp(confidence, 0.0f, 1.0f);
+	}
+
+	static float InverseSigmoid(float x) {
+		return std::log(x / (1.0f - x));
+	}
+
+	static int TypeSize(AttributeType type) {
+		switch (type) {
+		case Float16: return 2;
+		case Unorm16: return 2;
+		case Unorm8: return 1;
+		default: return 4;
+		}
+	}
+
+	// spread the lowest 21 bits of v over every 3rd bit
+	static uint64_t SpreadBits(uint64_t v) {
+		v &= 0x1fffff;
+		v = (v | v << 32) & 0x1f00000000ffffull;
+		v = (v | v << 16) & 0x1f0000ff0000ffull;
+		v = (v | v << 8) & 0x100f00f00f00f00full;
+		v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+		v = (v | v << 2) & 0x1249249249249249ull;
+		return v;
+	}
+
+	// Sort the splats along a Z-order curve through their bounding box, so that each chunk covers a compact region
+	static void SortByMortonCode(const std::vector<Splat>& splats, /*out*/ std::vector<Splat>& sorted, /*out*/ glm::vec3& boundsMin, /*out*/ glm::vec3& boundsMax) {
+		boundsMin = glm::vec3(0);
+		boundsMax = glm::vec3(0);
+		sorted.clear();
+		if (splats.empty()) return;
+
+		boundsMin = boundsMax = splats[0].position;
+		for (const Splat& splat : splats) {
+			boundsMin = glm::min(boundsMin, splat.position);
+			boundsMax = glm::max(boundsMax, splat.position);
+		}
+		glm::vec3 cellsPerUnit = 2097151.0f / glm::max(boundsMax - boundsMin, glm::vec3(1e-30f));
+
+		int nrSplats = splats.size();
+		std::vector<std::pair<uint64_t, int>> codes(nrSplats);
+		ParallelFor(nrSplats, [&](int begin, int end, int /*t*/) {
+			for (int i = begin; i < end; i++) {
+				glm::vec3 cell = glm::clamp((splats[i].position - boundsMin) * cellsPerUnit, 0.0f, 2097151.0f);
+				uint64_t code = SpreadBits(static_cast<uint64_t>(cell.x)) | SpreadBits(static_cast<uint64_t>(cell.y)) << 1 | SpreadBits(static_cast<uint64_t>(cell.z)) << 2;
+				codes[i] = std::pair<uint64_t, int>(code, i);
+			}
+		});
+		std::sort(codes.begin(), codes.end());
+
+		sorted.resize(nrSplats);
+		for (int i = 0; i < nrSplats; i++) {
+			sorted[i] = splats[codes[i].second];
+		}
+	}
+};
+
+#endif // !SPLAT_WRITER_H
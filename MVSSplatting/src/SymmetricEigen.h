@@ -0,0 +1,40 @@
+#ifndef SYMMETRIC_EIGEN_H
+#define SYMMETRIC_EIGEN_H
+
+#include <algorithm>
+
+// Jacobi eigenvalue algorithm for a symmetric 3x3 matrix, e.g. a covariance. The eigenvalues are sorted from large to
+// small, and the eigenvectors are the matching columns.
+inline void SymmetricEigen3(const glm::mat3& matrix, /*out*/ glm::vec3& eigenvalues, /*out*/ glm::mat3& eigenvectors) {
+	glm::mat3 a = matrix;
+	glm::mat3 v(1.0f);
+	for (int sweep = 0; sweep < 16; sweep++) {
+		float offDiagonal = a[1][0] * a[1][0] + a[2][0] * a[2][0] + a[2][1] * a[2][1];
+		if (offDiagonal < 1e-30f) break;
+		for (int p = 0; p < 2; p++) {
+			for (int q = p + 1; q < 3; q++) {
+				if (std::abs(a[q][p]) < 1e-30f) continue;
+				float theta = (a[q][q] - a[p][p]) / (2.0f * a[q][p]);
+				float t = (theta >= 0 ? 1.0f : -1.0f) / (std::abs(theta) + std::sqrt(theta * theta + 1.0f));
+				float c = 1.0f / std::sqrt(t * t + 1.0f);
+				float s = t * c;
+				glm::mat3 rotation(1.0f);
+				rotation[p][p] = c;
+				rotation[q][q] = c;
+				rotation[q][p] = s;  // column q, row p
+				rotation[p][q] = -s; // column p, row q
+				a = glm::transpose(rotation) * a * rotation;
+				v = v * rotation;
+			}
+		}
+	}
+
+	int order[3] = { 0, 1, 2 };
+	std::sort(order, order + 3, [&](int i, int j) { return a[i][i] > a[j][j]; });
+	for (int k = 0; k < 3; k++) {
+		eigenvalues[k] = a[order[k]][order[k]];
+		eigenvectors[k] = v[order[k]];
+	}
+}
+
+#endif // !SYMMETRIC_EIGEN_H
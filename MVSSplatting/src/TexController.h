@@ -25,25 +25,52 @@ public:
 private:
 
 	Intrinsics intrinsics;
+	int nrMvsNeighbors = 0;
+	int nrMvsLayers = 0;
+	// remaps the images of 1 camera at a time (see UndistorterOf), only for cameras that differ from the pinhole camera
+	Undistorter undistorter;
+	uint32_t undistorterCamera = 0;
+	std::map<uint32_t, GLuint> validMasks; // per remapped camera with pixels outside its image: the user mask that masks them
 
 public:
 	
 	std::map<int, GLuint> images;
 	std::map<int, GLuint> mvs_rough;
 	std::map<int, GLuint> masks;
+	std::map<int, GLuint> confidences; // [0, 1] how reliable the MVS depth of each pixel is
+	std::map<int, GLuint> features;    // per image, the features of the matching cost (see image_features.fs), only for costs other than RGB
+	std::map<int, GLuint> userMasks;   // per loaded image, with mipmaps: 0 = ignore the pixel, empty without --masks or remapped images (see LoadUserMasks)
+	GLuint keepAllMask = 0;            // the user mask of the images without a mask file
+	// intermediates of the plane sweep, with the size of 1 tile (see CreateSweepTextures)
 	std::vector<GLuint> tmpFloat_neighbors;
 	std::vector<GLuint> tmpFloat_layers;
 	std::vector<GLuint> tmpVec3;
+	GLuint importance = 0;
+	GLuint depthPrior = 0; // depth of earlier key views, reprojected into the key view that is being swept
+	GLuint layerRange = 0; // per block of layerRangeBlock x layerRangeBlock pixels: the layers that the sweep needs (see layer_range.fs)
+	static constexpr int layerRangeBlock = 8;
+
+	// Store the depth maps, the sweep intermediates and the matching cost features as 16-bit floats, which halves their
+	// memory and the bandwidth of the sweep. Costs (~[0, 1]), layer indices and depths need far fewer than 24 bits of
+	// mantissa. The exceptions are the features of the census code (an exact 24-bit integer) and of NCC (whose division by
+	// the deviation of the window amplifies their rounding), which stay 32-bit.
+	// Set before Init, or call ReallocateDepthMaps after changing it.
+	bool halfFloat = false;
 
 	// dummy textures for framebuffers
 	GLuint fbo_ca0;
 	GLuint fbo2_ca0;
 	GLuint fbo2_ca1;
+	GLuint fbo2_ca2;
+	GLuint fboMasks_ca0;
+	GLuint fboMasks_ca1;
 
 public:
 	
 	bool Init(Intrinsics intrinsics, Extrinsics extrinsics, std::vector<int> keyCamIds, std::map<int, std::vector<int>> mvsNeighbors, std::string imagesPath, int nrMvsNeighbors, int nrMvsLayers) {
 		this->intrinsics = intrinsics;
+		this->nrMvsNeighbors = nrMvsNeighbors;
+		this->nrMvsLayers = nrMvsLayers;
 
 		std::vector<GLubyte> data(intrinsics.width * intrinsics.height, 255);
 
@@ -51,25 +78,23 @@ public:
 			// depth maps
 			GLuint texture;
 			glGenTextures(1, &texture);
-			glDefineTexture(texture, GL_R32F, intrinsics.width, intrinsics.height, GL_RED, GL_FLOAT);
+			glDefineTexture(texture, halfFloat ? GL_R16F : GL_R32F, intrinsics.width, intrinsics.height, GL_RED, GL_FLOAT);
 			mvs_rough[id] = texture;
 			// masks
 			glGenTextures(1, &texture);
 			glDefineTexture(texture, GL_R8, intrinsics.width, intrinsics.height, GL_RED, GL_UNSIGNED_BYTE);
 			masks[id] = texture;
+			// confidences
+			glGenTextures(1, &texture);
+			glDefineTexture(texture, GL_R8, intrinsics.width, intrinsics.height, GL_RED, GL_UNSIGNED_BYTE);
+			confidences[id] = texture;
 		}
 		
-		// calculate which images need to be loaded (only those of key cameras and their neighbors)
-		std::unordered_set<int> imageIdsToLoad;
-		for (int& keyCamId : keyCamIds) {
-			imageIdsToLoad.insert(keyCamId);
-			for (int& neighborId : mvsNeighbors[keyCamId]) {
-				imageIdsToLoad.insert(neighborId);
-			}
-		}
+		std::unordered_set<int> imageIdsToLoad = ImagesToLoad(keyCamIds, mvsNeighbors);
 
 		bool checkedAlignment = false;
-		for (const int& id : imageIdsToLoad) {
+		std::vector<unsigned char> undistorted;
+		for (const int& id : ByCamera(extrinsics, std::vector<int>(imageIdsToLoad.begin(), imageIdsToLoad.end()))) {
 			// images
 			std::string filename = imagesPath + extrinsics.imageNames[id];
 			int width, height, channels;
@@ -78,6 +103,20 @@ public:
 				std::cout << "Error: failed to load image " << filename << std::endl;
 				return false;
 			}
+			const Undistorter* remap = UndistorterOf(extrinsics.cameraIds[id]);
+			if (remap) {
+				if (width != intrinsics.width || height != intrinsics.height) {
+					printf("Error: image %s is %d x %d pixels instead of %d x %d\n", filename.c_str(), width, height, intrinsics.width, intrinsics.height);
+					stbi_image_free(image);
+					return false;
+				}
+				remap->Remap(image, channels, undistorted);
+				std::copy(undistorted.begin(), undistorted.end(), image);
+				if (validMasks.count(undistorterCamera) == 0) {
+					std::vector<unsigned char> valid = remap->ValidMask();
+					validMasks[undistorterCamera] = valid.empty() ? 0 : CreateUserMask(valid.data());
+				}
+			}
 
 			if (!checkedAlignment && width % 4 != 0) {
 				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
@@ -91,38 +130,249 @@ public:
 			stbi_image_free(image);
 		}
 
-		// textures for intermediate calculations during multi-view stereo
+		// the pixels of remapped images outside of their source image are masked, like the user masks of --masks do
+		int nrValidMasks = std::count_if(validMasks.begin(), validMasks.end(), [](const std::pair<const uint32_t, GLuint>& pair) { return pair.second != 0; });
+		if (nrValidMasks > 0) {
+			for (auto const& pair : images) {
+				auto found = validMasks.find(extrinsics.cameraIds[pair.first]);
+				userMasks[pair.first] = found != validMasks.end() && found->second != 0 ? found->second : KeepAllMask();
+			}
+			printf("Masked the pixels outside of the distorted images of %d cameras\n", nrValidMasks);
+		}
+
+		// framebuffer dummy textures, only attached until the first pass replaces them
+		glGenTextures(1, &fbo_ca0);
+		glGenTextures(1, &fbo2_ca0);
+		glGenTextures(1, &fbo2_ca1);
+		glGenTextures(1, &fbo2_ca2);
+		glDefineTexture(fbo_ca0, GL_R32F, 1, 1, GL_RED, GL_FLOAT, 0);
+		glDefineTexture(fbo2_ca0, GL_R32F, 1, 1, GL_RED, GL_FLOAT, 0);
+		glDefineTexture(fbo2_ca1, GL_R8, 1, 1, GL_RED, GL_UNSIGNED_BYTE);
+		glDefineTexture(fbo2_ca2, GL_R8, 1, 1, GL_RED, GL_UNSIGNED_BYTE);
+		glGenTextures(1, &fboMasks_ca0);
+		glGenTextures(1, &fboMasks_ca1);
+		glDefineTexture(fboMasks_ca0, GL_R8, 1, 1, GL_RED, GL_UNSIGNED_BYTE);
+		glDefineTexture(fboMasks_ca1, GL_R8, 1, 1, GL_RED, GL_UNSIGNED_BYTE);
+
+		return true;
+	}
+
+	// only the images of the key cameras and their neighbors are loaded
+	static std::unordered_set<int> ImagesToLoad(const std::vector<int>& keyCamIds, const std::map<int, std::vector<int>>& mvsNeighbors) {
+		std::unordered_set<int> imageIdsToLoad;
+		for (int keyCamId : keyCamIds) {
+			imageIdsToLoad.insert(keyCamId);
+			auto found = mvsNeighbors.find(keyCamId);
+			if (found == mvsNeighbors.end()) continue;
+			imageIdsToLoad.insert(found->second.begin(), found->second.end());
+		}
+		return imageIdsToLoad;
+	}
+
+	// What the textures allocated by Init, LoadUserMasks, CreateSweepTextures (of sweepSize), CreateFeatureTextures,
+	// CreateDepthPriorTex and CreateImportanceTex take, in bytes per kind of texture, for --plan. RGB textures count
+	// as RGBA, like most drivers store them, and mipmaps as 1/3 extra.
+	// halfFeatures: the features are 16-bit (see halfFloat).
+	static std::vector<std::pair<std::string, int64_t>> EstimateMemory(const Intrinsics& intrinsics, int nrImages, int nrKeyCams, int nrMvsNeighbors, int nrMvsLayers,
+		glm::ivec2 sweepSize, int nrVec3, bool halfFloat, bool features, bool halfFeatures, bool userMasks, bool depthPrior, bool importance) {
+		int64_t pixels = static_cast<int64_t>(intrinsics.width) * intrinsics.height;
+		int64_t sweepPixels = static_cast<int64_t>(sweepSize.x) * sweepSize.y;
+		std::vector<std::pair<std::string, int64_t>> bytes;
+		bytes.push_back({ "images", nrImages * pixels * 4 });
+		bytes.push_back({ "depth maps, masks and confidences", nrKeyCams * pixels * ((halfFloat ? 2 : 4) + 1 + 1) });
+		bytes.push_back({ "sweep intermediates", sweepPixels * SweepBytesPerPixel(nrMvsNeighbors, nrMvsLayers, nrVec3, halfFloat) });
+		if (features) bytes.push_back({ "matching cost features", nrImages * pixels * (halfFeatures ? 8 : 16) });
+		if (userMasks) bytes.push_back({ "user masks", nrImages * pixels * 4 / 3 });
+		if (depthPrior) bytes.push_back({ "depth prior", pixels * 4 + pixels / (layerRangeBlock * layerRangeBlock) * 8 });
+		if (importance) bytes.push_back({ "importance", pixels * 8 });
+		return bytes;
+	}
+
+	// Optional masks of the regions to ignore (sky, moving people, the tripod, black borders), in the COLMAP convention:
+	// <masksPath><image name>.png, or the image name with its extension replaced by .png, with 0 for the pixels to ignore.
+	// Images without a mask file get a 1 x 1 texture that keeps everything. The mipmaps let the shaders test
+	// whether a whole window is masked with 1 lookup.
+	// The images of remapped cameras (see Init) keep the mask of the pixels outside their source image if they have no mask file.
+	bool LoadUserMasks(Extrinsics extrinsics, std::string masksPath) {
+		int nrMissing = 0;
+		std::vector<int> ids;
+		for (auto const& pair : images) {
+			ids.push_back(pair.first);
+		}
+		for (int id : ByCamera(extrinsics, ids)) {
+			std::string name = extrinsics.imageNames[id];
+			std::string filename = masksPath + name + ".png";
+			if (!std::ifstream(filename).good()) {
+				filename = masksPath + name.substr(0, name.find_last_of('.')) + ".png";
+			}
+			if (!std::ifstream(filename).good()) {
+				if (userMasks.count(id) == 0) userMasks[id] = KeepAllMask();
+				nrMissing++;
+				continue;
+			}
+
+			int width, height, channels;
+			unsigned char* mask = stbi_load(filename.c_str(), &width, &height, &channels, 1);
+			if (!mask) {
+				std::cout << "Error: failed to load mask " << filename << std::endl;
+				return false;
+			}
+			if (width != intrinsics.width || height != intrinsics.height) {
+				printf("Error: mask %s is %d x %d pixels instead of %d x %d\n", filename.c_str(), width, height, intrinsics.width, intrinsics.height);
+				stbi_image_free(mask);
+				return false;
+			}
+			for (int i = 0; i < width * height; i++) {
+				mask[i] = mask[i] > 0 ? 255 : 0;
+			}
+			const Undistorter* remap = UndistorterOf(extrinsics.cameraIds[id]);
+			if (remap) {
+				// the pixels outside the distorted image become masked
+				std::vector<unsigned char> undistorted;
+				remap->Remap(mask, 1, undistorted, /*nearest*/ true);
+				std::copy(undistorted.begin(), undistorted.end(), mask);
+			}
+
+			userMasks[id] = CreateUserMask(mask);
+			stbi_image_free(mask);
+		}
+		printf("Loaded %d masks from %s (%d images without a mask)\n", (int)images.size() - nrMissing, masksPath.c_str(), nrMissing);
+		return true;
+	}
+
+	// a user mask of the image size from 0 (masked) or 255 (keep) per pixel, with the mipmaps of LoadUserMasks
+	GLuint CreateUserMask(const unsigned char* mask) {
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glDefineTexture(texture, GL_R8, intrinsics.width, intrinsics.height, GL_RED, GL_UNSIGNED_BYTE, const_cast<unsigned char*>(mask), false);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+		return texture;
+	}
+
+	// the 1 x 1 user mask that keeps everything, created on first use
+	GLuint KeepAllMask() {
+		if (keepAllMask == 0) {
+			GLubyte keep = 255;
+			glGenTextures(1, &keepAllMask);
+			glDefineTexture(keepAllMask, GL_R8, 1, 1, GL_RED, GL_UNSIGNED_BYTE, &keep);
+		}
+		return keepAllMask;
+	}
+
+	// the undistorter that remaps the images of a camera to the pinhole camera, nullptr if they do not need it. Its table is
+	// only rebuilt when the camera changes, so callers go through the images by camera (see ByCamera).
+	const Undistorter* UndistorterOf(uint32_t cameraId) {
+		auto found = intrinsics.cameras.find(cameraId);
+		if (found == intrinsics.cameras.end() || !intrinsics.NeedsRemap(found->second)) return nullptr;
+		if (!undistorter.Enabled() || undistorterCamera != cameraId) {
+			undistorter.Init(found->second, intrinsics);
+			undistorterCamera = cameraId;
+		}
+		return &undistorter;
+	}
+
+	// image ids sorted by camera
+	static std::vector<int> ByCamera(Extrinsics& extrinsics, std::vector<int> ids) {
+		std::sort(ids.begin(), ids.end(), [&](int a, int b) {
+			return std::make_pair(extrinsics.cameraIds[a], a) < std::make_pair(extrinsics.cameraIds[b], b);
+		});
+		return ids;
+	}
+
+	// the mask of an image, 0 without --masks
+	GLuint UserMask(int id) {
+		auto found = userMasks.find(id);
+		return found == userMasks.end() ? 0 : found->second;
+	}
+
+	// Textures for the intermediate calculations of the plane sweep: an error map per neighbor and per layer, and nrVec3
+	// textures with the best layer per group of 32 layers. They cover 1 tile of width x height pixels, so their memory
+	// (~240 bytes per pixel for 4 neighbors and 50 layers, half that with halfFloat) does not grow with the image size.
+	// Replaces the textures of an earlier call.
+	void CreateSweepTextures(int width, int height, int nrVec3) {
+		DeleteSweepTextures();
 		tmpFloat_neighbors = std::vector<GLuint>(nrMvsNeighbors, 0);
 		for (int n = 0; n < nrMvsNeighbors; n++) {
 			glGenTextures(1, &(tmpFloat_neighbors[n]));
-			glDefineTexture(tmpFloat_neighbors[n], GL_R32F, intrinsics.width, intrinsics.height, GL_RED, GL_FLOAT, 0);
+			glDefineTexture(tmpFloat_neighbors[n], halfFloat ? GL_R16F : GL_R32F, width, height, GL_RED, GL_FLOAT, 0);
 		}
 
 		tmpFloat_layers = std::vector<GLuint>(nrMvsLayers, 0);
 		for (int n = 0; n < nrMvsLayers; n++) {
 			glGenTextures(1, &(tmpFloat_layers[n]));
-			glDefineTexture(tmpFloat_layers[n], GL_R32F, intrinsics.width, intrinsics.height, GL_RED, GL_FLOAT, 0);
+			glDefineTexture(tmpFloat_layers[n], halfFloat ? GL_R16F : GL_R32F, width, height, GL_RED, GL_FLOAT, 0);
 		}
 
-		// framebuffer dummy textures
-		glGenTextures(1, &fbo_ca0);
-		glGenTextures(1, &fbo2_ca0);
-		glGenTextures(1, &fbo2_ca1);
-		glDefineTexture(fbo_ca0, GL_R32F, intrinsics.width, intrinsics.height, GL_RED, GL_FLOAT, 0);
-		glDefineTexture(fbo2_ca0, GL_R32F, intrinsics.width, intrinsics.height, GL_RED, GL_FLOAT, 0);
-		glDefineTexture(fbo2_ca1, GL_R8, intrinsics.width, intrinsics.height, GL_RED, GL_UNSIGNED_BYTE);
+		// RGB16F is not a required render target format, so the half version has 4 channels
+		tmpVec3 = std::vector<GLuint>(nrVec3, 0);
+		for (int n = 0; n < nrVec3; n++) {
+			glGenTextures(1, &(tmpVec3[n]));
+			if (halfFloat) glDefineTexture(tmpVec3[n], GL_RGBA16F, width, height, GL_RGBA, GL_FLOAT, 0);
+			else glDefineTexture(tmpVec3[n], GL_RGB32F, width, height, GL_RGB, GL_FLOAT, 0);
+		}
+	}
 
-		return true;
+	// the bytes per pixel of the textures of CreateSweepTextures
+	static int SweepBytesPerPixel(int nrMvsNeighbors, int nrMvsLayers, int nrVec3, bool halfFloat) {
+		return halfFloat ? 2 * (nrMvsNeighbors + nrMvsLayers) + 8 * nrVec3 : 4 * (nrMvsNeighbors + nrMvsLayers) + 16 * nrVec3;
 	}
 
-	void CreateTmpVec3(int nrTextures) {
-		tmpVec3 = std::vector<GLuint>(nrTextures, 0);
-		for (int n = 0; n < nrTextures; n++) {
-			glGenTextures(1, &(tmpVec3[n]));
-			glDefineTexture(tmpVec3[n], GL_RGB32F, intrinsics.width, intrinsics.height, GL_RGB, GL_FLOAT, 0);
+	// 1 feature texture per loaded image, 16-bit with halfFloat unless fullPrecision. Replaces the textures of an earlier call.
+	void CreateFeatureTextures(bool fullPrecision) {
+		for (auto const& pair : features) {
+			glDeleteTextures(1, &pair.second);
+		}
+		features.clear();
+		for (auto const& pair : images) {
+			GLuint texture;
+			glGenTextures(1, &texture);
+			glDefineTexture(texture, halfFloat && !fullPrecision ? GL_RGBA16F : GL_RGBA32F, intrinsics.width, intrinsics.height, GL_RGBA, GL_FLOAT, 0, false);
+			features[pair.first] = texture;
+		}
+	}
+
+	// give the depth maps the precision of halfFloat, e.g. to run the sweep again in the other precision
+	void ReallocateDepthMaps() {
+		for (auto const& pair : mvs_rough) {
+			glDefineTexture(pair.second, halfFloat ? GL_R16F : GL_R32F, intrinsics.width, intrinsics.height, GL_RED, GL_FLOAT);
 		}
 	}
 
+	void CreateImportanceTex() {
+		glGenTextures(1, &importance);
+		glDefineTexture(importance, GL_RG32F, intrinsics.width, intrinsics.height, GL_RG, GL_FLOAT, 0);
+	}
+
+	void CreateDepthPriorTex() {
+		glDeleteTextures(1, &depthPrior);
+		glGenTextures(1, &depthPrior);
+		glDefineTexture(depthPrior, GL_R32F, intrinsics.width, intrinsics.height, GL_RED, GL_FLOAT, 0);
+		glDeleteTextures(1, &layerRange);
+		glGenTextures(1, &layerRange);
+		glDefineTexture(layerRange, GL_RG32F, LayerRangeBlocks(intrinsics.width), LayerRangeBlocks(intrinsics.height), GL_RG, GL_FLOAT, 0);
+	}
+
+	// nr of blocks of layerRange along a side of the image of the given nr of pixels
+	static int LayerRangeBlocks(int pixels) {
+		return (pixels + layerRangeBlock - 1) / layerRangeBlock;
+	}
+
+	// copy a texture (of the same resolution as the images) to the CPU
+	void ReadTexture(GLuint tex, GLenum format, GLenum type, /*out*/ void* data) {
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glGetTexImage(GL_TEXTURE_2D, 0, format, type, data);
+	}
+
+	// copy data from the CPU to a texture (of the same resolution as the images)
+	void WriteTexture(GLuint tex, GLenum format, GLenum type, const void* data) {
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, intrinsics.width, intrinsics.height, format, type, data);
+	}
+
 	void Cleanup() {
 		for (auto const& pair : images) {
 			glDeleteTextures(1, &pair.second);
@@ -138,7 +388,48 @@ public:
 			glDeleteTextures(1, &pair.second);
 		}
 		masks.clear();
+
+		for (auto const& pair : confidences) {
+			glDeleteTextures(1, &pair.second);
+		}
+		confidences.clear();
+
+		for (auto const& pair : features) {
+			glDeleteTextures(1, &pair.second);
+		}
+		features.clear();
+
+		std::unordered_set<GLuint> uniqueMasks;
+		for (auto const& pair : userMasks) {
+			uniqueMasks.insert(pair.second);
+		}
+		for (auto const& pair : validMasks) {
+			if (pair.second != 0) uniqueMasks.insert(pair.second);
+		}
+		for (GLuint t : uniqueMasks) {
+			glDeleteTextures(1, &t);
+		}
+		userMasks.clear();
+		validMasks.clear();
+		keepAllMask = 0;
 		
+		DeleteSweepTextures();
+
+		glDeleteTextures(1, &importance);
+		glDeleteTextures(1, &depthPrior);
+		glDeleteTextures(1, &layerRange);
+
+		glDeleteTextures(1, &fbo_ca0);
+		glDeleteTextures(1, &fbo2_ca0);
+		glDeleteTextures(1, &fbo2_ca1);
+		glDeleteTextures(1, &fbo2_ca2);
+		glDeleteTextures(1, &fboMasks_ca0);
+		glDeleteTextures(1, &fboMasks_ca1);
+		
+	}
+	
+private:
+	void DeleteSweepTextures() {
 		for (GLuint& t : tmpFloat_neighbors) {
 			glDeleteTextures(1, &t);
 		}
@@ -153,14 +444,8 @@ public:
 			glDeleteTextures(1, &t);
 		}
 		tmpVec3.clear();
-
-		glDeleteTextures(1, &fbo_ca0);
-		glDeleteTextures(1, &fbo2_ca0);
-		glDeleteTextures(1, &fbo2_ca1);
-		
 	}
-	
-private:
+
 	static void glDefineTexture(GLuint tex, GLint internalformat, int w, int h, GLenum format, GLenum type, void* data = NULL, bool nearest=true) {
 		glBindTexture(GL_TEXTURE_2D, tex);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, nearest? GL_NEAREST : GL_LINEAR);
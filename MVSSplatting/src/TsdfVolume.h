@@ -0,0 +1,235 @@
+#ifndef TSDF_VOLUME_H
+#define TSDF_VOLUME_H
+
+#include <array>
+
+// Sparse truncated signed distance field, to fuse the depth maps of all key views into one surface.
+// Only the blocks of 8 x 8 x 8 voxels near an observed surface are allocated, in a hash map from block coordinates
+// to an index in the list of blocks. Each voxel keeps a running confidence-weighted average of the signed distance
+// and color over all views that observed it, so noise is averaged away and overlapping views end up in the same voxels.
+// The surface is extracted as points on the zero crossings between neighboring voxels, so the nr of output points
+// scales with the surface area instead of with the nr of views.
+class TsdfVolume {
+
+private:
+	struct Voxel {
+		float tsdf = 1;  // signed distance / truncation, in [-1, 1], positive in front of the surface
+		float weight = 0;
+		glm::vec3 color = glm::vec3(0);
+	};
+
+	static constexpr int blockSize = 8;
+	static constexpr int voxelsPerBlock = blockSize * blockSize * blockSize;
+	typedef std::array<Voxel, voxelsPerBlock> Block;
+
+	float voxelSize;
+	float truncation;
+	std::unordered_map<int64_t, int> blockIds;
+	std::vector<Block> blocks;
+
+	// 2 views of full confidence that agree make a fully confident point
+	const float confidentWeight = 2.0f;
+	const float thickness = 0.1f; // like write_splats.vs
+
+public:
+
+	// truncation: in voxels, how far in front of and behind the surface the signed distance is stored
+	TsdfVolume(float voxelSize, float truncation = 4) : voxelSize(voxelSize), truncation(truncation * voxelSize) {}
+
+	int NrBlocks() const {
+		return blocks.size();
+	}
+
+	// Integrate 1 depth map, with the same layout and unprojection as in write_splats.vs.
+	// depth, confidence and mask have 1 value per pixel, color has 3. Pixels with a mask <= 127 are ignored.
+	void Integrate(const std::vector<float>& depth, const std::vector<unsigned char>& color, const std::vector<unsigned char>& confidence,
+		const std::vector<unsigned char>& mask, const Intrinsics& intrinsics, const CameraPose& pose) {
+
+		int width = intrinsics.width;
+		int height = intrinsics.height;
+		auto isValid = [&](int i) { return mask[i] > 127 && depth[i] > 0; };
+
+		// 1. allocate the blocks along the truncation band of every pixel
+		std::vector<std::vector<int64_t>> keysPerThread(NrThreads());
+		ParallelFor(height, [&](int begin, int end, int t) {
+			std::unordered_set<int64_t> keys;
+			for (int row = begin; row < end; row++) {
+				for (int col = 0; col < width; col++) {
+					if (!isValid(row * width + col)) continue;
+					glm::vec3 local = Unproject(col, row, depth[row * width + col], intrinsics);
+					glm::vec3 world = glm::vec3(pose.model * glm::vec4(local, 1));
+					glm::vec3 ray = glm::normalize(world - pose.pos);
+					for (float s = -truncation; s <= truncation; s += voxelSize) {
+						keys.insert(BlockKey(glm::ivec3(glm::floor((world + s * ray) / (voxelSize * blockSize)))));
+					}
+				}
+			}
+			keysPerThread[t].assign(keys.begin(), keys.end());
+		});
+
+		std::vector<int> visibleBlocks;
+		for (std::vector<int64_t>& keys : keysPerThread) {
+			for (int64_t key : keys) {
+				auto inserted = blockIds.insert(std::pair<int64_t, int>(key, blocks.size()));
+				if (inserted.second) {
+					blocks.push_back(Block());
+					blocks.back().fill(Voxel());
+				}
+				visibleBlocks.push_back(inserted.first->second);
+			}
+		}
+		std::sort(visibleBlocks.begin(), visibleBlocks.end());
+		visibleBlocks.erase(std::unique(visibleBlocks.begin(), visibleBlocks.end()), visibleBlocks.end());
+
+		// 2. project every voxel of those blocks into the depth map, and update its running average
+		std::vector<glm::ivec3> blockCoords(blocks.size());
+		for (auto& pair : blockIds) {
+			blockCoords[pair.second] = KeyToBlock(pair.first);
+		}
+		ParallelFor(visibleBlocks.size(), [&](int begin, int end, int /*t*/) {
+			for (int b = begin; b < end; b++) {
+				int blockId = visibleBlocks[b];
+				Block& block = blocks[blockId];
+				for (int v = 0; v < voxelsPerBlock; v++) {
+					glm::vec3 world = VoxelCenter(blockCoords[blockId], v);
+					glm::vec3 local = glm::vec3(pose.view * glm::vec4(world, 1));
+					if (local.z <= 0) continue;
+
+					// inverse of Unproject
+					float u = local.x / local.z * intrinsics.fx + intrinsics.cx;
+					float w = local.y / local.z * intrinsics.fy + (height - intrinsics.cy);
+					int col = static_cast<int>(std::floor(u));
+					int row = static_cast<int>(std::floor(w));
+					if (col < 0 || col >= width || row < 0 || row >= height) continue;
+					int i = row * width + col;
+					if (!isValid(i)) continue;
+
+					float sdf = depth[i] - local.z;
+					if (sdf < -truncation) continue; // hidden behind the surface
+					float tsdf = std::min(1.0f, sdf / truncation);
+					float observationWeight = confidence[i] / 255.0f + 1e-3f;
+
+					Voxel& voxel = block[v];
+					float newWeight = voxel.weight + observationWeight;
+					voxel.tsdf = (voxel.tsdf * voxel.weight + tsdf * observationWeight) / newWeight;
+					glm::vec3 observedColor = glm::vec3(color[3 * i], color[3 * i + 1], color[3 * i + 2]) / 255.0f;
+					voxel.color = (voxel.color * voxel.weight + observedColor * observationWeight) / newWeight;
+					voxel.weight = newWeight;
+				}
+			}
+		});
+	}
+
+	// A splat on every zero crossing of the signed distance between 2 neighboring voxels (along x, y and z),
+	// oriented along the gradient of the signed distance
+	void ExtractSplats(/*out*/ std::vector<Splat>& splats) {
+		std::vector<glm::ivec3> blockCoords(blocks.size());
+		for (auto& pair : blockIds) {
+			blockCoords[pair.second] = KeyToBlock(pair.first);
+		}
+
+		std::vector<std::vector<Splat>> splatsPerThread(NrThreads());
+		ParallelFor(blocks.size(), [&](int begin, int end, int t) {
+			for (int blockId = begin; blockId < end; blockId++) {
+				for (int v = 0; v < voxelsPerBlock; v++) {
+					const Voxel& voxel = blocks[blockId][v];
+					if (voxel.weight <= 0 || std::abs(voxel.tsdf) >= 1) continue;
+					glm::ivec3 coords = blockCoords[blockId] * blockSize + glm::ivec3(v % blockSize, (v / blockSize) % blockSize, v / (blockSize * blockSize));
+
+					for (int axis = 0; axis < 3; axis++) {
+						glm::ivec3 neighborCoords = coords;
+						neighborCoords[axis]++;
+						const Voxel* neighbor = FindVoxel(neighborCoords);
+						if (!neighbor || neighbor->weight <= 0 || std::abs(neighbor->tsdf) >= 1) continue;
+						if ((voxel.tsdf > 0) == (neighbor->tsdf > 0)) continue;
+
+						float alpha = voxel.tsdf / (voxel.tsdf - neighbor->tsdf);
+						glm::vec3 position = (glm::vec3(coords) + 0.5f) * voxelSize;
+						position[axis] += alpha * voxelSize;
+
+						glm::vec3 gradient = Gradient(alpha < 0.5f ? coords : neighborCoords);
+						if (glm::length(gradient) < 1e-12f) continue;
+						glm::vec3 normal = glm::normalize(gradient);
+
+						Splat splat;
+						splat.position = position;
+						splat.color = glm::mix(voxel.color, neighbor->color, alpha);
+						splat.scale = 0.5f * voxelSize;
+						splat.scales = glm::vec3(splat.scale, splat.scale, thickness * splat.scale);
+						splat.rotation = NormalToQuaternion(normal);
+						splat.confidence = std::min(1.0f, glm::mix(voxel.weight, neighbor->weight, alpha) / confidentWeight);
+						splatsPerThread[t].push_back(splat);
+					}
+				}
+			}
+		});
+
+		splats.clear();
+		for (std::vector<Splat>& threadSplats : splatsPerThread) {
+			splats.insert(splats.end(), threadSplats.begin(), threadSplats.end());
+		}
+	}
+
+private:
+
+	// same as Unproject in write_splats.vs, for the center of pixel (col, row)
+	static glm::vec3 Unproject(int col, int row, float depth, const Intrinsics& intrinsics) {
+		float x = (col + 0.5f - intrinsics.cx) / intrinsics.fx * depth;
+		float y = (row + 0.5f - (intrinsics.height - intrinsics.cy)) / intrinsics.fy * depth;
+		return glm::vec3(x, y, depth);
+	}
+
+	// 21 bits per coordinate
+	static int64_t BlockKey(glm::ivec3 block) {
+		const int64_t mask = (1 << 21) - 1;
+		return ((block.x & mask) << 42) | ((block.y & mask) << 21) | (block.z & mask);
+	}
+
+	static glm::ivec3 KeyToBlock(int64_t key) {
+		auto signExtend = [](int64_t value) { return static_cast<int>(value >= (1 << 20) ? value - (1 << 21) : value); };
+		const int64_t mask = (1 << 21) - 1;
+		return glm::ivec3(signExtend((key >> 42) & mask), signExtend((key >> 21) & mask), signExtend(key & mask));
+	}
+
+	glm::vec3 VoxelCenter(glm::ivec3 block, int v) const {
+		glm::ivec3 coords = block * blockSize + glm::ivec3(v % blockSize, (v / blockSize) % blockSize, v / (blockSize * blockSize));
+		return (glm::vec3(coords) + 0.5f) * voxelSize;
+	}
+
+	// voxel at global voxel coordinates, nullptr if its block was never allocated
+	const Voxel* FindVoxel(glm::ivec3 coords) const {
+		glm::ivec3 block = glm::ivec3(glm::floor(glm::vec3(coords) / static_cast<float>(blockSize)));
+		auto found = blockIds.find(BlockKey(block));
+		if (found == blockIds.end()) return nullptr;
+		glm::ivec3 inBlock = coords - block * blockSize;
+		return &blocks[found->second][inBlock.x + blockSize * (inBlock.y + blockSize * inBlock.z)];
+	}
+
+	// central differences, falling back to one-sided ones where a neighbor is unobserved
+	glm::vec3 Gradient(glm::ivec3 coords) const {
+		const Voxel* center = FindVoxel(coords);
+		glm::vec3 gradient(0);
+		for (int axis = 0; axis < 3; axis++) {
+			glm::ivec3 offset(0);
+			offset[axis] = 1;
+			const Voxel* next = FindVoxel(coords + offset);
+			const Voxel* previous = FindVoxel(coords - offset);
+			bool hasNext = next && next->weight > 0;
+			bool hasPrevious = previous && previous->weight > 0;
+			if (hasNext && hasPrevious) gradient[axis] = 0.5f * (next->tsdf - previous->tsdf);
+			else if (hasNext) gradient[axis] = next->tsdf - center->tsdf;
+			else if (hasPrevious) gradient[axis] = center->tsdf - previous->tsdf;
+		}
+		return gradient;
+	}
+
+	// rotation that maps the z axis onto normal, like the rotations of write_splats.vs
+	static glm::vec4 NormalToQuaternion(glm::vec3 normal) {
+		glm::vec3 tangent = glm::normalize(glm::cross(normal, std::abs(normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0)));
+		glm::vec3 bitangent = glm::cross(normal, tangent);
+		glm::quat q = glm::quat_cast(glm::mat3(tangent, bitangent, normal));
+		return glm::vec4(q.w, q.x, q.y, q.z);
+	}
+};
+
+#endif // !TSDF_VOLUME_H
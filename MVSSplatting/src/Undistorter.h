@@ -0,0 +1,97 @@
+#ifndef UNDISTORTER_H
+#define UNDISTORTER_H
+
+// Undistorts the images of a camera with lens distortion while they are loaded, so COLMAP's image_undistorter
+// (which writes a second copy of every image) is not needed. The output is the pinhole camera that the rest uses (see
+// Intrinsics::cameras), which also remaps the images of cameras with other focal lengths or principal points.
+// Per output pixel, a lookup table built once per camera holds the top-left source pixel and the bilinear weights
+// in 8-bit fixed point, so remapping an image is 4 multiply-adds per channel and pixel.
+class Undistorter {
+
+public:
+	Undistorter() {}
+
+	// source: the camera of the images, target: the pinhole camera of the same resolution to remap them to
+	void Init(const Intrinsics& source, const Intrinsics& target) {
+		width = target.width;
+		height = target.height;
+		table = std::vector<Entry>(width * height);
+		ParallelFor(height, [&](int begin, int end, int /*t*/) {
+			for (int row = begin; row < end; row++) {
+				for (int col = 0; col < width; col++) {
+					// COLMAP's convention: the center of the top-left pixel is at (0.5, 0.5)
+					glm::vec2 normalized((col + 0.5f - target.cx) / target.fx, (row + 0.5f - target.cy) / target.fy);
+					glm::vec2 distorted = source.Distort(normalized);
+					glm::vec2 position = glm::vec2(source.fx, source.fy) * distorted + glm::vec2(source.cx, source.cy) - 0.5f;
+
+					Entry& entry = table[row * width + col];
+					if (!(position.x >= -0.5f && position.x <= width - 0.5f && position.y >= -0.5f && position.y <= height - 0.5f)) continue;
+					position = glm::clamp(position, glm::vec2(0), glm::vec2(width - 1, height - 1));
+					glm::ivec2 topLeft = glm::min(glm::ivec2(position), glm::ivec2(width - 2, height - 2));
+					glm::vec2 weight = glm::round((position - glm::vec2(topLeft)) * 256.0f);
+					entry.index = topLeft.y * width + topLeft.x;
+					entry.weightX = static_cast<uint16_t>(weight.x);
+					entry.weightY = static_cast<uint16_t>(weight.y);
+				}
+			}
+		});
+	}
+
+	bool Enabled() const {
+		return !table.empty();
+	}
+
+	// 255 for the pixels that map inside the source image, 0 for the others, e.g. the black corners of barrel distortion.
+	// Empty if all pixels map inside.
+	std::vector<unsigned char> ValidMask() const {
+		std::vector<unsigned char> mask(table.size());
+		bool anyInvalid = false;
+		for (size_t i = 0; i < table.size(); i++) {
+			mask[i] = table[i].index < 0 ? 0 : 255;
+			anyInvalid |= table[i].index < 0;
+		}
+		if (!anyInvalid) mask.clear();
+		return mask;
+	}
+
+	// image: width x height pixels of channels bytes, rows from the top. Pixels that map outside the distorted image are 0.
+	// nearest: take the nearest source pixel instead of interpolating, e.g. for masks.
+	void Remap(const unsigned char* image, int channels, /*out*/ std::vector<unsigned char>& undistorted, bool nearest = false) const {
+		undistorted = std::vector<unsigned char>(table.size() * channels, 0);
+		ParallelFor(height, [&](int begin, int end, int /*t*/) {
+			for (int i = begin * width; i < end * width; i++) {
+				const Entry& entry = table[i];
+				if (entry.index < 0) continue;
+				unsigned char* target = &undistorted[i * channels];
+				const unsigned char* top = &image[entry.index * channels];
+				const unsigned char* bottom = top + width * channels;
+				if (nearest) {
+					const unsigned char* row = entry.weightY < 128 ? top : bottom;
+					const unsigned char* pixel = entry.weightX < 128 ? row : row + channels;
+					for (int c = 0; c < channels; c++) target[c] = pixel[c];
+					continue;
+				}
+				uint32_t wx = entry.weightX;
+				uint32_t wy = entry.weightY;
+				for (int c = 0; c < channels; c++) {
+					uint32_t upper = top[c] * (256 - wx) + top[c + channels] * wx;
+					uint32_t lower = bottom[c] * (256 - wx) + bottom[c + channels] * wx;
+					target[c] = static_cast<unsigned char>((upper * (256 - wy) + lower * wy + 32768) >> 16);
+				}
+			}
+		});
+	}
+
+private:
+	struct Entry {
+		int32_t index = -1; // of the top-left source pixel, -1 = outside the distorted image
+		uint16_t weightX = 0; // of the right column, in [0, 256]
+		uint16_t weightY = 0; // of the bottom row
+	};
+
+	int width = 0;
+	int height = 0;
+	std::vector<Entry> table;
+};
+
+#endif // !UNDISTORTER_H
@@ -11,24 +11,41 @@
 #include <chrono>
 #include <vector>
 #include <algorithm>
+#include <numeric>
 #include <gtx/string_cast.hpp>
+#include <gtc/packing.hpp>
 #ifndef CXXOPTS_NO_EXCEPTIONS
 #define CXXOPTS_NO_EXCEPTIONS
 #endif
 #include "cxxopts.hpp"
 
-// From CMAKE preprocessor
-std::string cmakelists_dir = CMAKELISTS_SOURCE_DIR;
-
 #include "CameraParams.h"
+#include "Parallel.h"
+#include "Undistorter.h"
+#include "Splat.h"
+#include "SymmetricEigen.h"
+#include "RegionOfInterest.h"
+#include "EmbeddedShaders.h"
+#include "ProgramCache.h"
 #include "Shader.h"
 #include "ShaderController.h"
 #include "TexController.h"
-#include "FramebufferController.h"
+#include "FrameBufferController.h"
 #include "Gui.h"
 #include "KeyViewsCalculator.h"
 #include "MultiViewStereo.h"
+#include "PrecisionReport.h"
+#include "DepthFilter.h"
+#include "SplatMerger.h"
+#include "KdTree.h"
+#include "KnnFilter.h"
+#include "TsdfVolume.h"
+#include "AdaptiveSampler.h"
+#include "SplatOctree.h"
+#include "SplatWriter.h"
+#include "CpuSplatter.h"
 #include "SplatGenerator.h"
+#include "JobPlanner.h"
 
 class Options {
 public:
@@ -36,6 +53,39 @@ public:
     bool eval = false;   // use test/train split
     bool headless = true;
     bool verbose = false;
+    float mergeCellFactor = 0; // 0 = don't merge splats
+    bool adaptiveSampling = false;
+    int targetNrSplats = 0; // 0 = estimate the nr of splats from the resolution and nr of key views
+    SplatWriter::Format format = SplatWriter::Format::Bin;
+    bool quantize = false;
+    bool lod = false;
+    MultiViewStereo::MatchingCost cost = MultiViewStereo::MatchingCost::Color;
+    int floaterRadius = 0; // 0 = keep floaters
+    bool halfFloat = false;         // 16-bit depth maps and sweep intermediates
+    bool comparePrecision = false;  // also sweep in full precision first, and report the difference
+    int tileSize = 0; // 0 = only tile images that are too large to sweep at once
+    int priorBand = 0; // 0 = sweep all layers of every key view
+    glm::vec2 depthPercentiles = glm::vec2(0, 100); // near and far of the sweep, of the depths of the SfM points per image
+    bool histogramLayers = false;
+    std::string masksPath = ""; // "" = no user masks
+    bool autoRoi = false; // estimate the region of interest from the SfM points
+    RegionOfInterest roi; // disabled = the whole scene
+    float tsdfVoxelFactor = 0; // 0 = splats per key view, without fusion
+    int knnNeighbors = 3;
+    float outlierStdRatio = 0; // 0 = keep outliers
+    float minConfidence = 0;   // 0 = keep the unconfident MVS splats
+    bool knnScales = false;
+    bool multiViewColor = false;
+    bool sh1 = false;
+    bool cpuSplats = false; // consistency check and splat extraction on the CPU
+    std::string saveDepthPath = ""; // "" = keep the depth maps on the GPU
+    std::string hostDepthPath = ""; // "" = estimate the depth maps, otherwise load them from this folder and run without GL
+    bool plan = false;       // only print what a run would cost
+    std::string planPath = ""; // "" = print the plan as text, otherwise write it as JSON to this file
+    JobPlanner::Calibration calibration = JobPlanner::DefaultCalibration();
+    bool calibrated = false;
+    std::string shadersPath = "";  // "" = the shaders embedded in the executable
+    std::string programCacheFolder = ProgramCache::DefaultFolder(); // "" = compile the shaders every run
 
 public:
 
@@ -46,10 +96,39 @@ public:
 		cxxopts::Options options("A fast multi-view-stereo depth estimator and 3DGS splat initializer.");
 		options.add_options()
 			("h,help", "Print help")
-            ("s,source", "Path (must end in /) to folder that contains (undistorted!) images/ and sparse/ ", cxxopts::value<std::string>())
+            ("s,source", "Path (must end in /) to folder that contains images/ and sparse/ (distorted camera models are undistorted while loading)", cxxopts::value<std::string>())
             ("eval", "Use test/train split, so starting from 3rd image, ignore every 8th image)")
             ("gui", "Enable gui, otherwise runs headless")
             ("v,verbose", "Print helpful information")
+            ("sampling", "Where to place the splats: 'uniform' grid, or 'adaptive' to the detail in each key view", cxxopts::value<std::string>()->default_value("uniform"))
+            ("target-splats", "Write exactly <N> splats (MVS + Colmap), by measuring how many pixels survive masking", cxxopts::value<int>())
+            ("format", "Output format of the splats: 'bin' (raw float32 x 7), 'mvss' (chunked, with header) or 'ply' (3DGS model)", cxxopts::value<std::string>()->default_value("bin"))
+            ("quantize", "Quantize the mvss output to 26 bytes per splat")
+            ("tsdf", "Fuse the depth maps in a TSDF volume with voxels of <factor> x the splat spacing, and extract the splats from its surface", cxxopts::value<float>()->implicit_value("1"))
+            ("cost", "Matching cost of the plane sweep: 'color' (RGB difference), 'census', 'ncc' or 'gradient' (gray + gradient)", cxxopts::value<std::string>()->default_value("color"))
+            ("precision", "Precision of the depth maps and the plane sweep intermediates: 'full' (32-bit), 'half' (16-bit, half the memory) or 'compare' (run both and report the difference)", cxxopts::value<std::string>()->default_value("full"))
+            ("tile", "Sweep the key views in tiles of at most <size> x <size> pixels, to bound the memory for very large images (default: automatic)", cxxopts::value<int>())
+            ("roi", "Only reconstruct inside a box: 'auto' (around the dense core of the SfM points) or <minx>,<miny>,<minz>,<maxx>,<maxy>,<maxz> in world coordinates", cxxopts::value<std::string>()->implicit_value("auto"))
+            ("masks", "Folder (relative to the source path) with masks of the pixels to ignore: <image name>.png, 0 = ignore", cxxopts::value<std::string>()->implicit_value("masks/"))
+            ("depth-percentiles", "Sweep between these percentiles of the SfM point depths per image, instead of their min and max", cxxopts::value<std::vector<float>>()->implicit_value("2,98"))
+            ("histogram-layers", "Place the sweep layers where the SfM points of each key view are")
+            ("depth-prior", "Sweep only <band> layers around the depth of the previous key views, where it is known and matches well", cxxopts::value<int>()->implicit_value("3"))
+            ("remove-floaters", "Mask off depth map pixels that have a depth discontinuity within <radius> pixels, before the consistency check", cxxopts::value<int>()->implicit_value("5"))
+            ("lod", "Also write a level-of-detail octree of the splats to points3D_mvs_lod.mvss")
+            ("min-confidence", "Drop the MVS splats whose confidence (0 - 1, see --format mvss) is below <c>, instead of only starting them less opaque", cxxopts::value<float>())
+            ("knn", "Nr of nearest neighbors used by --remove-outliers and --knn-scales", cxxopts::value<int>()->default_value("3"))
+            ("remove-outliers", "Remove splats whose mean neighbor distance is more than <ratio> standard deviations above average", cxxopts::value<float>()->implicit_value("2"))
+            ("knn-scales", "Set the splat scales from the mean distance to their nearest neighbors (like 3DGS does at load)")
+            ("multiview-color", "Color the splats with a robust mean over the key view and its MVS neighbors")
+            ("sh1", "Also fit degree-1 spherical harmonics to the colors per view direction (implies --multiview-color)")
+            ("cpu-splats", "Run the consistency check and the splat extraction on all CPU threads instead of the GPU (e.g. for a software renderer)")
+            ("save-depth", "Write the depth maps of the key views to <folder>, as <image name>.depth (for --host-depth)", cxxopts::value<std::string>())
+            ("host-depth", "Load the depth maps of the key views from <folder> instead of estimating them, and make the splats on the CPU without a GPU", cxxopts::value<std::string>())
+            ("merge", "Merge near-duplicate splats of overlapping key views, using voxels of <factor> x the splat spacing", cxxopts::value<float>()->implicit_value("1"))
+            ("plan", "Dry run: only choose the key views, and print the memory, nr of splats and runtime a run would take (or write them as JSON to <file>)", cxxopts::value<std::string>()->implicit_value(""))
+            ("calibration", "Runtime calibration for --plan, as printed at the end of a run on the same machine: <load ns>,<sweep ns>,<splat ns>", cxxopts::value<std::vector<float>>())
+            ("shaders", "Read the shaders from this folder instead of the ones embedded in the executable, e.g. <repo>/MVSSplatting/src/shaders/ to edit them without rebuilding", cxxopts::value<std::string>())
+            ("program-cache", "Folder in which the compiled shaders are cached for the next runs, or 'off' (default: in the cache folder of the user)", cxxopts::value<std::string>())
 			;
 		
 		cxxopts::ParseResult result = options.parse(argc, argv);
@@ -67,6 +146,171 @@ public:
         if (result.count("verbose")) {
             verbose = true;
         }
+        std::string sampling = result["sampling"].as<std::string>();
+        if (sampling == "adaptive") {
+            adaptiveSampling = true;
+        }
+        else if (sampling != "uniform") {
+            printf("Error: --sampling should be 'uniform' or 'adaptive' \n");
+            std::cout << options.help() << std::endl;
+            exit(0);
+        }
+        if (result.count("target-splats")) {
+            targetNrSplats = result["target-splats"].as<int>();
+        }
+        if (!SplatWriter::ParseFormat(result["format"].as<std::string>(), format)) {
+            printf("Error: --format should be 'bin', 'mvss' or 'ply' \n");
+            std::cout << options.help() << std::endl;
+            exit(0);
+        }
+        if (result.count("quantize")) {
+            quantize = true;
+        }
+        if (!MultiViewStereo::ParseCost(result["cost"].as<std::string>(), cost)) {
+            printf("Error: --cost should be 'color', 'census', 'ncc' or 'gradient' \n");
+            std::cout << options.help() << std::endl;
+            exit(0);
+        }
+        std::string precision = result["precision"].as<std::string>();
+        if (precision == "half" || precision == "compare") {
+            halfFloat = true;
+            comparePrecision = precision == "compare";
+        }
+        else if (precision != "full") {
+            printf("Error: --precision should be 'full', 'half' or 'compare' \n");
+            std::cout << options.help() << std::endl;
+            exit(0);
+        }
+        if (result.count("tile")) {
+            tileSize = result["tile"].as<int>();
+            if (tileSize < MultiViewStereo::minTileSize) {
+                printf("Error: --tile should be at least %d pixels \n", MultiViewStereo::minTileSize);
+                std::cout << options.help() << std::endl;
+                exit(0);
+            }
+        }
+        if (result.count("roi")) {
+            std::string roiBox = result["roi"].as<std::string>();
+            std::vector<float> bounds;
+            bool numbers = true;
+            std::stringstream stream(roiBox);
+            std::string value;
+            while (std::getline(stream, value, ',')) {
+                char* end = nullptr;
+                bounds.push_back(std::strtof(value.c_str(), &end));
+                numbers = numbers && !value.empty() && *end == '\0';
+            }
+            if (roiBox == "auto") {
+                autoRoi = true;
+            }
+            else if (numbers && bounds.size() == 6 && bounds[0] < bounds[3] && bounds[1] < bounds[4] && bounds[2] < bounds[5]) {
+                roi = RegionOfInterest::FromBounds(glm::vec3(bounds[0], bounds[1], bounds[2]), glm::vec3(bounds[3], bounds[4], bounds[5]));
+            }
+            else {
+                printf("Error: --roi should be 'auto' or <minx>,<miny>,<minz>,<maxx>,<maxy>,<maxz> with min < max \n");
+                std::cout << options.help() << std::endl;
+                exit(0);
+            }
+        }
+        if (result.count("masks")) {
+            masksPath = result["masks"].as<std::string>();
+            if (!masksPath.empty() && masksPath.back() != '/') masksPath += "/";
+        }
+        if (result.count("depth-percentiles")) {
+            std::vector<float> percentiles = result["depth-percentiles"].as<std::vector<float>>();
+            if (percentiles.size() != 2 || percentiles[0] < 0 || percentiles[0] >= percentiles[1] || percentiles[1] > 100) {
+                printf("Error: --depth-percentiles should be <near>,<far> with 0 <= near < far <= 100 \n");
+                std::cout << options.help() << std::endl;
+                exit(0);
+            }
+            depthPercentiles = glm::vec2(percentiles[0], percentiles[1]);
+        }
+        if (result.count("histogram-layers")) {
+            histogramLayers = true;
+        }
+        if (result.count("depth-prior")) {
+            priorBand = result["depth-prior"].as<int>();
+            if (priorBand < 1) {
+                printf("Error: --depth-prior should be at least 1 layer \n");
+                std::cout << options.help() << std::endl;
+                exit(0);
+            }
+        }
+        if (result.count("remove-floaters")) {
+            floaterRadius = std::max(0, result["remove-floaters"].as<int>());
+        }
+        if (result.count("lod")) {
+            lod = true;
+        }
+        if (result.count("tsdf")) {
+            tsdfVoxelFactor = result["tsdf"].as<float>();
+        }
+        if (result.count("min-confidence")) {
+            minConfidence = result["min-confidence"].as<float>();
+            if (minConfidence < 0 || minConfidence > 1) {
+                printf("Error: --min-confidence should be between 0 and 1 \n");
+                std::cout << options.help() << std::endl;
+                exit(0);
+            }
+        }
+        knnNeighbors = std::max(1, result["knn"].as<int>());
+        if (result.count("remove-outliers")) {
+            outlierStdRatio = result["remove-outliers"].as<float>();
+        }
+        if (result.count("knn-scales")) {
+            knnScales = true;
+        }
+        if (result.count("multiview-color")) {
+            multiViewColor = true;
+        }
+        if (result.count("plan")) {
+            plan = true;
+            planPath = result["plan"].as<std::string>();
+        }
+        if (result.count("calibration")) {
+            std::vector<float> values = result["calibration"].as<std::vector<float>>();
+            if (values.size() != 3 || *std::min_element(values.begin(), values.end()) <= 0) {
+                printf("Error: --calibration should be 3 positive numbers <load ns>,<sweep ns>,<splat ns> \n");
+                std::cout << options.help() << std::endl;
+                exit(0);
+            }
+            calibration.loadNs = values[0];
+            calibration.sweepNs = values[1];
+            calibration.splatNs = values[2];
+            calibrated = true;
+        }
+        if (result.count("sh1")) {
+            multiViewColor = true;
+            sh1 = true;
+        }
+        if (result.count("cpu-splats")) {
+            cpuSplats = true;
+        }
+        if (result.count("save-depth")) {
+            saveDepthPath = result["save-depth"].as<std::string>();
+            if (saveDepthPath.empty() || saveDepthPath.back() != '/') saveDepthPath += "/";
+        }
+        if (result.count("host-depth")) {
+            hostDepthPath = result["host-depth"].as<std::string>();
+            if (hostDepthPath.empty() || hostDepthPath.back() != '/') hostDepthPath += "/";
+            // these read textures of the GPU
+            if (adaptiveSampling || targetNrSplats > 0 || tsdfVoxelFactor > 0 || !masksPath.empty() || !saveDepthPath.empty()) {
+                printf("Error: --host-depth does not support --sampling adaptive, --target-splats, --tsdf, --masks or --save-depth \n");
+                exit(0);
+            }
+            cpuSplats = true;
+        }
+        if (result.count("merge")) {
+            mergeCellFactor = result["merge"].as<float>();
+        }
+        if (result.count("shaders")) {
+            shadersPath = result["shaders"].as<std::string>();
+            if (shadersPath.empty() || (shadersPath.back() != '/' && shadersPath.back() != '\\')) shadersPath += '/';
+        }
+        if (result.count("program-cache")) {
+            programCacheFolder = result["program-cache"].as<std::string>();
+            if (programCacheFolder == "off") programCacheFolder = "";
+        }
         
         if (undistortedPath.size() < 1 || undistortedPath.compare(undistortedPath.size() - 1, 1, "/") != 0) {
             printf("Error: source path should end in / \n");
@@ -79,6 +323,29 @@ public:
             printf("Eval       : %s\n", eval ? "true" : "false");
             printf("Gui        : %s\n", headless ? "false" : "true");
             printf("Verbose    : %s\n", verbose ? "true" : "false");
+            printf("Sampling   : %s\n", adaptiveSampling ? "adaptive" : "uniform");
+            printf("Merge      : %f\n", mergeCellFactor);
+            printf("Target     : %d splats\n", targetNrSplats);
+            printf("Format     : %s%s\n", SplatWriter::Extension(format).c_str(), quantize ? " (quantized)" : "");
+            printf("Cost       : %s\n", result["cost"].as<std::string>().c_str());
+            printf("Precision  : %s\n", comparePrecision ? "compare" : halfFloat ? "half" : "full");
+            printf("Tiles      : %s\n", tileSize > 0 ? std::to_string(tileSize).c_str() : "automatic");
+            printf("Roi        : %s\n", autoRoi ? "auto" : roi.enabled ? "box" : "false");
+            printf("Masks      : %s\n", masksPath.empty() ? "false" : masksPath.c_str());
+            printf("Depth range: percentiles %.1f - %.1f, %s layers\n", depthPercentiles.x, depthPercentiles.y, histogramLayers ? "histogram" : "quadratic");
+            printf("Depth prior: %s\n", priorBand > 0 ? ("+-" + std::to_string(priorBand) + " layers").c_str() : "false");
+            printf("Floaters   : radius %d\n", floaterRadius);
+            printf("Lod        : %s\n", lod ? "true" : "false");
+            printf("Tsdf       : %f\n", tsdfVoxelFactor);
+            printf("Confidence : at least %f\n", minConfidence);
+            printf("Knn        : k = %d, outlier ratio = %f, scales = %s\n", knnNeighbors, outlierStdRatio, knnScales ? "true" : "false");
+            printf("Color      : %s%s\n", multiViewColor ? "multi-view" : "key view", sh1 ? " + SH degree 1" : "");
+            printf("Cpu splats : %s\n", cpuSplats ? "true" : "false");
+            printf("Save depth : %s\n", saveDepthPath.empty() ? "false" : saveDepthPath.c_str());
+            printf("Host depth : %s\n", hostDepthPath.empty() ? "false" : hostDepthPath.c_str());
+            printf("Shaders    : %s\n", shadersPath.empty() ? "embedded" : shadersPath.c_str());
+            printf("Prog. cache: %s\n", programCacheFolder.empty() ? "off" : programCacheFolder.c_str());
+            printf("Plan       : %s\n", plan ? (planPath.empty() ? "text" : planPath.c_str()) : "false");
         }
 	}
 };
@@ -98,36 +365,184 @@ int main(int argc, char** argv) {
     SfmPoints sfmPoints(sparse0Path + "points3D.bin");
     if (!intrinsics.Init()) return -1;
     if (!extrinsics.Init()) return -1;
+    sfmPoints.nearPercentile = options.depthPercentiles.x;
+    sfmPoints.farPercentile = options.depthPercentiles.y;
     if (!sfmPoints.Init(extrinsics)) return -1;
+    if (options.autoRoi && !RegionOfInterest::Estimate(sfmPoints, options.roi)) {
+        printf("Error: too few SfM points to estimate the region of interest\n");
+        return -1;
+    }
+    if (options.roi.enabled) {
+        options.roi.Print();
+    }
 
-    // Init GLFW and glad
-    // let the gui already determine the window size
-    Gui gui(intrinsics, extrinsics, MultiViewStereo::nrLayers);
-    gui.InitWindow(options.headless);
-    
     // choose the key views for which to estimate the depth map, which in turn are used to create gaussian splats
     KeyViewsCalculator keyViewsCalculator(intrinsics, extrinsics, options.verbose);
     keyViewsCalculator.EstimateOverlapBetweenCameras();
     if (!keyViewsCalculator.CalculateKeyCameras()) return -1; 
     keyViewsCalculator.CalculateMvsNeighbors();
     keyViewsCalculator.Cleanup();
+    JobPlanner planner(intrinsics, extrinsics, keyViewsCalculator.keyCameras, keyViewsCalculator.mvsNeighbors);
+    planner.calibration = options.calibration;
+    planner.calibrated = options.calibrated;
+    planner.adaptiveSampling = options.adaptiveSampling;
+
+    TexController::getInstance().halfFloat = options.halfFloat;
+
+    // dry run: estimate the cost of the rest without a GL context
+    if (options.plan) {
+        std::vector<int>& keyCameras = keyViewsCalculator.keyCameras;
+        MultiViewStereo mvs(intrinsics, extrinsics, keyViewsCalculator.mvsNeighbors, keyCameras, sfmPoints.depthRanges);
+        mvs.tileSize = options.tileSize;
+        glm::ivec2 sweepSize;
+        int nrTiles = mvs.PlanTiles(sweepSize);
+        int nrImages = TexController::ImagesToLoad(keyCameras, keyViewsCalculator.mvsNeighbors).size();
+        std::vector<std::pair<std::string, int64_t>> memory = TexController::EstimateMemory(intrinsics, nrImages, keyCameras.size(), keyViewsCalculator.nrMvsNeighbors,
+            MultiViewStereo::nrLayers, sweepSize, MultiViewStereo::nrVec3, options.halfFloat, options.cost != MultiViewStereo::MatchingCost::Color,
+            options.halfFloat && MultiViewStereo::HalfFeatures(options.cost), !options.masksPath.empty() || intrinsics.NeedsRemap(), options.priorBand > 0, options.adaptiveSampling);
+
+        int64_t nrSfmSplats = 0;
+        for (int& id : extrinsics.imageIds) {
+            for (glm::vec3& point : sfmPoints.points[id]) {
+                if (!options.roi.enabled || options.roi.Contains(point)) nrSfmSplats++;
+            }
+        }
+        int width = intrinsics.width;
+        int height = intrinsics.height;
+        int nrKeyCams = keyCameras.size();
+        float tfSubdivisions = FrameBufferController::ChooseTfSubdivisions(width, height, nrKeyCams, FrameBufferController::getInstance().tfSubdivisions);
+        int64_t targetNrMvsSplats = options.targetNrSplats - nrSfmSplats;
+        if (options.targetNrSplats > 0 && targetNrMvsSplats > 0) {
+            // like SplatGenerator::ExtractTargetNrSplats, with expectedSurvivors of the key view pixels surviving masking
+            double nrSurvivors = static_cast<double>(width) * height * nrKeyCams * FrameBufferController::expectedSurvivors;
+            tfSubdivisions = std::max(0.25f, static_cast<float>(std::sqrt(nrSurvivors / (1.05 * targetNrMvsSplats))));
+        }
+        tfSubdivisions = std::max(tfSubdivisions, FrameBufferController::MinTfSubdivisions(width, height));
+        // the adaptive sampler places at most as many probes as this uniform grid, and only as many as it would keep after masking
+        int64_t nrProbes = static_cast<int64_t>(width / tfSubdivisions) * static_cast<int64_t>(height / tfSubdivisions);
+        memory.push_back({ "transform feedback buffers", nrProbes * FrameBufferController::tfBytesPerProbe });
+        int64_t nrMvsSplats = static_cast<int64_t>(nrProbes * nrKeyCams * FrameBufferController::expectedSurvivors);
+        if (options.targetNrSplats > 0) {
+            nrMvsSplats = std::min(nrMvsSplats, std::max<int64_t>(0, targetNrMvsSplats));
+        }
+
+        if (options.planPath.empty()) {
+            planner.Write(stdout, /*json*/ false, nrTiles, sweepSize, memory, tfSubdivisions, nrMvsSplats, nrSfmSplats);
+            return 0;
+        }
+        FILE* file = fopen(options.planPath.c_str(), "w");
+        if (!file) {
+            printf("Error: could not write %s\n", options.planPath.c_str());
+            return -1;
+        }
+        planner.Write(file, /*json*/ true, nrTiles, sweepSize, memory, tfSubdivisions, nrMvsSplats, nrSfmSplats);
+        fclose(file);
+        printf("Wrote the plan to %s\n", options.planPath.c_str());
+        return 0;
+    }
+
+    // the settings of the splats, for a normal run and for --host-depth
+    std::string splatsPath = sparse0Path + "points3D_mvs" + SplatWriter::Extension(options.format);
+    auto configure = [&](SplatGenerator& splatGenerator) {
+        splatGenerator.cpu = options.cpuSplats;
+        splatGenerator.mergeCellFactor = options.mergeCellFactor;
+        splatGenerator.adaptiveSampling = options.adaptiveSampling;
+        splatGenerator.targetNrSplats = options.targetNrSplats;
+        splatGenerator.lod = options.lod;
+        splatGenerator.tsdfVoxelFactor = options.tsdfVoxelFactor;
+        splatGenerator.knnNeighbors = options.knnNeighbors;
+        splatGenerator.minConfidence = options.minConfidence;
+        splatGenerator.outlierStdRatio = options.outlierStdRatio;
+        splatGenerator.knnScales = options.knnScales;
+        splatGenerator.multiViewColor = options.multiViewColor;
+        splatGenerator.fitSh1 = options.sh1;
+        splatGenerator.roi = options.roi;
+        splatGenerator.writer.format = options.format;
+        splatGenerator.writer.quantize = options.quantize;
+        splatGenerator.writer.sh1 = options.sh1;
+    };
+
+    // depth maps from elsewhere: the consistency check and the splats on the CPU threads, without a GL context
+    if (!options.hostDepthPath.empty()) {
+        std::vector<int>& keyCameras = keyViewsCalculator.keyCameras;
+        SplatGenerator splatGenerator(intrinsics, extrinsics, keyViewsCalculator.mvsNeighbors, keyCameras, {});
+        configure(splatGenerator);
+        if (!splatGenerator.LoadHostViews(options.hostDepthPath, imagesPath, options.multiViewColor)) return -1;
+        splatGenerator.MaskAwayUnnecessaryPixels();
+        float tfSubdivisions = FrameBufferController::ChooseTfSubdivisions(intrinsics.width, intrinsics.height, keyCameras.size(), FrameBufferController::getInstance().tfSubdivisions);
+        splatGenerator.WriteToFile(splatsPath, tfSubdivisions, sfmPoints);
+        return 0;
+    }
+
+    // Init GLFW and glad
+    Gui gui(intrinsics, extrinsics, MultiViewStereo::nrLayers);
+    gui.InitWindow(options.headless);
 
     // Setup some OpenGL helpers
     ShaderController& shaders = ShaderController::getInstance();
     TexController& textures = TexController::getInstance();
     FrameBufferController& framebuffers = FrameBufferController::getInstance();
-    if (!shaders.Init(intrinsics, gui.width_g, gui.height_g, gui.scale_g)) return false;
+    shaders.shadersPath = options.shadersPath;
+    if (!shaders.Init(intrinsics, gui.width_g, gui.height_g, gui.scale_g, options.programCacheFolder)) return false;
+    auto loadStart = std::chrono::steady_clock::now();
     if (!textures.Init(intrinsics, extrinsics, keyViewsCalculator.keyCameras, keyViewsCalculator.mvsNeighbors, imagesPath, keyViewsCalculator.nrMvsNeighbors, MultiViewStereo::nrLayers)) return false;
+    if (!options.masksPath.empty() && !textures.LoadUserMasks(extrinsics, options.undistortedPath + options.masksPath)) return false;
     if (!framebuffers.Init(sfmPoints, intrinsics.width, intrinsics.height, keyViewsCalculator.keyCameras.size())) return false;
+    auto sweepStart = std::chrono::steady_clock::now();
 
     // MVS
     MultiViewStereo mvs(intrinsics, extrinsics, keyViewsCalculator.mvsNeighbors, keyViewsCalculator.keyCameras, sfmPoints.depthRanges);
-    mvs.CalculateRoughDepth();
+    mvs.cost = options.cost;
+    mvs.tileSize = options.tileSize;
+    mvs.histogramLayers = options.histogramLayers;
+    mvs.depthHistograms = sfmPoints.depthHistograms;
+    mvs.depthPrior = options.priorBand > 0;
+    mvs.priorBand = options.priorBand;
+    mvs.roi = options.roi;
+    auto seconds = [](std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) { return std::chrono::duration<double>(to - from).count(); };
+    double compareSeconds = 0; // the reference sweep and the comparison of --precision compare, which the calibration leaves out
+    if (options.comparePrecision) {
+        // the reference in full precision, then the sweep that is used
+        auto referenceStart = std::chrono::steady_clock::now();
+        PrecisionReport report(intrinsics, extrinsics, keyViewsCalculator.keyCameras);
+        textures.halfFloat = false;
+        textures.ReallocateDepthMaps();
+        if (!mvs.CalculateRoughDepth()) return false;
+        report.ReadReference();
+        textures.halfFloat = true;
+        textures.ReallocateDepthMaps();
+        compareSeconds = seconds(referenceStart, std::chrono::steady_clock::now());
+        if (!mvs.CalculateRoughDepth()) return false;
+        glFinish();
+        auto compareStart = std::chrono::steady_clock::now();
+        report.Compare(mvs.layerDepths);
+        compareSeconds += seconds(compareStart, std::chrono::steady_clock::now());
+    }
+    else {
+        if (!mvs.CalculateRoughDepth()) return false;
+    }
+    glFinish();
+    auto splatStart = std::chrono::steady_clock::now();
 
     // Mask off bad depth map pixels
-    SplatGenerator splatGenerator(intrinsics, extrinsics, keyViewsCalculator.keyCameras);
+    if (options.floaterRadius > 0) {
+        DepthFilter depthFilter(options.floaterRadius);
+        depthFilter.MaskFloaters(intrinsics, keyViewsCalculator.keyCameras, mvs.layerDepths);
+    }
+    SplatGenerator splatGenerator(intrinsics, extrinsics, keyViewsCalculator.mvsNeighbors, keyViewsCalculator.keyCameras, mvs.depthBounds);
+    configure(splatGenerator);
+    if (!options.saveDepthPath.empty() && !splatGenerator.SaveDepthMaps(options.saveDepthPath)) return false;
     splatGenerator.MaskAwayUnnecessaryPixels();
-    splatGenerator.WriteToFile(sparse0Path + "points3D_mvs.bin", framebuffers.tfSubdivisions, sfmPoints);
+    splatGenerator.WriteToFile(splatsPath, framebuffers.tfSubdivisions, sfmPoints);
+
+    // how long each phase of --plan took on this machine
+    auto end = std::chrono::steady_clock::now();
+    double loadSeconds = seconds(loadStart, sweepStart);
+    double sweepSeconds = seconds(sweepStart, splatStart) - compareSeconds;
+    double splatSeconds = seconds(splatStart, end);
+    JobPlanner::Calibration measured = planner.Calibrate(loadSeconds, sweepSeconds, splatSeconds, mvs.sweepTiles, mvs.sweepTileSize);
+    printf("Timing: loading %.2f s, plane sweep %.2f s, splats %.2f s (for --plan: --calibration %.4g,%.4g,%.4g)\n",
+        loadSeconds, sweepSeconds, splatSeconds, measured.loadNs, measured.sweepNs, measured.splatNs);
 
     // visualize depth maps etc.
     if (!options.headless) {
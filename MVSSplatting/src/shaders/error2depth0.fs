@@ -3,9 +3,10 @@ layout(location = 0) out vec3 FragOut;
 
 in vec2 TexCoords;
 
-uniform int nrTextures; 
+// compiled per chunk of layers (see ShaderController::ErrorToDepthShader0), with #define LAYER_CHUNK: its nr of layers
+const int nrTextures = LAYER_CHUNK;
 uniform int offset; 
-uniform sampler2D errorTex[32]; 
+uniform sampler2D errorTex[LAYER_CHUNK]; 
 
 // Outputs a vec3, which is actually:
 //  - float (actually int) : the best layer
@@ -15,7 +16,7 @@ void main()
 {
 	float lowest_error = 9999;
 	int best_layer = 0;
-	float errors[32];
+	float errors[LAYER_CHUNK];
     for (int i = 0; i < nrTextures; i++) {
         errors[i] = texture(errorTex[i], TexCoords).r;
 		if (errors[i] < lowest_error){
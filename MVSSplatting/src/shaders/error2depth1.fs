@@ -1,19 +1,48 @@
 #version 330 core
 layout(location = 0) out float FragDepth;
 layout(location = 1) out float FragMask;
+layout(location = 2) out float FragConfidence;
 
 in vec2 TexCoords;
 
-uniform vec2 layer_to_depth;
-uniform int nrTextures; 
-uniform sampler2D inputTex[10]; 
+// depth of each layer (see MultiViewStereo::layerDepths)
+const int maxLayers = 64;
+uniform float layerDepths[maxLayers];
+uniform int nrLayers;
+// compiled per nr of chunks of layers (see ShaderController::ErrorToDepthShader1), with #define NR_CHUNKS
+const int nrTextures = NR_CHUNKS;
+uniform sampler2D inputTex[NR_CHUNKS]; 
+
+// Depth prior (see sum_radius2.fs). After the sweep around the prior (priorMode 1), a match at the edge of the band
+// may be a slope towards a better layer outside it, and is masked off, so that the 2nd sweep (priorMode 2) tries
+// all layers. That 2nd sweep only writes the pixels it swept again.
+uniform int priorMode;
+uniform sampler2D priorTex;
+uniform int priorBand;
+const float noPrior = 1e29f;
+const float skipped = 9999;
+
+// fractional layer of a depth, piecewise linear between the layer depths
+float DepthToLayer(float depth)
+{
+	if (depth <= layerDepths[0]) return 0.0f;
+	if (depth >= layerDepths[nrLayers - 1]) return float(nrLayers - 1);
+	int lower = 0;
+	int upper = nrLayers - 1;
+	while (upper - lower > 1) {
+		int middle = (lower + upper) / 2;
+		if (layerDepths[middle] <= depth) lower = middle;
+		else upper = middle;
+	}
+	return lower + (depth - layerDepths[lower]) / (layerDepths[upper] - layerDepths[lower]);
+}
 
 void main()
 {
 	float lowest_error = 9999;
 	int best_layer = 0;
-	float errors[10];
-	float nr_low_error_layers[10];
+	float errors[NR_CHUNKS];
+	float nr_low_error_layers[NR_CHUNKS];
     for (int i = 0; i < nrTextures; i++) {
 		// each pixel in inputTex[i] contains:
 		//  - float (actually int) : the best layer
@@ -28,6 +57,8 @@ void main()
 		}
     }
 	
+	if (priorMode == 2 && lowest_error >= skipped) discard;
+	
 	// approximately estimate nr_low_error_layers
 	float nr_low_error_layers_total = 0;
 	float thresh_inv = 100; // = 1/0.01f
@@ -38,7 +69,24 @@ void main()
 		nr_low_error_layers_total +=  max(0, 1.0f - (errors[i] - lowest_error)  * thresh_inv) * nr_low_error_layers[i];
 	}
 	
-	// layer to depth
-	FragDepth = layer_to_depth.x * (best_layer * best_layer) + layer_to_depth.y; 
-	FragMask = (nr_low_error_layers_total > 20 || lowest_error > 0.1f)? 0 : 1;
+	// more than 20 of the 50 layers close to the lowest error is ambiguous, or the same fraction of a band around the prior
+	float ambiguous = 20;
+	bool edgeOfBand = false;
+	if (priorMode == 1) {
+		float prior = texelFetch(priorTex, ivec2(gl_FragCoord.xy), 0).r;
+		if (prior < noPrior) {
+			float priorLayer = DepthToLayer(prior);
+			ambiguous = 20.0f * (2 * priorBand + 1) / nrLayers;
+			edgeOfBand = (best_layer < priorLayer - priorBand + 1 && best_layer > 0) || (best_layer > priorLayer + priorBand - 1 && best_layer < nrLayers - 1);
+		}
+	}
+	
+	// layer to depth, 0 (no depth) if the sweep skipped the pixel on every layer: masked off by the user mask, or
+	// its ray misses the region of interest (see InSweep in sum_radius2.fs)
+	FragDepth = lowest_error >= skipped ? 0.0f : layerDepths[best_layer];
+	FragMask = (nr_low_error_layers_total > ambiguous || lowest_error > 0.1f || edgeOfBand)? 0 : 1;
+	
+	// the same criteria as the mask, but continuous: 1 for a unique, perfect match, 0 at the mask thresholds
+	FragConfidence = clamp(1.0f - lowest_error * 10.0f, 0.0f, 1.0f) * clamp(1.0f - nr_low_error_layers_total / ambiguous, 0.0f, 1.0f);
+	if (edgeOfBand) FragConfidence = 0;
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+#version 330 core
+layout(location = 0) out vec4 FragFeatures;
+
+in vec2 TexCoords;
+
+uniform float width;
+uniform float height;
+uniform int cost; // 1: census, 2: NCC, 3: gray + gradient (see MultiViewStereo::MatchingCost)
+
+uniform sampler2D colorTex;
+
+const vec3 luminance = vec3(0.299f, 0.587f, 0.114f);
+const int censusRadius = 2; // 5 x 5 window, 24 bits
+
+float Gray(ivec2 pixel) {
+	pixel = clamp(pixel, ivec2(0), ivec2(width, height) - 1);
+	return dot(texelFetch(colorTex, pixel, 0).rgb, luminance);
+}
+
+// Per image features for the matching costs of quad_depth_error.fs, calculated once per image:
+//  - census  : (census code as an exact integer, gray, 0, 0)
+//  - NCC     : (gray, 0, 0, 0), sum_radius2.fs takes the statistics over the taps visible in each neighbor
+//  - gradient: (gray, d gray / dx, d gray / dy, 0)
+void main()
+{
+	ivec2 pixel = ivec2(TexCoords * vec2(width, height));
+	float gray = Gray(pixel);
+
+	if (cost == 1) {
+		// 1 bit per neighbor that is darker than the center
+		uint code = 0u;
+		for (int y = -censusRadius; y <= censusRadius; y++) {
+			for (int x = -censusRadius; x <= censusRadius; x++) {
+				if (x == 0 && y == 0) continue;
+				code = (code << 1u) | (Gray(pixel + ivec2(x, y)) < gray ? 1u : 0u);
+			}
+		}
+		FragFeatures = vec4(float(code), gray, 0, 0);
+	}
+	else if (cost == 2) {
+		FragFeatures = vec4(gray, 0, 0, 0);
+	}
+	else {
+		float gx = 0.5f * (Gray(pixel + ivec2(1, 0)) - Gray(pixel - ivec2(1, 0)));
+		float gy = 0.5f * (Gray(pixel + ivec2(0, 1)) - Gray(pixel - ivec2(0, 1)));
+		FragFeatures = vec4(gray, gx, gy, 0);
+	}
+}
@@ -0,0 +1,40 @@
+#version 330 core
+layout(location = 0) out vec2 FragImportance;
+
+in vec2 TexCoords;
+
+uniform float width;
+uniform float height;
+
+uniform sampler2D colorTex;
+uniform sampler2D depthTex;
+uniform sampler2D maskTex;
+
+// user mask of the key view (see quad_depth_error.fs): no probes on masked pixels
+uniform int useUserMasks;
+uniform sampler2D userMaskTex;
+
+// Outputs a vec2:
+//  - float : 1 if the pixel will be turned into a splat, otherwise 0
+//  - float : how much detail there is around the pixel (color gradient + depth discontinuities), 0 if masked off
+void main()
+{
+	float mask = texture(maskTex, TexCoords).x > 0.5f ? 1.0f : 0.0f;
+	if (useUserMasks == 1 && texture(userMaskTex, TexCoords).r < 0.5f) mask = 0.0f;
+	vec2 dx = vec2(1.0f / width, 0);
+	vec2 dy = vec2(0, 1.0f / height);
+
+	// color gradient (central differences of the luminance)
+	vec3 luminance = vec3(0.299f, 0.587f, 0.114f);
+	float gx = dot(texture(colorTex, TexCoords + dx).rgb - texture(colorTex, TexCoords - dx).rgb, luminance);
+	float gy = dot(texture(colorTex, TexCoords + dy).rgb - texture(colorTex, TexCoords - dy).rgb, luminance);
+	float gradient = min(1.0f, 0.5f * length(vec2(gx, gy)) * 10.0f);
+
+	// depth discontinuities, relative to the depth of the pixel
+	float depth = texture(depthTex, TexCoords).x;
+	float jump_x = abs(texture(depthTex, TexCoords + dx).x - texture(depthTex, TexCoords - dx).x);
+	float jump_y = abs(texture(depthTex, TexCoords + dy).x - texture(depthTex, TexCoords - dy).x);
+	float discontinuity = min(1.0f, max(jump_x, jump_y) / max(depth, 1e-6f) * 10.0f);
+
+	FragImportance = vec2(mask, mask * (gradient + discontinuity));
+}
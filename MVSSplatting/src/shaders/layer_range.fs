@@ -0,0 +1,67 @@
+#version 330 core
+layout(location = 0) out vec2 FragRange;
+
+// 1 fragment per block of layerBlock x layerBlock pixels of the key view (see MultiViewStereo::RenderLayerRange)
+
+uniform float width;
+uniform float height;
+uniform int layerBlock;
+uniform int apron; // the radius of the window of sum_radius2.fs
+
+// like sum_radius2.fs: priorMode 1 sweeps the layers within priorBand of the prior (all where there is none),
+// priorMode 2 sweeps all layers, but only for the pixels with a prior whose sweep around it found no good match
+uniform int priorMode;
+uniform sampler2D priorTex; // reprojected depth, >= noPrior where there is none
+uniform sampler2D maskTex;  // mask after priorMode 1
+uniform int priorBand;
+
+// depth of each layer (see MultiViewStereo::layerDepths)
+const int maxLayers = 64;
+uniform float layerDepths[maxLayers];
+uniform int nrLayers;
+
+const float noPrior = 1e29f;
+
+// fractional layer of a depth, piecewise linear between the layer depths (like sum_radius2.fs)
+float DepthToLayer(float depth)
+{
+	if (depth <= layerDepths[0]) return 0.0f;
+	if (depth >= layerDepths[nrLayers - 1]) return float(nrLayers - 1);
+	int lower = 0;
+	int upper = nrLayers - 1;
+	while (upper - lower > 1) {
+		int middle = (lower + upper) / 2;
+		if (layerDepths[middle] <= depth) lower = middle;
+		else upper = middle;
+	}
+	return lower + (depth - layerDepths[lower]) / (layerDepths[upper] - layerDepths[lower]);
+}
+
+// The range of layers for which quad_depth_error.fs calculates the errors of the pixels in this block: the union of
+// the layers that sum_radius2.fs sweeps for the pixels whose window reaches into the block. Those windows read the
+// errors within apron pixels of the block (or the nearest pixel of the image, which is closer), so the block is
+// extended by the apron on each side. An empty range is (nrLayers, -1).
+void main()
+{
+	ivec2 size = ivec2(width, height);
+	ivec2 first = max(ivec2(gl_FragCoord.xy) * layerBlock - apron, ivec2(0));
+	ivec2 last = min(ivec2(gl_FragCoord.xy) * layerBlock + layerBlock - 1 + apron, size - 1);
+	float lowest = float(nrLayers);
+	float highest = -1.0f;
+	for (int y = first.y; y <= last.y; y++) {
+		for (int x = first.x; x <= last.x; x++) {
+			float prior = texelFetch(priorTex, ivec2(x, y), 0).r;
+			bool all = priorMode == 1 ? prior >= noPrior : prior < noPrior && texelFetch(maskTex, ivec2(x, y), 0).r < 0.5f;
+			if (all) {
+				FragRange = vec2(0, nrLayers - 1);
+				return;
+			}
+			if (priorMode == 1) {
+				float priorLayer = DepthToLayer(prior);
+				lowest = min(lowest, floor(priorLayer - float(priorBand)));
+				highest = max(highest, ceil(priorLayer + float(priorBand)));
+			}
+		}
+	}
+	FragRange = vec2(lowest, highest);
+}
@@ -1,76 +1,97 @@
 #version 330 core
-layout(location = 0) out float FragMask;
+layout(location = 0) out float FragMaskA;
+layout(location = 1) out float FragMaskB;
 
 in vec2 TexCoords;
 
-// input camera parameters
+// camera parameters (shared by both cameras)
 uniform float width;
 uniform float height;
-uniform mat4 model;
 uniform vec2 focal;   // for perspective unprojection
 uniform vec2 pp;      // for perspective unprojection
 
-// output camera parameters
-uniform mat4 view;
+// the pair of cameras
+uniform mat4 modelA;
+uniform mat4 viewA;
+uniform mat4 modelB;
+uniform mat4 viewB;
 
+uniform sampler2D colorTexA;
+uniform sampler2D depthTexA;
+uniform sampler2D colorTexB;
+uniform sampler2D depthTexB;
 
-uniform sampler2D mainColorTex;
-uniform sampler2D mainDepthTex;
-uniform sampler2D neighborColorTex;
-uniform sampler2D neighborDepthTex;
+// user masks (see TexController::LoadUserMasks): the depth of a masked pixel is not the scene, so it cannot reject
+// another pixel. Masked pixels have no MVS mask anymore, so their own output does not matter.
+uniform int useUserMasks;
+uniform sampler2D userMaskTexA;
+uniform sampler2D userMaskTexB;
 
 
-void main()
+// Project the current pixel of the 'from' camera to the 'to' camera.
+// Returns 0 if the point from the 'from' camera does not match well
+// with the corresponding point of the 'to' camera, otherwise 1.
+// The outputs are multiplied with the masks (blending), so 1 leaves the mask untouched.
+float CheckProjectedPixel(mat4 model, mat4 view, sampler2D fromColorTex, sampler2D fromDepthTex, sampler2D toColorTex, sampler2D toDepthTex,
+	sampler2D fromMaskTex, sampler2D toMaskTex)
 {
-	// Project neighbor to main camera
-	// -------------------------------
-	
-	float depth = texture(neighborDepthTex, TexCoords).x;
-	
+	if (useUserMasks == 1 && textureLod(fromMaskTex, TexCoords, 0).r < 0.5f) {
+		return 1.0f;
+	}
+
+	float depth = texture(fromDepthTex, TexCoords).x;
+
 	// unproject to find the worldPosition of the current pixel
 	vec4 worldPosition;
 	// perspective unprojection
 	float x = (TexCoords.x * width - pp.x) / focal.x * depth;
 	float y = (TexCoords.y * height - (pp.y + 2.0f * (height * 0.5f - pp.y))) / focal.y * depth;
-	
+
 	vec4 localPosition = vec4(x,y,depth,1.0f);
 	worldPosition = model * localPosition;
 	worldPosition = worldPosition / worldPosition.w;
-	
-	// project onto main camera
+
+	// project onto the 'to' camera
 	vec4 viewPosition = view * worldPosition;
 	viewPosition = viewPosition / viewPosition.w;
 	if(viewPosition.z <= 0){
-		discard;
+		return 1.0f;
 	}
-	
+
 	float u = viewPosition.x / viewPosition.z * focal.x + pp.x;
 	float v = viewPosition.y / viewPosition.z * focal.y + (pp.y + 2.0f * (height * 0.5f - pp.y));
-	vec2 screenTexMain = vec2(u / width, v / height);
-	
-	// discard if outside of image bounds
-	if(screenTexMain.x < 0 || screenTexMain.x > 1 || screenTexMain.y < 0 || screenTexMain.y > 1 ){
-		discard;
+	vec2 screenTexTo = vec2(u / width, v / height);
+
+	// keep if outside of image bounds
+	if(screenTexTo.x < 0 || screenTexTo.x > 1 || screenTexTo.y < 0 || screenTexTo.y > 1 ){
+		return 1.0f;
+	}
+
+	if (useUserMasks == 1 && textureLod(toMaskTex, screenTexTo, 0).r < 0.5f) {
+		return 1.0f;
 	}
-	
-	// Set FragMask = 0 if the point from the neighbor camera does not match well 
-	// with the corresponding point of the main camera.
-	// --------------------------------------------------------------------------
-	vec4 color_main = texture(mainColorTex, screenTexMain);
-	vec4 color_neighbor = texture(neighborColorTex, TexCoords);
-	float view_depth_main = texture(mainDepthTex, screenTexMain).x;
-	float view_depth_neighbor = viewPosition.z;
-	
+
+	vec4 color_to = texture(toColorTex, screenTexTo);
+	vec4 color_from = texture(fromColorTex, TexCoords);
+	float view_depth_to = texture(toDepthTex, screenTexTo).x;
+	float view_depth_from = viewPosition.z;
+
 	// depth test
-	if (view_depth_neighbor > view_depth_main * 0.95f){
-		discard;
+	if (view_depth_from > view_depth_to * 0.95f){
+		return 1.0f;
 	}
-	
-	// if color is pretty similar, discard
-	float color_diff = length(color_neighbor - color_main);
+
+	// if color is pretty similar, keep
+	float color_diff = length(color_from - color_to);
 	if(color_diff < 0.1f) {
-		discard;
+		return 1.0f;
 	}
-	
-	FragMask = 0;
+
+	return 0.0f;
+}
+
+void main()
+{
+	FragMaskA = CheckProjectedPixel(modelA, viewB, colorTexA, depthTexA, colorTexB, depthTexB, userMaskTexA, userMaskTexB);
+	FragMaskB = CheckProjectedPixel(modelB, viewA, colorTexB, depthTexB, colorTexA, depthTexA, userMaskTexB, userMaskTexA);
 }
@@ -0,0 +1,19 @@
+#version 330 core
+layout(location = 0) out float FragOut;
+
+in vec2 TexCoords;
+
+uniform sampler2D priorTex; // reprojected depth of earlier key views, >= noPrior where there is none
+uniform sampler2D maskTex;  // mask of the sweep in the band around the prior
+uniform int useUserMasks;
+uniform sampler2D userMaskTex;
+
+const float noPrior = 1e29f;
+
+// only keeps the pixels that had a prior, but found no good match near it, for an occlusion query
+void main()
+{
+	if (texture(priorTex, TexCoords).r >= noPrior || texture(maskTex, TexCoords).r >= 0.5f) discard;
+	if (useUserMasks == 1 && textureLod(userMaskTex, TexCoords, 0).r < 0.5f) discard;
+	FragOut = 1;
+}
@@ -18,9 +18,81 @@ uniform float depth;
 uniform sampler2D mainColorTex;
 uniform sampler2D neighborColorTex;
 
+// 0: RGB difference, otherwise the per image features of image_features.fs are compared
+// 1: census (Hamming distance), 2: NCC, 3: truncated gray + gradient difference
+// NCC needs a whole window, so for NCC this shader outputs the gray of the neighbor (-1 outside of it), and sum_radius2.fs
+// calculates the NCC of the window.
+uniform int cost;
+uniform sampler2D mainFeatureTex;
+uniform sampler2D neighborFeatureTex;
+
+// user masks (see TexController::LoadUserMasks): 0 = ignore the pixel. A pixel whose whole block of 32 x 32 pixels
+// (mip level maskLod, interpolated with the neighboring blocks) is masked is not needed by any window of sum_radius2.fs.
+// The 8-bit mip rounds a block with a few kept pixels down to 0, so it is only an early-out: the pixel itself must
+// also be masked at level 0 to be skipped.
+// A masked pixel in the neighbor does not show the scene, like a pixel outside of it.
+uniform int useUserMasks;
+uniform sampler2D mainMaskTex;
+uniform sampler2D neighborMaskTex;
+const float maskLod = 5.0f;
+
+// with a depth prior (see layer_range.fs), only the layers that some window of sum_radius2.fs needs at this pixel
+uniform int useLayerRange;
+uniform sampler2D layerRangeTex;
+uniform int layerBlock;
+uniform int layer;
+
+// the errors of all costs are scaled to roughly the range of the RGB difference, for the thresholds of error2depth*.fs
+const float censusScale = 0.5f / 24.0f;
+const float grayTruncation = 0.04f;
+const float gradientTruncation = 0.05f;
+const float gradientWeight = 0.9f;
+
+uint BitCount(uint v) {
+	v = v - ((v >> 1u) & 0x55555555u);
+	v = (v & 0x33333333u) + ((v >> 2u) & 0x33333333u);
+	return (((v + (v >> 4u)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24u;
+}
+
+float MatchingError(vec2 screenTexNeighbor) {
+	if (cost == 1) {
+		ivec2 size = ivec2(width, height);
+		ivec2 pixelNeighbor = clamp(ivec2(screenTexNeighbor * vec2(width, height)), ivec2(0), size - 1);
+		uint codeMain = uint(texelFetch(mainFeatureTex, ivec2(TexCoords * vec2(width, height)), 0).r);
+		uint codeNeighbor = uint(texelFetch(neighborFeatureTex, pixelNeighbor, 0).r);
+		return float(BitCount(codeMain ^ codeNeighbor)) * censusScale;
+	}
+	else if (cost == 2) {
+		return texture(neighborFeatureTex, screenTexNeighbor).r;
+	}
+	else if (cost == 3) {
+		vec3 featuresMain = texture(mainFeatureTex, TexCoords).rgb;
+		vec3 featuresNeighbor = texture(neighborFeatureTex, screenTexNeighbor).rgb;
+		float grayError = min(abs(featuresMain.x - featuresNeighbor.x), grayTruncation) / grayTruncation;
+		float gradientError = min(abs(featuresMain.y - featuresNeighbor.y) + abs(featuresMain.z - featuresNeighbor.z), gradientTruncation) / gradientTruncation;
+		return 0.5f * mix(grayError, gradientError, gradientWeight);
+	}
+	vec4 color_neighbor = texture(neighborColorTex, screenTexNeighbor);
+	vec4 color_main = texture(mainColorTex, TexCoords);
+	return length(color_main.xyz - color_neighbor.xyz);
+}
+
 
 void main()
 {
+	if (useUserMasks == 1 && textureLod(mainMaskTex, TexCoords, maskLod).r == 0 && textureLod(mainMaskTex, TexCoords, 0).r < 0.5f) {
+		FragError = cost == 2 ? -1.0f : 1.0f;
+		return;
+	}
+	if (useLayerRange == 1) {
+		ivec2 pixel = clamp(ivec2(TexCoords * vec2(width, height)), ivec2(0), ivec2(width, height) - 1);
+		vec2 range = texelFetch(layerRangeTex, pixel / layerBlock, 0).rg;
+		if (float(layer) < range.x || float(layer) > range.y) {
+			FragError = cost == 2 ? -1.0f : 1.0f;
+			return;
+		}
+	}
+
 	// unproject to find the worldPosition of the current pixel
 	vec4 worldPosition;
 	// perspective unprojection
@@ -39,18 +111,19 @@ void main()
 		float v = viewPosition.y / viewPosition.z * focal.y + (pp.y + 2.0f * (height * 0.5f - pp.y));
 		vec2 screenTexNeighbor = vec2(u / width, v / height);
 		
-		vec4 color_neighbor = texture(neighborColorTex, screenTexNeighbor);
-		vec4 color_main = texture(mainColorTex, TexCoords);
-		//FragColor = color_neighbor;
-		FragError = length(color_main.xyz - color_neighbor.xyz);
+		if (useUserMasks == 1 && textureLod(neighborMaskTex, screenTexNeighbor, 0).r < 0.5f) {
+			FragError = cost == 2 ? -1.0f : 1.0f;
+			return;
+		}
+		FragError = MatchingError(screenTexNeighbor);
 		
 		// apply a penalty if screenTexNeighbor is outside of image bounds
 		if(screenTexNeighbor.x < 0 || screenTexNeighbor.x > 1 || screenTexNeighbor.y < 0 || screenTexNeighbor.y > 1 ){
-			FragError += 0.01f;
+			FragError = cost == 2 ? -1.0f : FragError + 0.01f;
 		}
 	}
 	else {
-		FragError = 1;
+		FragError = cost == 2 ? -1.0f : 1.0f;
 	}
 	
 	
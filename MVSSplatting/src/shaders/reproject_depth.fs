@@ -0,0 +1,10 @@
+#version 330 core
+layout(location = 0) out float FragDepth;
+
+in float vs_depth;
+
+void main()
+{
+	// the nearest point per pixel is kept by GL_MIN blending
+	FragDepth = vs_depth;
+}
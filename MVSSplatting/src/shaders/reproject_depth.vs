@@ -0,0 +1,43 @@
+// Renders every pixel of a finished depth map as a point in another key view, with its depth in that view,
+// for the depth prior of the plane sweep (see MultiViewStereo::depthPrior)
+
+#version 330 core
+layout (location = 0) in vec2 TexCoords; // input from the VBO, i.e. (u,v) texture coordinates
+
+out float vs_depth;
+
+uniform sampler2D depthTex;
+uniform sampler2D maskTex;
+
+uniform float width;
+uniform float height;
+uniform vec2 focal;
+uniform vec2 pp;
+uniform mat4 model; // of the finished key view
+uniform mat4 view;  // of the key view of the prior
+
+const vec4 culled = vec4(0, 0, 2, 1); // outside the clip volume
+
+void main()
+{
+	float depth = texture(depthTex, TexCoords).x;
+	if (depth <= 0 || texture(maskTex, TexCoords).x < 0.5f) {
+		gl_Position = culled;
+		return;
+	}
+
+	// same unprojection as quad_depth_error.fs
+	float x = (TexCoords.x * width - pp.x) / focal.x * depth;
+	float y = (TexCoords.y * height - (pp.y + 2.0f * (height * 0.5f - pp.y))) / focal.y * depth;
+	vec4 localPosition = view * model * vec4(x, y, depth, 1.0f);
+	if (localPosition.z <= 0) {
+		gl_Position = culled;
+		return;
+	}
+
+	float u = localPosition.x / localPosition.z * focal.x + pp.x;
+	float v = localPosition.y / localPosition.z * focal.y + (pp.y + 2.0f * (height * 0.5f - pp.y));
+	gl_Position = vec4(2.0f * u / width - 1.0f, 2.0f * v / height - 1.0f, 0.0f, 1.0f);
+	gl_PointSize = 2.0f; // closes most of the cracks where the other view is closer to the surface
+	vs_depth = localPosition.z;
+}
@@ -5,39 +5,180 @@ in vec2 TexCoords;
 
 uniform float width;
 uniform float height;
-uniform int radius;
-uniform int step;
-uniform int nrTextures;
+
+// Compiled per configuration (see ShaderController::SumRadiusShader), with #defines for:
+//  NR_NEIGHBORS: the nr of error textures (MVS neighbors) of the key view
+//  NR_TAPS, TAPS: the offsets within the window of aggregation (its radius and step), in the order they are summed
+const int nrTextures = NR_NEIGHBORS;
+const ivec2 taps[NR_TAPS] = ivec2[NR_TAPS](TAPS);
 
 uniform sampler2D errorTex[4]; 
 uniform sampler2D colorTex; 
 
+// for NCC (cost 2), errorTex holds the gray of each neighbor (-1 where it has none), and featureTex
+// the gray of the key view
+uniform int cost;
+uniform sampler2D featureTex;
+
+// the error textures only cover this region of the image (see tile.vs), TexCoords are image coordinates
+uniform vec4 texRegion;
+
+// coordinates in the error textures of a tap at imageCoords, clamped to the image like GL_CLAMP_TO_EDGE would
+vec2 ErrorCoords(vec2 imageCoords) {
+	vec2 halfTexel = 0.5f / vec2(width, height);
+	return (clamp(imageCoords, halfTexel, 1.0f - halfTexel) - texRegion.xy) / texRegion.zw;
+}
+
+// Depth prior of earlier key views (see MultiViewStereo::depthPrior):
+//  priorMode 0: every pixel is swept over all layers
+//  priorMode 1: pixels with a prior only sweep the layers within priorBand of it, the others all layers
+//  priorMode 2: only the pixels whose sweep around their prior found no good match (maskTex) sweep all layers
+// Pixels that skip a layer get an error that is never the lowest, without sampling anything.
+uniform int priorMode;
+uniform sampler2D priorTex; // reprojected depth, >= noPrior where there is none
+uniform sampler2D maskTex;  // mask after priorMode 1
+uniform int layer;
+uniform int priorBand;
+
+// depth of each layer (see MultiViewStereo::layerDepths)
+const int maxLayers = 64;
+uniform float layerDepths[maxLayers];
+uniform int nrLayers;
+
+const float noPrior = 1e29f;
+const float skipped = 9999;
+
+// fractional layer of a depth, piecewise linear between the layer depths
+float DepthToLayer(float depth)
+{
+	if (depth <= layerDepths[0]) return 0.0f;
+	if (depth >= layerDepths[nrLayers - 1]) return float(nrLayers - 1);
+	int lower = 0;
+	int upper = nrLayers - 1;
+	while (upper - lower > 1) {
+		int middle = (lower + upper) / 2;
+		if (layerDepths[middle] <= depth) lower = middle;
+		else upper = middle;
+	}
+	return lower + (depth - layerDepths[lower]) / (layerDepths[upper] - layerDepths[lower]);
+}
+
+// user mask of the key view (see quad_depth_error.fs), masked pixels are never swept
+uniform int useUserMasks;
+uniform sampler2D userMaskTex;
+
+// Region of interest (see RegionOfInterest.h): a layer is only swept where the ray of the pixel is inside the box,
+// including the layers on either side of where it enters and leaves the box
+uniform int useRoi;
+uniform mat4 roiFromCamera; // key camera -> box coordinates, in which the box is [-1, 1]^3
+uniform vec2 focal;
+uniform vec2 pp;
+
+bool InRoi()
+{
+	// ray with depth as parameter, like Unproject in write_splats.vs
+	vec3 direction = vec3((TexCoords.x * width - pp.x) / focal.x, (TexCoords.y * height - (height - pp.y)) / focal.y, 1.0f);
+	vec3 origin = (roiFromCamera * vec4(0, 0, 0, 1)).xyz;
+	direction = mat3(roiFromCamera) * direction;
+
+	// slab test
+	vec3 inverse = 1.0f / direction;
+	vec3 t0 = (-1.0f - origin) * inverse;
+	vec3 t1 = (1.0f - origin) * inverse;
+	vec3 tMin = min(t0, t1);
+	vec3 tMax = max(t0, t1);
+	float enter = max(max(tMin.x, tMin.y), tMin.z);
+	float leave = min(min(tMax.x, tMax.y), tMax.z);
+	if (leave < max(enter, 0.0f)) return false;
+
+	float before = layerDepths[max(layer - 1, 0)];
+	float after = layerDepths[min(layer + 1, nrLayers - 1)];
+	return after >= enter && before <= leave;
+}
+
+bool InSweep()
+{
+	if (useUserMasks == 1 && textureLod(userMaskTex, TexCoords, 0).r < 0.5f) return false;
+	if (useRoi == 1 && !InRoi()) return false;
+	if (priorMode == 0) return true;
+	float prior = texture(priorTex, TexCoords).r;
+	if (prior >= noPrior) return priorMode == 1;
+	if (priorMode == 2) return texture(maskTex, TexCoords).r < 0.5f;
+	float priorLayer = DepthToLayer(prior);
+	return abs(float(layer) - priorLayer) <= float(priorBand);
+}
+
+const float nccScale = 0.5f; // error = nccScale * (1 - NCC), to roughly match the range of the RGB difference
+
+float LowestNccError()
+{
+	// the statistics of both views are taken over the taps that are visible in the neighbor
+	float sumsMain[4] = float[4](0, 0, 0, 0);
+	float sumsMainSquared[4] = float[4](0, 0, 0, 0);
+	float sums[4] = float[4](0, 0, 0, 0);
+	float sumsSquared[4] = float[4](0, 0, 0, 0);
+	float products[4] = float[4](0, 0, 0, 0);
+	float counts[4] = float[4](0, 0, 0, 0);
+	float nrTaps = float(NR_TAPS);
+	for (int t = 0; t < NR_TAPS; t++) {
+		vec2 coordsNeighbor = TexCoords + vec2(taps[t].x / width, taps[t].y / height);
+		float gray_main = texture(featureTex, coordsNeighbor).r;
+		vec2 coordsError = ErrorCoords(coordsNeighbor);
+		for(int i = 0; i < nrTextures; i++){	
+			float gray_neighbor = texture(errorTex[i], coordsError).r;
+			if(gray_neighbor >= 0){
+				sumsMain[i] += gray_main; sumsMainSquared[i] += gray_main * gray_main;
+				sums[i] += gray_neighbor; sumsSquared[i] += gray_neighbor * gray_neighbor;
+				products[i] += gray_main * gray_neighbor; counts[i]++;
+			}
+		}
+	}
+	float lowest_error = nccScale;
+	for (int i = 0; i < nrTextures; i++) {
+		if(counts[i] < 0.5f * nrTaps) continue;
+		float meanMain = sumsMain[i] / counts[i];
+		float varianceMain = max(0, sumsMainSquared[i] / counts[i] - meanMain * meanMain);
+		float mean = sums[i] / counts[i];
+		float variance = max(0, sumsSquared[i] / counts[i] - mean * mean);
+		float covariance = products[i] / counts[i] - meanMain * mean;
+		float ncc = covariance / sqrt(varianceMain * variance + 1e-10f);
+		lowest_error = min(lowest_error, nccScale * (1 - clamp(ncc, -1.0f, 1.0f)));
+    }
+	return lowest_error;
+}
+
 void main()
 {
+	if(!InSweep()){
+		FragError = skipped;
+		return;
+	}
+
+	if(cost == 2){
+		FragError = LowestNccError();
+		return;
+	}
+
 	vec3 color_c = texture(colorTex, TexCoords).rgb;
 	
 	float sums[4] = float[4](0, 0, 0, 0);
 	float counts[4] = float[4](0, 0, 0, 0);
 	
-    for (int y = -radius; y <= radius; y+=step) {
-        for (int x = -radius; x <= radius; x+=step) {
-			float dist = length(vec2(x,y));
-			if(dist <= radius){
-				vec2 coordsNeighbor = TexCoords + vec2(x / width, y / height);
-				
-				// take color difference into account
-				vec3 color_n = texture(colorTex, coordsNeighbor).rgb;
-				float color_diff = length(color_c - color_n);
-				float weight = 1 / (5 * color_diff + 1); // small color differences have a larger weight then large color differences
-				
-				for(int i = 0; i < nrTextures; i++){	
-					float error = texture(errorTex[i], coordsNeighbor).r;
-					sums[i] += error * weight;
-					counts[i] += weight;
-				}
-			}
-        }
-    }
+	for (int t = 0; t < NR_TAPS; t++) {
+		vec2 coordsNeighbor = TexCoords + vec2(taps[t].x / width, taps[t].y / height);
+		
+		// take color difference into account
+		vec3 color_n = texture(colorTex, coordsNeighbor).rgb;
+		float color_diff = length(color_c - color_n);
+		float weight = 1 / (5 * color_diff + 1); // small color differences have a larger weight then large color differences
+		
+		vec2 coordsError = ErrorCoords(coordsNeighbor);
+		for(int i = 0; i < nrTextures; i++){	
+			float error = texture(errorTex[i], coordsError).r;
+			sums[i] += error * weight;
+			counts[i] += weight;
+		}
+	}
 	
 	// takes minimum
 	float lowest_error = 9999;
@@ -0,0 +1,15 @@
+// like copy_tex.vs, but the quad covers only a region of the input textures, e.g. a tile of the image
+
+#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+
+uniform vec4 texRegion; // xy: offset, zw: size, in texture coordinates. (0, 0, 1, 1) is the whole texture
+
+void main()
+{
+    TexCoords = texRegion.xy + aTexCoords * texRegion.zw;
+    gl_Position = vec4(aPos.x, aPos.y, 0.0f, 1.0f); 
+}  
@@ -5,17 +5,33 @@ layout(points, max_vertices = 1) out;
 in vec3 vs_position[];
 in vec3 vs_color[];
 in float vs_scale[];
+in vec3 vs_scales[];
+in vec4 vs_rotation[];
+in float vs_confidence[];
+in vec3 vs_sh1_0[];
+in vec3 vs_sh1_1[];
+in vec3 vs_sh1_2[];
 in int vs_mask[];
 
 out vec3 out_position;
 out vec3 out_color;
 out float out_scale;
+out vec3 out_scales;
+out vec4 out_rotation;
+out float out_confidence;
+out vec3 out_sh1[3];
 
 void main() {
 	if(vs_mask[0] > 0.5f) {
         out_position = vs_position[0];
 		out_color = vs_color[0];
 		out_scale = vs_scale[0];
+		out_scales = vs_scales[0];
+		out_rotation = vs_rotation[0];
+		out_confidence = vs_confidence[0];
+		out_sh1[0] = vs_sh1_0[0];
+		out_sh1[1] = vs_sh1_1[0];
+		out_sh1[2] = vs_sh1_2[0];
 		
         EmitVertex();
         EndPrimitive();
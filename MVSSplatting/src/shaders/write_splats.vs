@@ -1,9 +1,16 @@
 #version 330 core
 layout(location = 0) in vec2 TexCoords;
+layout(location = 1) in float SpacingFactor; // spacing between probes, relative to the uniform grid
 
 out vec3 vs_position;
 out vec3 vs_color;
 out float vs_scale;
+out vec3 vs_scales;   // along the 2 tangents and the normal of the surface
+out vec4 vs_rotation; // quaternion (w, x, y, z) that rotates the x, y and z axes onto the tangents and normal
+out float vs_confidence;
+out vec3 vs_sh1_0;    // degree-1 SH, see Splat::sh1
+out vec3 vs_sh1_1;
+out vec3 vs_sh1_2;
 out int vs_mask;
 
 uniform float width;
@@ -13,26 +20,190 @@ uniform vec2 focal;
 uniform vec2 pp;
 
 uniform float diameter;
+uniform vec2 texelSize; // 1 / resolution of the depth map
+
+const float maxStretch = 4.0f;  // max elongation of a splat on a slanted surface
+const float thickness = 0.1f;   // scale along the normal, relative to the smallest tangent scale
 
 uniform sampler2D colorTex;
 uniform sampler2D depthTex;
 uniform sampler2D maskTex;
+uniform sampler2D confidenceTex;
+
+// multi-view color: the color is a robust mean over the key view and the reprojections in its MVS neighbors
+uniform int nrNeighbors; // 0: only the color of the key view
+uniform sampler2D neighborColorTex[4];
+uniform mat4 neighborView[4];
+uniform vec3 neighborPosition[4];
+uniform vec3 cameraPosition; // of the key view
+uniform bool fitSh1;         // also fit degree-1 SH to the colors per view direction
+
+// region of interest: splats outside the box are not emitted
+uniform bool useRoi;
+uniform mat4 roiFromWorld; // world -> box coordinates, in which the box is [-1, 1]^3
+
+const float colorInlierRange = 0.1f; // deviation from the median color at which an observation gets half the weight
+const float shRidge = 0.01f;         // regularization of the SH coefficients, relative to the total weight
+const float maxSh1 = 0.5f;
+const float C1 = 0.4886025119029199f;
+
+// perspective unprojection
+vec3 Unproject(vec2 texCoords) {
+	float depth = texture(depthTex, texCoords).x;
+	float x = (texCoords.x * width - pp.x) / focal.x * depth;
+	float y = (texCoords.y * height - (pp.y + 2.0f * (height * 0.5f - pp.y))) / focal.y * depth;
+	return vec3(x, y, depth);
+}
+
+// difference to the neighboring pixel on the side with the smallest depth change, so depth discontinuities don't tilt the normal
+vec3 SurfaceDerivative(vec3 position, vec2 offset) {
+	vec3 forward = Unproject(TexCoords + offset) - position;
+	vec3 backward = position - Unproject(TexCoords - offset);
+	return abs(forward.z) < abs(backward.z) ? forward : backward;
+}
+
+vec4 RotationToQuaternion(mat3 m) {
+	// m[column][row]
+	float trace = m[0][0] + m[1][1] + m[2][2];
+	if (trace > 0.0f) {
+		float s = sqrt(trace + 1.0f) * 2.0f;
+		return vec4(0.25f * s, (m[1][2] - m[2][1]) / s, (m[2][0] - m[0][2]) / s, (m[0][1] - m[1][0]) / s);
+	}
+	else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+		float s = sqrt(1.0f + m[0][0] - m[1][1] - m[2][2]) * 2.0f;
+		return vec4((m[1][2] - m[2][1]) / s, 0.25f * s, (m[1][0] + m[0][1]) / s, (m[2][0] + m[0][2]) / s);
+	}
+	else if (m[1][1] > m[2][2]) {
+		float s = sqrt(1.0f + m[1][1] - m[0][0] - m[2][2]) * 2.0f;
+		return vec4((m[2][0] - m[0][2]) / s, (m[1][0] + m[0][1]) / s, 0.25f * s, (m[2][1] + m[1][2]) / s);
+	}
+	else {
+		float s = sqrt(1.0f + m[2][2] - m[0][0] - m[1][1]) * 2.0f;
+		return vec4((m[0][1] - m[1][0]) / s, (m[2][0] + m[0][2]) / s, (m[2][1] + m[1][2]) / s, 0.25f * s);
+	}
+}
+
+// GLSL 3.30 only allows constant indices into sampler arrays
+vec3 NeighborColor(int i, vec2 coords) {
+	if (i == 0) return textureLod(neighborColorTex[0], coords, 0.0f).rgb;
+	if (i == 1) return textureLod(neighborColorTex[1], coords, 0.0f).rgb;
+	if (i == 2) return textureLod(neighborColorTex[2], coords, 0.0f).rgb;
+	return textureLod(neighborColorTex[3], coords, 0.0f).rgb;
+}
+
+float Median(float values[5], int n) {
+	for (int i = 1; i < n; i++) {
+		float value = values[i];
+		int j = i;
+		while (j > 0 && values[j - 1] > value) {
+			values[j] = values[j - 1];
+			j--;
+		}
+		values[j] = value;
+	}
+	return n % 2 == 1 ? values[n / 2] : 0.5f * (values[n / 2 - 1] + values[n / 2]);
+}
+
+// Observe the point in the key view (keyColor) and every neighbor that sees it, weigh the observations by how close
+// they are to the per channel median (so occlusions and highlights in 1 view are ignored), and take the weighted mean.
+// With fitSh1, fit color + degree-1 SH of the view direction instead, by weighted ridge regression.
+void MultiViewColor(vec3 position, vec3 keyColor) {
+	vec3 colors[5];
+	vec3 directions[5];
+	colors[0] = keyColor;
+	directions[0] = normalize(position - cameraPosition);
+	int n = 1;
+	for (int i = 0; i < nrNeighbors; i++) {
+		vec4 local = neighborView[i] * vec4(position, 1.0f);
+		if (local.z <= 0.0f) continue;
+		// inverse of Unproject
+		vec2 coords = vec2((local.x / local.z * focal.x + pp.x) / width, (local.y / local.z * focal.y + height - pp.y) / height);
+		if (any(lessThan(coords, vec2(0.0f))) || any(greaterThan(coords, vec2(1.0f)))) continue;
+		colors[n] = NeighborColor(i, coords);
+		directions[n] = normalize(position - neighborPosition[i]);
+		n++;
+	}
+
+	vec3 median;
+	for (int c = 0; c < 3; c++) {
+		float values[5];
+		for (int j = 0; j < n; j++) values[j] = colors[j][c];
+		median[c] = Median(values, n);
+	}
+
+	float weights[5];
+	float sumWeights = 0.0f;
+	vec3 sumColors = vec3(0.0f);
+	for (int j = 0; j < n; j++) {
+		float deviation = length(colors[j] - median) / colorInlierRange;
+		weights[j] = 1.0f / (1.0f + deviation * deviation);
+		sumWeights += weights[j];
+		sumColors += weights[j] * colors[j];
+	}
+	vs_color = sumColors / sumWeights;
+	vs_sh1_0 = vec3(0.0f);
+	vs_sh1_1 = vec3(0.0f);
+	vs_sh1_2 = vec3(0.0f);
+	if (!fitSh1 || n < 2) return;
+
+	// color per channel = dot(x, basis), with x = (color, SH coefficients of -C1 y, C1 z and -C1 x)
+	mat4 normalMatrix = mat4(0.0f);
+	vec4 rhs[3] = vec4[3](vec4(0.0f), vec4(0.0f), vec4(0.0f));
+	for (int j = 0; j < n; j++) {
+		vec4 basis = vec4(1.0f, -C1 * directions[j].y, C1 * directions[j].z, -C1 * directions[j].x);
+		normalMatrix += weights[j] * outerProduct(basis, basis);
+		for (int c = 0; c < 3; c++) rhs[c] += weights[j] * colors[j][c] * basis;
+	}
+	for (int k = 1; k < 4; k++) normalMatrix[k][k] += shRidge * sumWeights;
+	mat4 inverseMatrix = inverse(normalMatrix);
+	vec4 x[3] = vec4[3](inverseMatrix * rhs[0], inverseMatrix * rhs[1], inverseMatrix * rhs[2]);
+	vs_color = clamp(vec3(x[0].x, x[1].x, x[2].x), 0.0f, 1.0f);
+	vs_sh1_0 = clamp(vec3(x[0].y, x[1].y, x[2].y), -maxSh1, maxSh1);
+	vs_sh1_1 = clamp(vec3(x[0].z, x[1].z, x[2].z), -maxSh1, maxSh1);
+	vs_sh1_2 = clamp(vec3(x[0].w, x[1].w, x[2].w), -maxSh1, maxSh1);
+}
 
 void main() {
 	
-	float depth = texture(depthTex, TexCoords).x;
-	
-	// perspective unprojection
-	float x = (TexCoords.x * width - pp.x) / focal.x * depth;
-	float y = (TexCoords.y * height - (pp.y + 2.0f * (height * 0.5f - pp.y))) / focal.y * depth;
-	
-	vec4 localPosition = vec4(x,y,depth,1.0f);
+	vec4 localPosition = vec4(Unproject(TexCoords), 1.0f);
 	vec4 worldPosition = model * localPosition;
 	worldPosition = worldPosition / worldPosition.w;
 	
     vs_position = worldPosition.xyz;
 	vs_color = texture(colorTex, TexCoords).rgb;
-	vs_scale = length(localPosition.xyz) * diameter;
+	vs_sh1_0 = vec3(0.0f);
+	vs_sh1_1 = vec3(0.0f);
+	vs_sh1_2 = vec3(0.0f);
+	if (nrNeighbors > 0) {
+		MultiViewColor(worldPosition.xyz, vs_color);
+	}
+	vs_scale = length(localPosition.xyz) * diameter * SpacingFactor;
+
+	// surface normal and footprint of 1 pixel, from the depth map
+	vec3 dx = SurfaceDerivative(localPosition.xyz, vec2(texelSize.x, 0));
+	vec3 dy = SurfaceDerivative(localPosition.xyz, vec2(0, texelSize.y));
+	vec3 normal = cross(dx, dy);
+	if (length(normal) < 1e-20f) {
+		normal = -localPosition.xyz; // degenerate: face the camera
+	}
+	normal = normalize(normal);
+	if (dot(normal, localPosition.xyz) > 0.0f) {
+		normal = -normal;
+	}
+	vec3 tangent = dx - dot(dx, normal) * normal;
+	tangent = length(tangent) > 1e-20f ? normalize(tangent) : normalize(cross(normal, abs(normal.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0)));
+	vec3 bitangent = cross(normal, tangent);
+
+	// stretch the isotropic scale by how much a slanted surface enlarges the footprint of a pixel
+	vec2 frontoParallel = length(localPosition.xyz) * texelSize * vec2(width, height) / focal;
+	float scaleX = vs_scale * clamp(length(dx) / frontoParallel.x, 1.0f, maxStretch);
+	float scaleY = vs_scale * clamp(length(dy) / frontoParallel.y, 1.0f, maxStretch);
+	vs_scales = vec3(scaleX, scaleY, thickness * min(scaleX, scaleY));
+	vs_rotation = RotationToQuaternion(mat3(model) * mat3(tangent, bitangent, normal));
 	
+	vs_confidence = texture(confidenceTex, TexCoords).x;
 	vs_mask = texture(maskTex, TexCoords).x > 0.5f? 1 : 0;
+	if (useRoi && any(greaterThan(abs((roiFromWorld * worldPosition).xyz), vec3(1.0f)))) {
+		vs_mask = 0;
+	}
 }
@@ -22,7 +22,7 @@ class Scene:
 
     gaussians : GaussianModel
 
-    def __init__(self, args : ModelParams, gaussians : GaussianModel, load_iteration=None, shuffle=True, resolution_scales=[1.0], splat_init_mode="colmap", ply_path=None):
+    def __init__(self, args : ModelParams, gaussians : GaussianModel, load_iteration=None, shuffle=True, resolution_scales=[1.0], splat_init_mode="colmap", ply_path=None, mvs_path=None, min_confidence=0.0):
         """b
         :param path: Path to colmap scene main folder.
         """
@@ -81,8 +81,14 @@ class Scene:
                                                            "point_cloud.ply"), args.train_test_exp)
         else:
             if splat_init_mode == "mvs":
-                bin_path = os.path.join(args.source_path, "sparse/0/points3D_mvs.bin")
-                self.gaussians.create_from_mvs_bin(bin_path, scene_info.train_cameras, self.cameras_extent)
+                # the given MVSSplatting output, else .mvss (which has the orientation, confidence and SH of the splats) over .bin
+                bin_path = mvs_path
+                if bin_path is None:
+                    bin_path = os.path.join(args.source_path, "sparse/0/points3D_mvs.mvss")
+                    if not os.path.exists(bin_path):
+                        bin_path = os.path.join(args.source_path, "sparse/0/points3D_mvs.bin")
+                print("Initializing the splats from " + bin_path)
+                self.gaussians.create_from_mvs_bin(bin_path, scene_info.train_cameras, self.cameras_extent, min_confidence)
             else:
                 self.gaussians.create_from_pcd(scene_info.point_cloud, scene_info.train_cameras, self.cameras_extent)
 
@@ -16,6 +16,7 @@ from typing import NamedTuple
 from scene.colmap_loader import read_extrinsics_text, read_intrinsics_text, qvec2rotmat, \
     read_extrinsics_binary, read_intrinsics_binary, read_points3D_binary, read_points3D_text
 from utils.graphics_utils import getWorld2View2, focal2fov, fov2focal
+from utils.undistort_utils import DISTORTED_MODELS, pinhole, undistortion_maps
 import numpy as np
 import json
 from pathlib import Path
@@ -36,6 +37,7 @@ class CameraInfo(NamedTuple):
     width: int
     height: int
     is_test: bool
+    undistortion_maps: tuple = None # of distorted COLMAP cameras (see utils/undistort_utils.py)
 
 class SceneInfo(NamedTuple):
     point_cloud: BasicPointCloud
@@ -70,6 +72,7 @@ def getNerfppNorm(cam_info):
 
 def readColmapCameras(cam_extrinsics, cam_intrinsics, depths_params, images_folder, depths_folder, test_cam_names_list):
     cam_infos = []
+    maps_per_camera = {}
     for idx, key in enumerate(cam_extrinsics):
         sys.stdout.write('\r')
         # the exact output you're looking for:
@@ -94,8 +97,15 @@ def readColmapCameras(cam_extrinsics, cam_intrinsics, depths_params, images_fold
             focal_length_y = intr.params[1]
             FovY = focal2fov(focal_length_y, height)
             FovX = focal2fov(focal_length_x, width)
+        elif intr.model in DISTORTED_MODELS:
+            # undistorted while loading, to the pinhole camera with the same focal length and principal point
+            focal_length_x, focal_length_y, _, _ = pinhole(intr.model, intr.params)
+            FovY = focal2fov(focal_length_y, height)
+            FovX = focal2fov(focal_length_x, width)
+            if intr.id not in maps_per_camera:
+                maps_per_camera[intr.id] = undistortion_maps(intr)
         else:
-            assert False, "Colmap camera model not handled: only undistorted datasets (PINHOLE or SIMPLE_PINHOLE cameras) supported!"
+            assert False, "Colmap camera model not handled: only PINHOLE, SIMPLE_PINHOLE and the models of utils/undistort_utils.py are supported!"
 
         n_remove = len(extr.name.split('.')[-1]) + 1
         depth_params = None
@@ -111,7 +121,8 @@ def readColmapCameras(cam_extrinsics, cam_intrinsics, depths_params, images_fold
 
         cam_info = CameraInfo(uid=uid, R=R, T=T, FovY=FovY, FovX=FovX, depth_params=depth_params,
                               image_path=image_path, image_name=image_name, depth_path=depth_path,
-                              width=width, height=height, is_test=image_name in test_cam_names_list)
+                              width=width, height=height, is_test=image_name in test_cam_names_list,
+                              undistortion_maps=maps_per_camera.get(intr.id))
         cam_infos.append(cam_info)
 
     sys.stdout.write('\n')
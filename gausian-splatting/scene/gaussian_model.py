@@ -20,6 +20,7 @@ from plyfile import PlyData, PlyElement
 from utils.sh_utils import RGB2SH
 from simple_knn._C import distCUDA2
 from utils.graphics_utils import BasicPointCloud
+from utils.mvss_utils import read_mvss
 from utils.general_utils import strip_symmetric, build_scaling_rotation
 
 try:
@@ -175,11 +176,23 @@ class GaussianModel:
         exposure = torch.eye(3, 4, device="cuda")[None].repeat(len(cam_infos), 1, 1)
         self._exposure = nn.Parameter(exposure.requires_grad_(True))
 
-    def create_from_mvs_bin(self, bin_path : str, cam_infos : int, spatial_lr_scale : float):
+    def create_from_mvs_bin(self, bin_path : str, cam_infos : int, spatial_lr_scale : float, min_confidence : float = 0.0):
         self.spatial_lr_scale = spatial_lr_scale
         
-        data = np.fromfile(bin_path, dtype=np.float32)  # shape (N*7,)
-        data = data.reshape((-1,7))  # (N,7)
+        splats = None
+        if bin_path.endswith(".mvss"):
+            splats = read_mvss(bin_path)
+            if min_confidence > 0 and "confidence" in splats:
+                # drop the splats of unreliable MVS depths (the Colmap points have confidence 1)
+                kept = splats["confidence"][:, 0] >= min_confidence
+                print("Dropped {} of {} splats with a confidence below {}".format(int((~kept).sum()), len(kept), min_confidence))
+                splats = {name: values[kept] for name, values in splats.items()}
+            data = np.concatenate((splats["position"], splats["color"], splats["scale"]), axis=1)  # (N,7)
+        else:
+            if min_confidence > 0:
+                print("Warning: {} has no confidences, --min_confidence is ignored (use --format mvss)".format(bin_path))
+            data = np.fromfile(bin_path, dtype=np.float32)  # shape (N*7,)
+            data = data.reshape((-1,7))  # (N,7)
         data = torch.from_numpy(data).cuda()
         
         fused_point_cloud = data[:,:3]
@@ -187,15 +200,29 @@ class GaussianModel:
         features = torch.zeros((fused_color.shape[0], 3, (self.max_sh_degree + 1) ** 2)).float().cuda()
         features[:, :3, 0 ] = fused_color
         features[:, 3:, 1:] = 0.0
+        if splats is not None and "sh1" in splats and self.max_sh_degree >= 1:
+            # degree-1 SH fitted to the colors of multiple views, (N, 3 basis functions, RGB)
+            sh1 = torch.from_numpy(splats["sh1"]).float().cuda().reshape(-1, 3, 3)
+            features[:, :3, 1:4] = sh1.transpose(1, 2)
         
-        scales = data[:,6:].repeat(1, 3)
-        scales = torch.log(scales).float().cuda()
-        
-        # [qw, qx, qy, qz]
-        rots = torch.zeros((fused_point_cloud.shape[0], 4), dtype=torch.float, device="cuda")
-        rots[:,0] = 1
+        if splats is not None and "scales" in splats and "rotation" in splats:
+            # oriented along the surface normals of the depth maps, [qw, qx, qy, qz]
+            scales = torch.log(torch.from_numpy(splats["scales"]).clamp_min(1e-12)).float().cuda()
+            rots = torch.nn.functional.normalize(torch.from_numpy(splats["rotation"]).float().cuda(), dim=1)
+        else:
+            scales = data[:,6:].repeat(1, 3)
+            scales = torch.log(scales).float().cuda()
+            
+            # [qw, qx, qy, qz]
+            rots = torch.zeros((fused_point_cloud.shape[0], 4), dtype=torch.float, device="cuda")
+            rots[:,0] = 1
         
-        opacities = torch.ones((fused_point_cloud.shape[0], 1), dtype=torch.float, device="cuda") * 0.5
+        if splats is not None and "confidence" in splats:
+            # reliable MVS depths start more opaque, confidence 0.5 gives the default opacity of 0.5
+            confidence = torch.from_numpy(splats["confidence"]).float().cuda().clamp(0.0, 1.0)
+            opacities = 0.1 + 0.8 * confidence
+        else:
+            opacities = torch.ones((fused_point_cloud.shape[0], 1), dtype=torch.float, device="cuda") * 0.5
         opacities = self.inverse_opacity_activation(opacities)
         
         print("Number of points at initialisation : ", fused_point_cloud.shape[0])
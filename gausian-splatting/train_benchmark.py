@@ -50,7 +50,7 @@ lpips_model = LPIPS(net_type='vgg', version='0.1').cuda().eval()
 start_time = time.time()
 accum_duration = 0
 
-def training(dataset, opt, pipe, testing_iterations, saving_iterations, checkpoint_iterations, checkpoint, debug_from, save_images, is_eval, splat_init_mode, ply_path):
+def training(dataset, opt, pipe, testing_iterations, saving_iterations, checkpoint_iterations, checkpoint, debug_from, save_images, is_eval, splat_init_mode, ply_path, mvs_path, min_confidence):
 
     if not SPARSE_ADAM_AVAILABLE and opt.optimizer_type == "sparse_adam":
         sys.exit(f"Trying to use sparse adam but it is not installed, please install the correct rasterizer using pip install [3dgs_accel].")
@@ -58,7 +58,7 @@ def training(dataset, opt, pipe, testing_iterations, saving_iterations, checkpoi
     first_iter = 0
     tb_writer = prepare_output_and_logger(dataset, save_images)
     gaussians = GaussianModel(dataset.sh_degree, opt.optimizer_type)
-    scene = Scene(dataset, gaussians, splat_init_mode=splat_init_mode, ply_path=ply_path)
+    scene = Scene(dataset, gaussians, splat_init_mode=splat_init_mode, ply_path=ply_path, mvs_path=mvs_path, min_confidence=min_confidence)
     gaussians.training_setup(opt)
     if checkpoint:
         (model_params, first_iter) = torch.load(checkpoint)
@@ -368,6 +368,8 @@ if __name__ == "__main__":
     parser.add_argument("--splat_init", type=str, default = "mvs")
     parser.add_argument("--save_images", nargs="+", type=str, default=[])
     parser.add_argument("--ply_path", type=str, default = None)
+    parser.add_argument("--mvs_path", type=str, default = None)
+    parser.add_argument("--min_confidence", type=float, default = 0.0)
     
     args = parser.parse_args(sys.argv[1:])
     
@@ -381,6 +383,9 @@ if __name__ == "__main__":
     
     if args.splat_init != "mvsgaussian":
         args.ply_path = None
+    if args.mvs_path is not None and not (args.mvs_path.endswith(".mvss") or args.mvs_path.endswith(".bin")):
+        print("Unexpected value for --mvs_path: should be an .mvss or .bin file written by MVSSplatting")
+        exit(0)
     
     if args.iterations not in args.save_iterations:
         args.save_iterations.append(args.iterations)
@@ -396,7 +401,7 @@ if __name__ == "__main__":
     if not args.disable_viewer:
         network_gui.init(args.ip, args.port)
     torch.autograd.set_detect_anomaly(args.detect_anomaly)
-    training(lp.extract(args), op.extract(args), pp.extract(args), args.test_iterations, args.save_iterations, args.checkpoint_iterations, args.start_checkpoint, args.debug_from, args.save_images, args.eval, args.splat_init, args.ply_path)
+    training(lp.extract(args), op.extract(args), pp.extract(args), args.test_iterations, args.save_iterations, args.checkpoint_iterations, args.start_checkpoint, args.debug_from, args.save_images, args.eval, args.splat_init, args.ply_path, args.mvs_path, args.min_confidence)
 
     # All done
     print("\nTraining complete.")
@@ -14,11 +14,14 @@ import numpy as np
 from utils.graphics_utils import fov2focal
 from PIL import Image
 import cv2
+from utils.undistort_utils import undistort_image
 
 WARNED = False
 
 def loadCam(args, id, cam_info, resolution_scale, is_nerf_synthetic, is_test_dataset):
     image = Image.open(cam_info.image_path)
+    if cam_info.undistortion_maps is not None:
+        image = undistort_image(image, cam_info.undistortion_maps)
 
     if cam_info.depth_path != "":
         try:
@@ -0,0 +1,101 @@
+#
+# Reader for the .mvss splat files written by MVSSplatting (see SplatWriter.h for the layout).
+#
+
+import numpy as np
+
+MVSS_VERSION = 2
+HEADER_SIZE = 56
+ATTRIBUTE_SIZE = 24
+CHUNK_ENTRY_SIZE = 40
+
+# attribute type -> numpy dtype of one component
+ATTRIBUTE_DTYPES = {0: np.float32, 1: np.float16, 2: np.uint16, 3: np.uint8}
+
+NO_PARENT = 0xffffffff
+
+class MvssFile:
+    """Memory maps an .mvss file, so that its (Morton-ordered) chunks can be decoded one by one.
+    A hierarchy (written with --lod) has a chunk per octree node: the leaves hold the original splats,
+    the other nodes merged splats that approximate their subtree."""
+
+    def __init__(self, path : str):
+        self.data = np.memmap(path, dtype=np.uint8, mode="r")
+        if self.data[:4].tobytes() != b"MVSS":
+            raise ValueError("{} is not an mvss file".format(path))
+
+        header = self.data[4:HEADER_SIZE]
+        self.version = int(header[0:4].view(np.uint32)[0])
+        if self.version > MVSS_VERSION:
+            raise ValueError("{} has mvss version {}, only up to {} is supported".format(path, self.version, MVSS_VERSION))
+        self.count = int(header[4:12].view(np.uint64)[0])
+        nr_chunks, nr_attributes, self.chunk_size, flags = header[12:28].view(np.uint32)
+        self.quantized = bool(flags & 1)
+        self.hierarchy = bool(flags & 2)
+        self.bounds = header[28:52].view(np.float32).reshape(2, 3).copy()
+
+        self.attributes = []
+        fields = []
+        offset = HEADER_SIZE
+        for _ in range(nr_attributes):
+            entry = self.data[offset:offset + ATTRIBUTE_SIZE]
+            name = entry[:16].tobytes().split(b"\0")[0].decode()
+            attribute_type, nr_components = entry[16:24].view(np.uint32)
+            self.attributes.append((name, int(attribute_type), int(nr_components)))
+            fields.append((name, ATTRIBUTE_DTYPES[int(attribute_type)], (int(nr_components),)))
+            offset += ATTRIBUTE_SIZE
+        self.record_dtype = np.dtype(fields)
+
+        table = self.data[offset:offset + int(nr_chunks) * CHUNK_ENTRY_SIZE].reshape(-1, CHUNK_ENTRY_SIZE)
+        self.chunk_offsets = table[:, 0:8].copy().view(np.uint64).ravel()
+        self.chunk_counts = table[:, 8:12].copy().view(np.uint32).ravel()
+        self.chunk_bounds = table[:, 16:40].copy().view(np.float32).reshape(-1, 2, 3)
+        if self.hierarchy:
+            self.parents = table[:, 12:16].copy().view(np.uint32).ravel()
+            self.levels = np.zeros(len(self.parents), dtype=np.int32)
+            for index, parent in enumerate(self.parents):
+                # breadth-first order: a parent always comes before its children
+                if parent != NO_PARENT:
+                    self.levels[index] = self.levels[parent] + 1
+            has_children = np.zeros(len(self.parents), dtype=bool)
+            has_children[self.parents[self.parents != NO_PARENT]] = True
+            self.leaves = np.nonzero(~has_children)[0]
+
+    def children(self, index : int):
+        return np.nonzero(self.parents == index)[0]
+
+    def __len__(self):
+        return len(self.chunk_counts)
+
+    def read_chunk(self, index : int):
+        """Returns a dict with a float32 array of shape (n, components) per attribute."""
+        offset = int(self.chunk_offsets[index])
+        count = int(self.chunk_counts[index])
+        records = np.frombuffer(self.data, dtype=self.record_dtype, count=count, offset=offset)
+        chunk = {}
+        for name, attribute_type, _ in self.attributes:
+            values = records[name].astype(np.float32)
+            if attribute_type == 2:
+                values /= 65535.0
+                if name == "position":
+                    chunk_min, chunk_max = self.chunk_bounds[index]
+                    values = chunk_min + values * (chunk_max - chunk_min)
+            elif attribute_type == 3:
+                values /= 255.0
+            chunk[name] = values
+        return chunk
+
+    def chunks(self, indices=None):
+        for index in (range(len(self)) if indices is None else indices):
+            yield self.read_chunk(index)
+
+    def read_all(self):
+        """All splats, at full detail (only the leaves of a hierarchy)."""
+        chunks = list(self.chunks(self.leaves if self.hierarchy else None))
+        if not chunks:
+            # the same shapes and dtype as read_chunk
+            return {name: np.zeros((0, nr_components), dtype=np.float32) for name, _, nr_components in self.attributes}
+        return {name: np.concatenate([chunk[name] for chunk in chunks]) for name, _, _ in self.attributes}
+
+def read_mvss(path : str):
+    return MvssFile(path).read_all()
@@ -0,0 +1,72 @@
+#
+# Undistortion of the COLMAP camera models with lens distortion while the images are loaded, like MVSSplatting does
+# (see Undistorter.h and Intrinsics::Distort), so the dataset does not need COLMAP's image_undistorter first.
+# Each camera becomes the pinhole camera with the same resolution, focal length and principal point.
+#
+
+import numpy as np
+import cv2
+from PIL import Image
+
+# model name -> index of the first distortion parameter (after the focal lengths and principal point)
+DISTORTED_MODELS = {
+    "SIMPLE_RADIAL": 3, "RADIAL": 3, "OPENCV": 4, "OPENCV_FISHEYE": 4, "FULL_OPENCV": 4,
+    "SIMPLE_RADIAL_FISHEYE": 3, "RADIAL_FISHEYE": 3
+}
+
+def pinhole(model, params):
+    """(fx, fy, cx, cy) of a COLMAP camera"""
+    if model in ("PINHOLE", "OPENCV", "OPENCV_FISHEYE", "FULL_OPENCV"):
+        return params[0], params[1], params[2], params[3]
+    return params[0], params[0], params[1], params[2]
+
+def distort(model, params, x, y):
+    """normalized image coordinates (x / z, y / z) -> their distorted position"""
+    d = params[DISTORTED_MODELS[model]:]
+    k = np.zeros(6)
+    p = np.zeros(2)
+    if model in ("SIMPLE_RADIAL", "SIMPLE_RADIAL_FISHEYE"):
+        k[0] = d[0]
+    elif model in ("RADIAL", "RADIAL_FISHEYE"):
+        k[:2] = d[:2]
+    elif model == "OPENCV":
+        k[:2], p[:] = d[:2], d[2:4]
+    elif model == "OPENCV_FISHEYE":
+        k[:4] = d[:4]
+    elif model == "FULL_OPENCV":
+        k[:2], p[:], k[2:6] = d[:2], d[2:4], d[4:8]
+
+    if "FISHEYE" in model:
+        r = np.sqrt(x * x + y * y)
+        theta = np.arctan(r)
+        theta2 = theta * theta
+        theta_distorted = theta * (1 + theta2 * (k[0] + theta2 * (k[1] + theta2 * (k[2] + theta2 * k[3]))))
+        scale = np.where(r < 1e-8, 1.0, theta_distorted / np.maximum(r, 1e-8))
+        return x * scale, y * scale
+
+    r2 = x * x + y * y
+    radial = (1 + r2 * (k[0] + r2 * (k[1] + r2 * k[2]))) / (1 + r2 * (k[3] + r2 * (k[4] + r2 * k[5])))
+    xy2 = 2 * x * y
+    return x * radial + p[0] * xy2 + p[1] * (r2 + 2 * x * x), y * radial + p[1] * xy2 + p[0] * (r2 + 2 * y * y)
+
+def undistortion_maps(intr):
+    """maps for cv2.remap from the pinhole camera to the distorted image of a COLMAP camera, None if it has no distortion"""
+    if intr.model not in DISTORTED_MODELS:
+        return None
+    fx, fy, cx, cy = pinhole(intr.model, intr.params)
+    # COLMAP's convention: the center of the top-left pixel is at (0.5, 0.5), cv2's at (0, 0)
+    col, row = np.meshgrid(np.arange(intr.width) + 0.5, np.arange(intr.height) + 0.5)
+    x, y = distort(intr.model, intr.params, (col - cx) / fx, (row - cy) / fy)
+    return (fx * x + cx - 0.5).astype(np.float32), (fy * y + cy - 0.5).astype(np.float32)
+
+def undistort_image(image, maps):
+    """Remaps a PIL image with the maps of undistortion_maps. The pixels outside the distorted image are black with
+    alpha 0, so the training ignores them (the render is multiplied with Camera.alpha_mask)."""
+    rgb = np.asarray(image.convert("RGB"))
+    undistorted = cv2.remap(rgb, maps[0], maps[1], cv2.INTER_LINEAR, borderMode=cv2.BORDER_REPLICATE)
+    inside = (maps[0] >= -0.5) & (maps[0] <= rgb.shape[1] - 0.5) & (maps[1] >= -0.5) & (maps[1] <= rgb.shape[0] - 0.5)
+    undistorted[~inside] = 0
+    alpha = np.where(inside, 255, 0).astype(np.uint8)
+    if image.mode == "RGBA":
+        alpha = np.minimum(alpha, cv2.remap(np.asarray(image)[..., 3], maps[0], maps[1], cv2.INTER_NEAREST, borderMode=cv2.BORDER_CONSTANT, borderValue=0))
+    return Image.fromarray(np.dstack([undistorted, alpha]), "RGBA")